@@ -5,10 +5,40 @@
  * @addtogroup BLUETOOTH
  * @{
  */
+#include "ch.h"
 #include "hal.h"
 #include "bluetooth.h"
 #if HAL_USE_BLUETOOTH || defined(__DOXYGEN__) || 1
 
+/*!
+ * \brief Working area of the thread running btOpenAsync
+ */
+static WORKING_AREA(btOpenThreadWa, BLUETOOTH_OPEN_THREAD_STACK_SIZE);
+
+/*!
+ * \brief Thread running btOpenAsync, NULL if it was never started
+ */
+static Thread *btOpenThreadTp = NULL;
+
+/*!
+ * \brief Initializes a BluetoothDriver object
+ *
+ * Must be called once before the eventSource of the driver is used (btOpenAsync, listeners).
+ *
+ * \param[in] instance A BluetoothDriver object
+ */
+void btObjectInit(struct BluetoothDriver *instance){
+
+    if (!instance)
+        return;
+
+    chEvtInit(&instance->eventSource);
+    instance->driverIsReady = 0;
+    instance->openInProgress = 0;
+    instance->btInputQueue = NULL;
+    instance->btOutputQueue = NULL;
+}
+
 /*!
  * \brief Sends a buffer of data through the specified BluetoothDriver
  *
@@ -96,10 +126,100 @@ int btRead(struct BluetoothDriver *instance, char *buffer, int maxlen){
  */
 int btOpen(struct BluetoothDriver *instance, struct BluetoothConfig *config){
 
+    int retval;
+
+    if (!instance || !config)
+        return EXIT_FAILURE;
+
+    retval = instance->vmt->open(instance, config);
+    instance->driverIsReady = (retval == EXIT_SUCCESS);
+
+    return retval;
+}
+
+/*!
+ * \brief Thread running the module bring-up for btOpenAsync
+ *
+ * \param[in] arg A BluetoothDriver object
+ * \return the result of btOpen
+ */
+static msg_t btOpenThread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    int retval;
+
+    chRegSetThreadName("btopen");
+
+    retval = btOpen(instance, instance->config);
+
+    instance->openInProgress = 0;
+    chEvtBroadcastFlags(&instance->eventSource,
+                        retval == EXIT_SUCCESS ? BT_EVENT_OPENED : BT_EVENT_OPEN_FAILED);
+
+    return (msg_t)retval;
+}
+
+/*!
+ * \brief Starts the driver in the background
+ *
+ * Same as btOpen, but the module bring-up runs in its own thread and the call returns at once.
+ * BT_EVENT_OPENED or BT_EVENT_OPEN_FAILED is broadcast on the eventSource when it is done,
+ * driverIsReady shows the result too. Only one driver can be opening at a time.
+ *
+ * \param[in] instance A BluetoothDriver object, initialized with btObjectInit
+ * \param[in] config A BluetoothConfig the use
+ * \return EXIT_SUCCESS if the bring-up was started, EXIT_FAILURE otherwise
+ */
+int btOpenAsync(struct BluetoothDriver *instance, struct BluetoothConfig *config){
+
     if (!instance || !config)
         return EXIT_FAILURE;
 
-    return instance->vmt->open(instance, config);
+    if (btOpenThreadTp && !chThdTerminated(btOpenThreadTp))
+        return EXIT_FAILURE;
+
+    instance->config = config;
+    instance->driverIsReady = 0;
+    instance->openInProgress = 1;
+
+    btOpenThreadTp = chThdCreateStatic(btOpenThreadWa, sizeof(btOpenThreadWa),
+                                       NORMALPRIO, btOpenThread, instance);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Waits until btOpenAsync finishes
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] timeout Maximum time to wait, TIME_INFINITE to wait forever
+ * \return EXIT_SUCCESS if the driver is ready, EXIT_FAILURE if opening failed or timed out
+ */
+int btWaitOpen(struct BluetoothDriver *instance, systime_t timeout){
+
+    EventListener listener;
+    systime_t start = chTimeNow();
+
+    if (!instance)
+        return EXIT_FAILURE;
+
+    chEvtRegisterMask(&instance->eventSource, &listener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    //register first, then check, so the event can not slip through between the two
+    while (instance->openInProgress) {
+        systime_t elapsed = chTimeElapsedSince(start);
+
+        if (timeout != TIME_INFINITE && elapsed >= timeout)
+            break;
+
+        chEvtWaitAnyTimeout(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID),
+                            timeout == TIME_INFINITE ? TIME_INFINITE : timeout - elapsed);
+    }
+
+    chEvtUnregister(&instance->eventSource, &listener);
+    chEvtGetAndClearEvents(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    return instance->driverIsReady ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
@@ -116,8 +236,95 @@ int btClose(struct BluetoothDriver *instance){
     if (!instance)
         return EXIT_FAILURE;
 
+    instance->driverIsReady = 0;
+
     return instance->vmt->close(instance);
 }
 
+/*!
+ * \brief Checks if a remote device is connected
+ *
+ * Modules that can not tell are reported as connected, so callers do not stall on them.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return 1 if connected, 0 if not
+ */
+int btIsConnected(struct BluetoothDriver *instance){
+
+    if (!instance || !instance->driverIsReady)
+        return 0;
+
+    if (!instance->vmt->isConnected)
+        return 1;
+
+    return instance->vmt->isConnected(instance);
+}
+
+/*!
+ * \brief Sends a buffer, waits for room in the output up to the timeout
+ *
+ * Unlike btSend, a full output blocks instead of losing data.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer
+ * \param[in] bufferlength The length of the buffer
+ * \param[in] timeout Timeout in system ticks, TIME_INFINITE or TIME_IMMEDIATE
+ * \return the number of bytes sent, 0 if the module can not do it
+ */
+int btWriteTimeout(struct BluetoothDriver *instance, const char *buffer, int bufferlength, systime_t timeout){
+
+    if (!instance || !buffer || bufferlength <= 0 || !instance->vmt->writeTimeout)
+        return 0;
+
+    return instance->vmt->writeTimeout(instance, buffer, bufferlength, timeout);
+}
+
+/*!
+ * \brief Reads into a buffer, waits for the data up to the timeout
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer
+ * \param[in] maxlength The length of the buffer
+ * \param[in] timeout Timeout in system ticks, TIME_INFINITE or TIME_IMMEDIATE
+ * \return the number of bytes read, 0 if the module can not do it
+ */
+int btReadTimeout(struct BluetoothDriver *instance, char *buffer, int maxlength, systime_t timeout){
+
+    if (!instance || !buffer || maxlength <= 0 || !instance->vmt->readTimeout)
+        return 0;
+
+    return instance->vmt->readTimeout(instance, buffer, maxlength, timeout);
+}
+
+/*!
+ * \brief Starts sending every received byte back, as soon as it arrives
+ *
+ * The data does not go through the application, which must not read or send while it runs.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already or the module can not do it
+ */
+int btStartReflector(struct BluetoothDriver *instance){
+
+    if (!instance || !instance->driverIsReady || !instance->vmt->startReflector)
+        return EXIT_FAILURE;
+
+    return instance->vmt->startReflector(instance);
+}
+
+/*!
+ * \brief Stops the reflector
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it was not running
+ */
+int btStopReflector(struct BluetoothDriver *instance){
+
+    if (!instance || !instance->vmt->stopReflector)
+        return EXIT_FAILURE;
+
+    return instance->vmt->stopReflector(instance);
+}
+
 /** @} */
 #endif //HAL_USE_BLUETOOTH || defined(__DOXYGEN__)
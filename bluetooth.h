@@ -59,9 +59,52 @@
 #if !defined(BLUETOOTH_OUTPUT_BUFFER_LENGTH) || defined(__DOXYGEN__)
 #define BLUETOOTH_OUTPUT_BUFFER_SIZE 128
 #endif
+/**
+ * @brief   Stack size of the thread running btOpenAsync.
+ * @details The deepest path is the sync of the configuration: the command, the answer and the
+ *          line buffers of the AT pipeline are all on the stack, about 700 bytes. Check it with
+ *          "threads stacks" (USE_STACK_PROFILING) after a change.
+ */
+#if !defined(BLUETOOTH_OPEN_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define BLUETOOTH_OPEN_THREAD_STACK_SIZE 1024
+#endif
+/**
+ * @brief   Event ID btWaitOpen uses internally.
+ * @details Configuration parameter, must not collide with the events the caller thread uses.
+ */
+#if !defined(BLUETOOTH_WAIT_EVENT_ID) || defined(__DOXYGEN__)
+#define BLUETOOTH_WAIT_EVENT_ID 31
+#endif
 
 /** @} */
 
+/**
+ * @name    Bluetooth event flags
+ * @details Broadcast on the eventSource of the BluetoothDriver.
+ * @{
+ */
+/**
+ * @brief   btOpenAsync finished, the driver is ready.
+ */
+#define BT_EVENT_OPENED             ((flagsmask_t)1)
+/**
+ * @brief   btOpenAsync finished, but the driver could not be opened.
+ */
+#define BT_EVENT_OPEN_FAILED        ((flagsmask_t)2)
+/**
+ * @brief   A remote device connected.
+ */
+#define BT_EVENT_CONNECTED          ((flagsmask_t)4)
+/**
+ * @brief   The remote device disconnected, unsent data was dropped.
+ */
+#define BT_EVENT_DISCONNECTED       ((flagsmask_t)8)
+/**
+ * @brief   The driver opened, but the module did not take its name, PIN code, bit rate or role.
+ */
+#define BT_EVENT_CONFIG_FAILED      ((flagsmask_t)16)
+/** @} */
+
 /*===========================================================================*/
 /* Forward declarations                                                      */
 /*===========================================================================*/
@@ -131,8 +174,10 @@ struct BluetoothDriver{
     struct BluetoothConfig *config;
     InputQueue *btInputQueue;
     OutputQueue *btOutputQueue;
-    int driverIsReady;
+    volatile int driverIsReady;
     int commSleepTimeMs;
+    EventSource eventSource;        //driver events, see BT_EVENT_*
+    volatile int openInProgress;    //1 while btOpenAsync is running
 };
 
 
@@ -150,6 +195,11 @@ struct BluetoothDeviceVMT {
     int (*open)(struct BluetoothDriver *instance, struct BluetoothConfig *config);
     int (*close)(struct BluetoothDriver *instance);
     int (*resetModuleSettings) (struct BluetoothDriver * instance);
+    int (*isConnected)(struct BluetoothDriver *instance);
+    int (*writeTimeout)(struct BluetoothDriver *instance, const char *buffer, int bufferlength, systime_t timeout);
+    int (*readTimeout)(struct BluetoothDriver *instance, char *buffer, int maxlength, systime_t timeout);
+    int (*startReflector)(struct BluetoothDriver *instance);
+    int (*stopReflector)(struct BluetoothDriver *instance);
 };
 
 
@@ -169,8 +219,16 @@ int btSend(struct BluetoothDriver *instance, char *buffer, int bufferlength);
 int btSendByte(struct BluetoothDriver *instance, int mybyte);
 int btCanRecieve(struct BluetoothDriver *instance);
 int btRead(struct BluetoothDriver *instance, char *buffer, int maxlen);
+void btObjectInit(struct BluetoothDriver *instance);
 int btOpen(struct BluetoothDriver *instance, struct BluetoothConfig *config);
+int btOpenAsync(struct BluetoothDriver *instance, struct BluetoothConfig *config);
+int btWaitOpen(struct BluetoothDriver *instance, systime_t timeout);
 int btClose(struct BluetoothDriver *instance);
+int btIsConnected(struct BluetoothDriver *instance);
+int btWriteTimeout(struct BluetoothDriver *instance, const char *buffer, int bufferlength, systime_t timeout);
+int btReadTimeout(struct BluetoothDriver *instance, char *buffer, int maxlength, systime_t timeout);
+int btStartReflector(struct BluetoothDriver *instance);
+int btStopReflector(struct BluetoothDriver *instance);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,365 @@
+/*!
+ * @file btbench.c
+ * @brief Source file for the bluetooth link benchmark in ChibiosRT.
+ *
+ *  A frame is: 0x55 0xAA, sequence (16 bit), payload length (16 bit), send timestamp in system
+ *  ticks (32 bit), the payload, then a Fletcher-16 checksum of everything after the sync bytes.
+ *  All fields are little endian, payload byte i is (sequence + i) & 0xFF.
+ *
+ *  btBenchRun sends the frames and expects them back unchanged from the other end
+ *  (tools/btbench.py echo), btBenchReflect is that other end on the target.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btbench.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief What btbench_readframe found
+ */
+enum btbench_status_t{
+    bench_frame = 0,
+    bench_corrupt,
+    bench_timeout
+};
+
+/**
+ * @brief Incoming frame assembly
+ */
+struct btbench_parser_t{
+    uint8_t chunk[64];          //read from the driver, not yet parsed
+    int chunklength;
+    int chunkposition;
+    int framelength;            //bytes of the frame collected so far
+    uint8_t frame[BTBENCH_MAX_PAYLOAD + BTBENCH_OVERHEAD];
+};
+
+static struct btbench_parser_t btBenchParser;
+
+/**
+ * @brief The frame being sent
+ */
+static uint8_t btBenchFrame[BTBENCH_MAX_PAYLOAD + BTBENCH_OVERHEAD];
+
+/**
+ * @brief Round trip times in milliseconds, a ring of the last BTBENCH_MAX_SAMPLES
+ */
+static uint16_t btBenchSamples[BTBENCH_MAX_SAMPLES];
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Reads a little endian 16 bit value
+ */
+static uint16_t btbench_get16(const uint8_t *data){
+
+    return data[0] | (data[1] << 8);
+}
+
+/*!
+ * \brief Reads a little endian 32 bit value
+ */
+static uint32_t btbench_get32(const uint8_t *data){
+
+    return btbench_get16(data) | ((uint32_t)btbench_get16(data + 2) << 16);
+}
+
+/*!
+ * \brief Fletcher-16 checksum
+ *
+ * \param[in] data The data
+ * \param[in] length Its length
+ * \return the checksum
+ */
+static uint16_t btbench_checksum(const uint8_t *data, int length){
+
+    uint16_t sum1 = 0, sum2 = 0;
+
+    while (length--) {
+        sum1 = (sum1 + *data++) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+
+    return (sum2 << 8) | sum1;
+}
+
+/*!
+ * \brief Builds a frame into btBenchFrame
+ *
+ * \param[in] sequence Sequence number
+ * \param[in] payload Payload length
+ * \return length of the frame
+ */
+static int btbench_buildframe(uint16_t sequence, uint16_t payload){
+
+    uint32_t stamp = chTimeNow();
+    uint16_t checksum;
+    int i;
+
+    btBenchFrame[0] = BTBENCH_SYNC1;
+    btBenchFrame[1] = BTBENCH_SYNC2;
+    btBenchFrame[2] = sequence & 0xFF;
+    btBenchFrame[3] = sequence >> 8;
+    btBenchFrame[4] = payload & 0xFF;
+    btBenchFrame[5] = payload >> 8;
+    for (i = 0; i < 4; i++)
+        btBenchFrame[6 + i] = (stamp >> (8 * i)) & 0xFF;
+    for (i = 0; i < payload; i++)
+        btBenchFrame[BTBENCH_HEADER_LENGTH + i] = (sequence + i) & 0xFF;
+
+    checksum = btbench_checksum(btBenchFrame + 2, BTBENCH_HEADER_LENGTH - 2 + payload);
+    btBenchFrame[BTBENCH_HEADER_LENGTH + payload] = checksum & 0xFF;
+    btBenchFrame[BTBENCH_HEADER_LENGTH + payload + 1] = checksum >> 8;
+
+    return BTBENCH_OVERHEAD + payload;
+}
+
+/*!
+ * \brief Reads the next frame into btBenchParser.frame
+ *
+ *  Bytes outside of frames are skipped.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] timeout How long to wait for the whole frame, in system ticks
+ * \return bench_frame, bench_corrupt or bench_timeout
+ */
+static enum btbench_status_t btbench_readframe(struct BluetoothDriver *instance, systime_t timeout){
+
+    struct btbench_parser_t *parser = &btBenchParser;
+    systime_t start = chTimeNow();
+
+    while (TRUE) {
+        uint8_t byte;
+
+        if (parser->chunkposition == parser->chunklength) {
+            systime_t elapsed = chTimeElapsedSince(start);
+
+            if (elapsed >= timeout)
+                return bench_timeout;
+
+            //block for one byte only, then take what is already there
+            parser->chunkposition = 0;
+            parser->chunklength = btReadTimeout(instance, (char *)parser->chunk, 1, timeout - elapsed);
+            if (!parser->chunklength)
+                return bench_timeout;
+            parser->chunklength += btReadTimeout(instance, (char *)parser->chunk + 1,
+                                                 sizeof(parser->chunk) - 1, TIME_IMMEDIATE);
+        }
+
+        byte = parser->chunk[parser->chunkposition++];
+
+        if (parser->framelength == 0 && byte != BTBENCH_SYNC1)
+            continue;
+        if (parser->framelength == 1 && byte != BTBENCH_SYNC2) {
+            parser->framelength = byte == BTBENCH_SYNC1 ? 1 : 0;
+            continue;
+        }
+
+        parser->frame[parser->framelength++] = byte;
+
+        if (parser->framelength < BTBENCH_HEADER_LENGTH)
+            continue;
+
+        if (btbench_get16(parser->frame + 4) > BTBENCH_MAX_PAYLOAD) {
+            parser->framelength = 0;
+            return bench_corrupt;
+        }
+
+        if (parser->framelength == BTBENCH_OVERHEAD + btbench_get16(parser->frame + 4)) {
+            int length = parser->framelength;
+
+            parser->framelength = 0;
+            return btbench_checksum(parser->frame + 2, length - 4) == btbench_get16(parser->frame + length - 2)
+                    ? bench_frame
+                    : bench_corrupt;
+        }
+    }
+}
+
+/*!
+ * \brief Fills the round trip percentiles of the result
+ *
+ * \param[in,out] result The result
+ * \param[in] count Number of round trip samples taken
+ */
+static void btbench_percentiles(struct btbench_result_t *result, uint32_t count){
+
+    int n = count < BTBENCH_MAX_SAMPLES ? count : BTBENCH_MAX_SAMPLES;
+    int i, j;
+
+    if (!n)
+        return;
+
+    //insertion sort, the table is small
+    for (i = 1; i < n; i++) {
+        uint16_t sample = btBenchSamples[i];
+
+        for (j = i; j > 0 && btBenchSamples[j - 1] > sample; j--)
+            btBenchSamples[j] = btBenchSamples[j - 1];
+        btBenchSamples[j] = sample;
+    }
+
+    result->rttp50ms = btBenchSamples[((n - 1) * 50) / 100];
+    result->rttp90ms = btBenchSamples[((n - 1) * 90) / 100];
+    result->rttp99ms = btBenchSamples[((n - 1) * 99) / 100];
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Sends patterned frames and measures them coming back
+ *
+ *  Keeps up to config->window frames in flight. A frame that is not back within
+ *  config->timeoutms is lost, together with everything sent before it.
+ *  The link has no flow control and the echoes wait in the input queue until we read them,
+ *  so the window is cut to the frames that fit SERIAL_BUFFERS_SIZE, result->window tells.
+ *
+ * \param[in] instance A BluetoothDriver object, in communication mode
+ * \param[in] config Parameters of the run
+ * \param[out] result The results
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the parameters are wrong
+ */
+int btBenchRun(struct BluetoothDriver *instance, const struct btbench_config_t *config,
+               struct btbench_result_t *result){
+
+    systime_t start = chTimeNow();
+    uint32_t done = 0;              //frames back or given up
+    uint32_t samples = 0;
+    uint16_t window;
+
+    if (!instance || !config || !result || !config->frames || !config->window ||
+        config->window > BTBENCH_MAX_WINDOW || config->payload > BTBENCH_MAX_PAYLOAD)
+        return EXIT_FAILURE;
+
+    memset(result, 0, sizeof(*result));
+    memset(&btBenchParser, 0, sizeof(btBenchParser));
+    result->rttminms = 0xFFFF;
+
+    window = SERIAL_BUFFERS_SIZE / (config->payload + BTBENCH_OVERHEAD);
+    if (!window)
+        window = 1;
+    if (window > config->window)
+        window = config->window;
+    result->window = window;
+
+    while (done < config->frames) {
+        enum btbench_status_t status;
+        uint16_t delta, rttms;
+        uint32_t rtt;
+
+        while (result->sent < config->frames && result->sent - done < window) {
+            int length = btbench_buildframe(result->sent, config->payload);
+
+            btWriteTimeout(instance, (char *)btBenchFrame, length, MS2ST(config->timeoutms));
+            result->sent++;
+        }
+
+        status = btbench_readframe(instance, MS2ST(config->timeoutms));
+
+        if (status == bench_timeout) {
+            result->lost += result->sent - done;
+            done = result->sent;
+            continue;
+        }
+        if (status == bench_corrupt) {
+            result->corrupt++;
+            continue;
+        }
+
+        //how far ahead of the oldest frame in flight it is
+        delta = btbench_get16(btBenchParser.frame + 2) - (uint16_t)done;
+        if (delta >= result->sent - done) {
+            result->outoforder++;
+            continue;
+        }
+        if (btbench_get16(btBenchParser.frame + 4) != config->payload) {
+            result->corrupt++;
+            continue;
+        }
+
+        result->lost += delta;
+        done += delta + 1;
+        result->received++;
+        result->bytes += config->payload;
+
+        rtt = ((uint32_t)(chTimeNow() - btbench_get32(btBenchParser.frame + 6)) * 1000) / CH_FREQUENCY;
+        rttms = rtt > 0xFFFF ? 0xFFFF : rtt;
+        if (rttms < result->rttminms)
+            result->rttminms = rttms;
+        if (rttms > result->rttmaxms)
+            result->rttmaxms = rttms;
+        btBenchSamples[samples++ % BTBENCH_MAX_SAMPLES] = rttms;
+    }
+
+    result->elapsedms = ((uint64_t)chTimeElapsedSince(start) * 1000) / CH_FREQUENCY;
+    if (!samples)
+        result->rttminms = 0;
+    btbench_percentiles(result, samples);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Sends the intact frames back to the other end
+ *
+ *  result->received counts the frames echoed, lost counts the gaps in their sequence.
+ *
+ * \param[in] instance A BluetoothDriver object, in communication mode
+ * \param[in] idlems Stops after this long without a frame
+ * \param[out] result The results
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btBenchReflect(struct BluetoothDriver *instance, uint32_t idlems, struct btbench_result_t *result){
+
+    systime_t start = chTimeNow();
+    systime_t last = start;
+    uint16_t expected = 0;
+    enum btbench_status_t status;
+
+    if (!instance || !result || !idlems)
+        return EXIT_FAILURE;
+
+    memset(result, 0, sizeof(*result));
+    memset(&btBenchParser, 0, sizeof(btBenchParser));
+
+    while ((status = btbench_readframe(instance, MS2ST(idlems))) != bench_timeout) {
+        uint16_t sequence, delta;
+        int length;
+
+        last = chTimeNow();
+        if (status == bench_corrupt) {
+            result->corrupt++;
+            continue;
+        }
+
+        sequence = btbench_get16(btBenchParser.frame + 2);
+        delta = sequence - expected;
+        if (result->received && delta >= 0x8000)
+            result->outoforder++;
+        else if (result->received)
+            result->lost += delta;
+        expected = sequence + 1;
+
+        length = BTBENCH_OVERHEAD + btbench_get16(btBenchParser.frame + 4);
+        result->sent += btWriteTimeout(instance, (char *)btBenchParser.frame, length, MS2ST(idlems)) == length;
+        result->received++;
+        result->bytes += length - BTBENCH_OVERHEAD;
+    }
+
+    result->elapsedms = ((uint64_t)(last - start) * 1000) / CH_FREQUENCY;
+
+    return EXIT_SUCCESS;
+}
+
+/** @} */
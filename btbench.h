@@ -0,0 +1,103 @@
+/*!
+ * @file btbench.h
+ * @brief Header file for the bluetooth link benchmark in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTBENCH_H_INCLUDED
+#define BTBENCH_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Benchmark configuration options
+ * @{
+ */
+/**
+ * @brief   Largest payload of a benchmark frame.
+ */
+#if !defined(BTBENCH_MAX_PAYLOAD) || defined(__DOXYGEN__)
+#define BTBENCH_MAX_PAYLOAD 240
+#endif
+/**
+ * @brief   Most frames in flight at once.
+ */
+#if !defined(BTBENCH_MAX_WINDOW) || defined(__DOXYGEN__)
+#define BTBENCH_MAX_WINDOW 16
+#endif
+/**
+ * @brief   Round trip times kept for the percentiles, the last ones win.
+ */
+#if !defined(BTBENCH_MAX_SAMPLES) || defined(__DOXYGEN__)
+#define BTBENCH_MAX_SAMPLES 128
+#endif
+/** @} */
+
+/**
+ * @brief   First two bytes of a frame.
+ */
+#define BTBENCH_SYNC1 0x55
+#define BTBENCH_SYNC2 0xAA
+
+/**
+ * @brief   Bytes around the payload: sync, sequence, length, timestamp and checksum.
+ */
+#define BTBENCH_HEADER_LENGTH 10
+#define BTBENCH_OVERHEAD (BTBENCH_HEADER_LENGTH + 2)
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Parameters of a benchmark run
+ */
+struct btbench_config_t{
+    uint32_t frames;            //frames to send
+    uint16_t payload;           //payload bytes per frame, up to BTBENCH_MAX_PAYLOAD
+    uint16_t window;            //frames in flight, 1 measures the pure round trip
+    uint16_t timeoutms;         //frames not back by then are lost
+};
+
+/**
+ * @brief Results of a run, or of the reflector
+ */
+struct btbench_result_t{
+    uint32_t sent;              //frames
+    uint32_t received;          //frames back intact, in order
+    uint32_t lost;              //frames never back
+    uint32_t corrupt;           //frames with a bad checksum or length
+    uint32_t outoforder;        //frames back late or twice
+    uint32_t bytes;             //payload bytes back intact
+    uint32_t elapsedms;
+    uint16_t window;            //frames kept in flight, the input queue may allow fewer than asked
+    uint16_t rttminms;
+    uint16_t rttp50ms;
+    uint16_t rttp90ms;
+    uint16_t rttp99ms;
+    uint16_t rttmaxms;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btBenchRun(struct BluetoothDriver *instance, const struct btbench_config_t *config,
+               struct btbench_result_t *result);
+int btBenchReflect(struct BluetoothDriver *instance, uint32_t idlems, struct btbench_result_t *result);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTBENCH_H_INCLUDED
+/** @} */
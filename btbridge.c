@@ -0,0 +1,262 @@
+/*!
+ * @file btbridge.c
+ * @brief Source file for the transparent host to bluetooth bridge in ChibiosRT.
+ *
+ *  Two pump threads move the data between a host channel (USB CDC) and the channel of the
+ *  bluetooth module, in chunks. A full output queue blocks the pump, so it stops reading and
+ *  the backpressure reaches the other side. The host leaves the bridge with "+++" between
+ *  two BTBRIDGE_ESCAPE_GUARD_MS pauses.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btbridge.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief One direction of the bridge
+ */
+struct btbridge_pump_t{
+    BaseChannel *from;
+    BaseChannel *to;
+    uint32_t *bytes;
+    uint32_t *chunks;
+    int escape;                 //nonzero: watch for "+++"
+    Thread *thread;
+    uint8_t buffer[BTBRIDGE_CHUNK_SIZE];
+};
+
+static WORKING_AREA(btBridgeHostWa, BTBRIDGE_THREAD_STACK_SIZE);
+static WORKING_AREA(btBridgeBtWa, BTBRIDGE_THREAD_STACK_SIZE);
+
+/**
+ * @brief Host to bluetooth and bluetooth to host pumps
+ */
+static struct btbridge_pump_t btBridgeHostPump, btBridgeBtPump;
+
+/**
+ * @brief Bridge counters
+ */
+static struct btbridge_stats_t btBridgeStats;
+
+/**
+ * @brief Start of the bridge
+ */
+static systime_t btBridgeStarted;
+
+/**
+ * @brief Thread waiting in btBridgeWait, NULL if none
+ */
+static Thread *btBridgeWaiter = NULL;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Writes a chunk, waits as long as the output is full
+ *
+ * \param[in] pump The pump
+ * \param[in] buffer The data
+ * \param[in] length Its length
+ */
+static void btbridge_write(struct btbridge_pump_t *pump, const uint8_t *buffer, size_t length){
+
+    while (length && !chThdShouldTerminate()) {
+        size_t written = chnWriteTimeout(pump->to, buffer, length, MS2ST(BTBRIDGE_POLL_MS));
+
+        buffer += written;
+        length -= written;
+    }
+}
+
+/*!
+ * \brief Checks a chunk for the escape sequence
+ *
+ *  The '+' characters are held back while they could be the escape, and sent if anything else follows.
+ *
+ * \param[in] pump The host pump
+ * \param[in] length Length of the chunk in the buffer
+ * \param[in,out] pluses '+' characters held back
+ * \param[in] silence Time without data before the chunk
+ * \return nonzero if the host asked to leave the bridge
+ */
+static int btbridge_escape(struct btbridge_pump_t *pump, size_t length, int *pluses, systime_t silence){
+
+    static const uint8_t plusplusplus[3] = {'+', '+', '+'};
+    size_t i;
+
+    for (i = 0; i < length && pump->buffer[i] == '+'; i++)
+        ;
+
+    if (i == length && *pluses + length <= 3 && (*pluses || silence >= MS2ST(BTBRIDGE_ESCAPE_GUARD_MS))) {
+        *pluses += length;
+        if (*pluses < 3)
+            return 0;
+
+        //the guard time after it decides
+        if (!chnReadTimeout(pump->from, pump->buffer, 1, MS2ST(BTBRIDGE_ESCAPE_GUARD_MS)))
+            return 1;
+
+        (*pump->bytes)++;
+        btbridge_write(pump, plusplusplus, 3);
+        *pluses = 0;
+        length = 1;
+    }
+
+    if (*pluses) {
+        btbridge_write(pump, plusplusplus, *pluses);
+        *pluses = 0;
+    }
+
+    btbridge_write(pump, pump->buffer, length);
+    return 0;
+}
+
+/*!
+ * \brief Pump thread
+ *
+ *  Waits for the first byte, then takes whatever else is already there, up to a chunk.
+ */
+static msg_t btbridge_pumpthread(void *arg){
+
+    struct btbridge_pump_t *pump = arg;
+    systime_t lastdata = chTimeNow();
+    int pluses = 0;
+
+    chRegSetThreadName(pump->escape ? "bridgehost" : "bridgebt");
+
+    while (!chThdShouldTerminate()) {
+        size_t length = chnReadTimeout(pump->from, pump->buffer, 1, MS2ST(BTBRIDGE_POLL_MS));
+        systime_t silence;
+
+        if (!length)
+            continue;
+
+        length += chnReadTimeout(pump->from, pump->buffer + 1, BTBRIDGE_CHUNK_SIZE - 1, TIME_IMMEDIATE);
+        silence = chTimeElapsedSince(lastdata);
+        lastdata = chTimeNow();
+
+        *pump->bytes += length;
+        (*pump->chunks)++;
+
+        if (!pump->escape) {
+            btbridge_write(pump, pump->buffer, length);
+            continue;
+        }
+
+        if (btbridge_escape(pump, length, &pluses, silence)) {
+            chSysLock();
+            if (btBridgeWaiter)
+                chEvtSignalI(btBridgeWaiter, EVENT_MASK(0));
+            chSchRescheduleS();
+            chSysUnlock();
+            break;
+        }
+        lastdata = chTimeNow();
+    }
+
+    return 0;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Starts bridging two channels
+ *
+ *  Nothing else may read the channels while the bridge runs (stop the shell on the host
+ *  channel, or run the bridge from a shell command with btBridgeWait).
+ *
+ * \param[in] host The host side, USB CDC
+ * \param[in] bt The channel of the bluetooth module
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it is already running
+ */
+int btBridgeStart(BaseChannel *host, BaseChannel *bt){
+
+    if (!host || !bt || btBridgeStats.running)
+        return EXIT_FAILURE;
+
+    memset(&btBridgeStats, 0, sizeof(btBridgeStats));
+    btBridgeStats.running = 1;
+    btBridgeStarted = chTimeNow();
+
+    btBridgeHostPump.from = host;
+    btBridgeHostPump.to = bt;
+    btBridgeHostPump.bytes = &btBridgeStats.hosttobt;
+    btBridgeHostPump.chunks = &btBridgeStats.hostchunks;
+    btBridgeHostPump.escape = 1;
+
+    btBridgeBtPump.from = bt;
+    btBridgeBtPump.to = host;
+    btBridgeBtPump.bytes = &btBridgeStats.bttohost;
+    btBridgeBtPump.chunks = &btBridgeStats.btchunks;
+    btBridgeBtPump.escape = 0;
+
+    btBridgeHostPump.thread = chThdCreateStatic(btBridgeHostWa, sizeof(btBridgeHostWa),
+                                                NORMALPRIO + 1, btbridge_pumpthread, &btBridgeHostPump);
+    btBridgeBtPump.thread = chThdCreateStatic(btBridgeBtWa, sizeof(btBridgeBtWa),
+                                              NORMALPRIO + 1, btbridge_pumpthread, &btBridgeBtPump);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Waits until the host leaves the bridge with "+++", then stops it
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the bridge is not running
+ */
+int btBridgeWait(void){
+
+    if (!btBridgeStats.running)
+        return EXIT_FAILURE;
+
+    chEvtGetAndClearEvents(EVENT_MASK(0));
+    btBridgeWaiter = chThdSelf();
+    //the host pump ends only on the escape
+    while (!chThdTerminated(btBridgeHostPump.thread))
+        chEvtWaitAnyTimeout(EVENT_MASK(0), MS2ST(BTBRIDGE_POLL_MS));
+    btBridgeWaiter = NULL;
+
+    btBridgeStop();
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops the bridge
+ */
+void btBridgeStop(void){
+
+    if (!btBridgeStats.running)
+        return;
+
+    chThdTerminate(btBridgeHostPump.thread);
+    chThdTerminate(btBridgeBtPump.thread);
+    chThdWait(btBridgeHostPump.thread);
+    chThdWait(btBridgeBtPump.thread);
+
+    btBridgeStats.elapsedms = (uint32_t)(((uint64_t)chTimeElapsedSince(btBridgeStarted) * 1000) / CH_FREQUENCY);
+    btBridgeStats.running = 0;
+}
+
+/*!
+ * \brief Returns the bridge counters
+ *
+ * \return pointer to the counters
+ */
+const struct btbridge_stats_t *btBridgeGetStats(void){
+
+    if (btBridgeStats.running)
+        btBridgeStats.elapsedms = (uint32_t)(((uint64_t)chTimeElapsedSince(btBridgeStarted) * 1000) / CH_FREQUENCY);
+
+    return &btBridgeStats;
+}
+
+/** @} */
@@ -0,0 +1,82 @@
+/*!
+ * @file btbridge.h
+ * @brief Header file for the transparent host to bluetooth bridge in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTBRIDGE_H_INCLUDED
+#define BTBRIDGE_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Bridge configuration options
+ * @{
+ */
+/**
+ * @brief   Largest chunk a pump moves at once.
+ * @details Configuration parameter, the output queues should hold two chunks, so the next
+ *          chunk is read while the previous one is still being sent.
+ */
+#if !defined(BTBRIDGE_CHUNK_SIZE) || defined(__DOXYGEN__)
+#define BTBRIDGE_CHUNK_SIZE 128
+#endif
+/**
+ * @brief   Stack size of a pump thread.
+ */
+#if !defined(BTBRIDGE_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTBRIDGE_THREAD_STACK_SIZE 256
+#endif
+/**
+ * @brief   Silence needed before and after "+++" to leave the bridge, in milliseconds.
+ */
+#if !defined(BTBRIDGE_ESCAPE_GUARD_MS) || defined(__DOXYGEN__)
+#define BTBRIDGE_ESCAPE_GUARD_MS 1000
+#endif
+/**
+ * @brief   How often a blocked pump checks if it has to stop, in milliseconds.
+ */
+#if !defined(BTBRIDGE_POLL_MS) || defined(__DOXYGEN__)
+#define BTBRIDGE_POLL_MS 100
+#endif
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Bridge counters
+ */
+struct btbridge_stats_t{
+    int running;
+    uint32_t hosttobt;          //bytes
+    uint32_t bttohost;          //bytes
+    uint32_t hostchunks;
+    uint32_t btchunks;
+    uint32_t elapsedms;         //since the start, frozen at the stop
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btBridgeStart(BaseChannel *host, BaseChannel *bt);
+int btBridgeWait(void);
+void btBridgeStop(void);
+const struct btbridge_stats_t *btBridgeGetStats(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTBRIDGE_H_INCLUDED
+/** @} */
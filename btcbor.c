@@ -0,0 +1,431 @@
+/*!
+ * @file btcbor.c
+ * @brief Source file for the CBOR subset used by the bluetooth RPC in ChibiosRT.
+ *
+ *  RFC 7049 items with definite lengths only: integers up to 32 bits, byte and text strings,
+ *  arrays, maps, false, true and null. No floats, no tags.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btcbor.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Writes the head of an item: major type and argument, shortest form
+ */
+static void btcbor_puthead(struct btcbor_writer_t *writer, uint8_t major, uint32_t argument){
+
+    uint8_t head[5];
+    int length, i;
+
+    if (argument < 24) {
+        head[0] = (major << 5) | argument;
+        length = 1;
+    }
+    else if (argument <= 0xFF) {
+        head[0] = (major << 5) | 24;
+        length = 2;
+    }
+    else if (argument <= 0xFFFF) {
+        head[0] = (major << 5) | 25;
+        length = 3;
+    }
+    else {
+        head[0] = (major << 5) | 26;
+        length = 5;
+    }
+    //big endian
+    for (i = length - 1; i > 0; i--) {
+        head[i] = argument & 0xFF;
+        argument >>= 8;
+    }
+
+    if (writer->error || writer->length + length > writer->size) {
+        writer->error = 1;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, head, length);
+    writer->length += length;
+}
+
+/*!
+ * \brief Reads the head of an item
+ *
+ * \param[in] reader The decoder
+ * \param[out] major The major type
+ * \param[out] argument The argument, the value of an integer or a length
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int btcbor_gethead(struct btcbor_reader_t *reader, uint8_t *major, uint32_t *argument){
+
+    uint8_t initial, info;
+    int length;
+
+    if (reader->error || reader->position >= reader->length) {
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    initial = reader->data[reader->position];
+    *major = initial >> 5;
+    info = initial & 0x1F;
+
+    if (info < 24) {
+        *argument = info;
+        reader->position++;
+        return EXIT_SUCCESS;
+    }
+
+    length = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : 0;
+    if (!length || reader->position + 1 + length > reader->length) {
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    reader->position++;
+    *argument = 0;
+    while (length--)
+        *argument = (*argument << 8) | reader->data[reader->position++];
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reads the head of an item of the given major type
+ */
+static int btcbor_expect(struct btcbor_reader_t *reader, uint8_t major, uint32_t *argument){
+
+    int position = reader->position;
+    uint8_t found;
+
+    if (btcbor_gethead(reader, &found, argument) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (found != major) {
+        reader->position = position;
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reads a string of the given major type
+ */
+static int btcbor_getstring(struct btcbor_reader_t *reader, uint8_t major, const uint8_t **data, int *length){
+
+    uint32_t argument;
+
+    if (btcbor_expect(reader, major, &argument) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (argument > (uint32_t)(reader->length - reader->position)) {
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    *data = reader->data + reader->position;
+    *length = argument;
+    reader->position += argument;
+
+    return EXIT_SUCCESS;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Initializes an encoder
+ *
+ * \param[in] writer The encoder
+ * \param[in] buffer The buffer to encode into
+ * \param[in] size Its size
+ */
+void btCborWriterInit(struct btcbor_writer_t *writer, uint8_t *buffer, int size){
+
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->error = 0;
+}
+
+/*!
+ * \brief Adds an unsigned integer
+ */
+void btCborPutUint(struct btcbor_writer_t *writer, uint32_t value){
+
+    btcbor_puthead(writer, btcbor_uint, value);
+}
+
+/*!
+ * \brief Adds a signed integer
+ */
+void btCborPutInt(struct btcbor_writer_t *writer, int32_t value){
+
+    if (value < 0)
+        btcbor_puthead(writer, btcbor_negint, (uint32_t)(-1 - value));
+    else
+        btcbor_puthead(writer, btcbor_uint, value);
+}
+
+/*!
+ * \brief Adds a byte string
+ */
+void btCborPutBytes(struct btcbor_writer_t *writer, const uint8_t *data, int length){
+
+    btcbor_puthead(writer, btcbor_bytes, length);
+    if (writer->error || writer->length + length > writer->size) {
+        writer->error = 1;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+/*!
+ * \brief Adds a text string
+ */
+void btCborPutText(struct btcbor_writer_t *writer, const char *text){
+
+    int length = strlen(text);
+
+    btcbor_puthead(writer, btcbor_text, length);
+    if (writer->error || writer->length + length > writer->size) {
+        writer->error = 1;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, text, length);
+    writer->length += length;
+}
+
+/*!
+ * \brief Starts an array, the next count items are its elements
+ */
+void btCborPutArray(struct btcbor_writer_t *writer, int count){
+
+    btcbor_puthead(writer, btcbor_array, count);
+}
+
+/*!
+ * \brief Starts a map, the next 2 * count items are its keys and values
+ */
+void btCborPutMap(struct btcbor_writer_t *writer, int count){
+
+    btcbor_puthead(writer, btcbor_map, count);
+}
+
+/*!
+ * \brief Adds false or true
+ */
+void btCborPutBool(struct btcbor_writer_t *writer, int value){
+
+    btcbor_puthead(writer, 7, value ? 21 : 20);
+}
+
+/*!
+ * \brief Adds null
+ */
+void btCborPutNull(struct btcbor_writer_t *writer){
+
+    btcbor_puthead(writer, 7, 22);
+}
+
+/*!
+ * \brief Initializes a decoder
+ *
+ * \param[in] reader The decoder
+ * \param[in] data The encoded items
+ * \param[in] length Their length
+ */
+void btCborReaderInit(struct btcbor_reader_t *reader, const uint8_t *data, int length){
+
+    reader->data = data;
+    reader->length = length;
+    reader->position = 0;
+    reader->error = 0;
+}
+
+/*!
+ * \brief Returns the type of the next item, without reading it
+ *
+ * \param[in] reader The decoder
+ * \return the type, btcbor_invalid at the end or on an error
+ */
+enum btcbor_type_t btCborPeek(struct btcbor_reader_t *reader){
+
+    uint8_t initial;
+
+    if (reader->error || reader->position >= reader->length)
+        return btcbor_invalid;
+
+    initial = reader->data[reader->position];
+    if ((initial >> 5) != 7)
+        return initial >> 5;
+
+    switch (initial & 0x1F) {
+    case 20:
+        return btcbor_false;
+    case 21:
+        return btcbor_true;
+    case 22:
+        return btcbor_null;
+    default:
+        return btcbor_invalid;
+    }
+}
+
+/*!
+ * \brief Reads an unsigned integer
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetUint(struct btcbor_reader_t *reader, uint32_t *value){
+
+    return btcbor_expect(reader, btcbor_uint, value);
+}
+
+/*!
+ * \brief Reads a signed integer, from either integer type
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it does not fit
+ */
+int btCborGetInt(struct btcbor_reader_t *reader, int32_t *value){
+
+    uint32_t argument;
+    uint8_t major;
+
+    if (btcbor_gethead(reader, &major, &argument) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if ((major != btcbor_uint && major != btcbor_negint) || argument > 0x7FFFFFFF) {
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    *value = major == btcbor_uint ? (int32_t)argument : -1 - (int32_t)argument;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reads a byte string, data points into the decoded buffer
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetBytes(struct btcbor_reader_t *reader, const uint8_t **data, int *length){
+
+    return btcbor_getstring(reader, btcbor_bytes, data, length);
+}
+
+/*!
+ * \brief Reads a text string, text points into the decoded buffer and is not '\0' terminated
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetText(struct btcbor_reader_t *reader, const char **text, int *length){
+
+    return btcbor_getstring(reader, btcbor_text, (const uint8_t **)text, length);
+}
+
+/*!
+ * \brief Reads the start of an array
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetArray(struct btcbor_reader_t *reader, int *count){
+
+    uint32_t argument;
+
+    if (btcbor_expect(reader, btcbor_array, &argument) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    *count = argument;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reads the start of a map
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetMap(struct btcbor_reader_t *reader, int *count){
+
+    uint32_t argument;
+
+    if (btcbor_expect(reader, btcbor_map, &argument) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    *count = argument;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reads false or true
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborGetBool(struct btcbor_reader_t *reader, int *value){
+
+    enum btcbor_type_t type = btCborPeek(reader);
+
+    if (type != btcbor_false && type != btcbor_true) {
+        reader->error = 1;
+        return EXIT_FAILURE;
+    }
+
+    *value = type == btcbor_true;
+    reader->position++;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Skips the next item, with all its elements
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btCborSkip(struct btcbor_reader_t *reader){
+
+    uint32_t pending = 1;       //items still to skip
+
+    while (pending--) {
+        uint32_t argument;
+        uint8_t major;
+
+        if (btcbor_gethead(reader, &major, &argument) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        switch (major) {
+        case btcbor_bytes:
+        case btcbor_text:
+            if (argument > (uint32_t)(reader->length - reader->position)) {
+                reader->error = 1;
+                return EXIT_FAILURE;
+            }
+            reader->position += argument;
+            break;
+        case btcbor_array:
+        case btcbor_map:
+            //more elements than bytes left can not be right
+            if (argument > (uint32_t)(reader->length - reader->position)) {
+                reader->error = 1;
+                return EXIT_FAILURE;
+            }
+            pending += major == btcbor_map ? 2 * argument : argument;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/** @} */
@@ -0,0 +1,89 @@
+/*!
+ * @file btcbor.h
+ * @brief Header file for the CBOR subset used by the bluetooth RPC in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTCBOR_H_INCLUDED
+#define BTCBOR_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief CBOR major types, and the simple values as their own types
+ */
+enum btcbor_type_t{
+    btcbor_uint = 0,
+    btcbor_negint = 1,
+    btcbor_bytes = 2,
+    btcbor_text = 3,
+    btcbor_array = 4,
+    btcbor_map = 5,
+    btcbor_false = 8,
+    btcbor_true,
+    btcbor_null,
+    btcbor_invalid
+};
+
+/**
+ * @brief Encoder into a buffer
+ *
+ *  error is set once something did not fit, the functions do nothing after that.
+ */
+struct btcbor_writer_t{
+    uint8_t *buffer;
+    int size;
+    int length;
+    int error;
+};
+
+/**
+ * @brief Decoder of a buffer
+ *
+ *  error is set once something was malformed or of the wrong type.
+ */
+struct btcbor_reader_t{
+    const uint8_t *data;
+    int length;
+    int position;
+    int error;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void btCborWriterInit(struct btcbor_writer_t *writer, uint8_t *buffer, int size);
+void btCborPutUint(struct btcbor_writer_t *writer, uint32_t value);
+void btCborPutInt(struct btcbor_writer_t *writer, int32_t value);
+void btCborPutBytes(struct btcbor_writer_t *writer, const uint8_t *data, int length);
+void btCborPutText(struct btcbor_writer_t *writer, const char *text);
+void btCborPutArray(struct btcbor_writer_t *writer, int count);
+void btCborPutMap(struct btcbor_writer_t *writer, int count);
+void btCborPutBool(struct btcbor_writer_t *writer, int value);
+void btCborPutNull(struct btcbor_writer_t *writer);
+void btCborReaderInit(struct btcbor_reader_t *reader, const uint8_t *data, int length);
+enum btcbor_type_t btCborPeek(struct btcbor_reader_t *reader);
+int btCborGetUint(struct btcbor_reader_t *reader, uint32_t *value);
+int btCborGetInt(struct btcbor_reader_t *reader, int32_t *value);
+int btCborGetBytes(struct btcbor_reader_t *reader, const uint8_t **data, int *length);
+int btCborGetText(struct btcbor_reader_t *reader, const char **text, int *length);
+int btCborGetArray(struct btcbor_reader_t *reader, int *count);
+int btCborGetMap(struct btcbor_reader_t *reader, int *count);
+int btCborGetBool(struct btcbor_reader_t *reader, int *value);
+int btCborSkip(struct btcbor_reader_t *reader);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTCBOR_H_INCLUDED
+/** @} */
@@ -0,0 +1,417 @@
+/*!
+ * @file btclock.c
+ * @brief Source file for the clock synchronization over the bluetooth link in ChibiosRT.
+ *
+ *  NTP style: the device sends a request on BTFRAME_CHANNEL_CLOCK at t1 (its clock), the host
+ *  stamps its arrival t2 and its answer t3 (host clock), the answer arrives at t4. Then
+ *
+ *  round trip = (t4 - t1) - (t3 - t2), offset = ((t2 - t1) + (t3 - t4)) / 2
+ *
+ *  and the offset is off by at most half the round trip. Of every burst of BTCLOCK_BURST
+ *  exchanges the one with the shortest round trip is kept, a straight line fitted through the
+ *  last BTCLOCK_HISTORY of them gives the offset now and the drift. The request is one byte,
+ *  the answer 17, a burst every BTCLOCK_INTERVAL_MS keeps the traffic at a few bytes a second.
+ *
+ *  Request: sequence (u8). Answer: sequence (u8), t2 (u64 le), t3 (u64 le), host time in us.
+ *
+ *  The device clock is the realtime counter of the HAL, extended to 64 bits.
+ *  It has to be read more often than it wraps, a virtual timer does so while the clock runs.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btframe.h"
+#include "btclock.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Length of an answer of the host
+ */
+#define BTCLOCK_ANSWER_SIZE 17
+
+/**
+ * @brief How often the counter is extended, well below its wrap time (25 s at 168 MHz)
+ */
+#define BTCLOCK_WRAP_CHECK_MS 10000
+
+/**
+ * @brief An offset this far from the fitted line means the host clock was set, in microseconds
+ */
+#define BTCLOCK_STEP_US 100000
+
+/**
+ * @brief Events of the synchronization thread
+ */
+#define BTCLOCK_EVENT_ANSWER EVENT_MASK(0)
+#define BTCLOCK_EVENT_STOP EVENT_MASK(1)
+
+/**
+ * @brief One kept exchange
+ */
+struct btclock_sample_t{
+    uint64_t deviceus;          //middle of the exchange
+    int64_t offsetus;
+    uint32_t delayus;
+};
+
+/**
+ * @brief btTimeToHost(deviceus) = deviceus + offsetus + (deviceus - refus) * driftppb / 10^9
+ */
+struct btclock_model_t{
+    uint64_t refus;
+    int64_t offsetus;
+    int32_t driftppb;
+};
+
+static struct btclock_sample_t btClockHistory[BTCLOCK_HISTORY];
+static int btClockHistoryCount;
+static int btClockHistoryNext;
+
+static struct btclock_model_t btClockModel;
+static struct btclock_stats_t btClockStats;
+
+/**
+ * @brief Extended counter
+ */
+static uint64_t btClockHigh;
+static halrtcnt_t btClockLast;
+static VirtualTimer btClockWrapTimer;
+
+/**
+ * @brief The exchange waiting for its answer, 0 if none, and the answer
+ */
+static volatile uint8_t btClockPending;
+static uint64_t btClockT2, btClockT3, btClockT4;
+
+static WORKING_AREA(btClockThreadWa, BTCLOCK_THREAD_STACK_SIZE);
+static Thread *btClockThreadTp = NULL;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Reads the counter and counts its wraps, called locked
+ *
+ * \return the counter, 64 bits
+ */
+static uint64_t btclock_extend(void){
+
+    halrtcnt_t now = halGetCounterValue();
+
+    if (now < btClockLast)
+        btClockHigh += (uint64_t)1 << 32;
+    btClockLast = now;
+
+    return btClockHigh | now;
+}
+
+/*!
+ * \brief Keeps the counter extended while nobody asks for the time
+ */
+static void btclock_wrapcb(void *par){
+
+    (void)par;
+
+    chSysLockFromIsr();
+    btclock_extend();
+    chVTSetI(&btClockWrapTimer, MS2ST(BTCLOCK_WRAP_CHECK_MS), btclock_wrapcb, NULL);
+    chSysUnlockFromIsr();
+}
+
+/*!
+ * \brief Reads a little endian 64 bit number
+ */
+static uint64_t btclock_get64(const uint8_t *data){
+
+    uint64_t value = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        value = (value << 8) | data[i];
+
+    return value;
+}
+
+/*!
+ * \brief Frame handler of BTFRAME_CHANNEL_CLOCK, takes the answers of the host
+ */
+static void btclock_answer(struct BluetoothDriver *instance, uint8_t channel,
+                           uint8_t *payload, int length, void *arg){
+
+    uint64_t t4 = btClockNow();
+
+    (void)instance;
+    (void)channel;
+    (void)arg;
+
+    //late answers of timed out exchanges are dropped
+    if (length != BTCLOCK_ANSWER_SIZE || !btClockPending || payload[0] != btClockPending)
+        return;
+
+    btClockT2 = btclock_get64(payload + 1);
+    btClockT3 = btclock_get64(payload + 9);
+    btClockT4 = t4;
+    btClockPending = 0;
+
+    chSysLock();
+    if (btClockThreadTp)
+        chEvtSignalI(btClockThreadTp, BTCLOCK_EVENT_ANSWER);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/*!
+ * \brief One exchange with the host
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the host did not answer in time
+ */
+static int btclock_exchange(struct BluetoothDriver *instance, uint8_t sequence,
+                            struct btclock_sample_t *sample){
+
+    uint64_t t1;
+    int64_t delay;
+
+    chEvtGetAndClearEvents(BTCLOCK_EVENT_ANSWER);
+    btClockPending = sequence;
+    t1 = btClockNow();
+
+    if (btFrameSend(instance, BTFRAME_CHANNEL_CLOCK, &sequence, 1) != EXIT_SUCCESS ||
+        !chEvtWaitAnyTimeout(BTCLOCK_EVENT_ANSWER, MS2ST(BTCLOCK_TIMEOUT_MS))) {
+        btClockPending = 0;
+        btClockStats.timeouts++;
+        return EXIT_FAILURE;
+    }
+    btClockStats.exchanges++;
+
+    delay = (int64_t)(btClockT4 - t1) - (int64_t)(btClockT3 - btClockT2);
+    sample->delayus = delay > 0 ? delay : 0;
+    sample->offsetus = ((int64_t)(btClockT2 - t1) + (int64_t)(btClockT3 - btClockT4)) / 2;
+    sample->deviceus = t1 + (btClockT4 - t1) / 2;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Keeps a sample and fits the line through the history
+ *
+ *  Integer least squares, x in ms and y in us relative to the oldest sample,
+ *  so the sums stay far from overflowing for any sane drift and history.
+ */
+static void btclock_fit(const struct btclock_sample_t *sample){
+
+    const struct btclock_sample_t *base;
+    struct btclock_model_t model;
+    int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, den, xn = 0, fitn;
+    uint32_t maxresidual = 0;
+    int32_t ppb = 0;
+    int n, i;
+
+    //a step of the host clock makes the old samples useless
+    if (btClockStats.synced &&
+        llabs((int64_t)(btTimeToHost(sample->deviceus) - sample->deviceus) - sample->offsetus) > BTCLOCK_STEP_US)
+        btClockHistoryCount = 0;
+
+    btClockHistory[btClockHistoryNext] = *sample;
+    btClockHistoryNext = (btClockHistoryNext + 1) % BTCLOCK_HISTORY;
+    if (btClockHistoryCount < BTCLOCK_HISTORY)
+        btClockHistoryCount++;
+    btClockStats.samples++;
+
+    n = btClockHistoryCount;
+    base = &btClockHistory[(btClockHistoryNext + BTCLOCK_HISTORY - n) % BTCLOCK_HISTORY];
+
+    for (i = 0; i < n; i++) {
+        const struct btclock_sample_t *s = &btClockHistory[(btClockHistoryNext + BTCLOCK_HISTORY - n + i) % BTCLOCK_HISTORY];
+        int64_t x = (int64_t)(s->deviceus - base->deviceus) / 1000;
+        int64_t y = s->offsetus - base->offsetus;
+
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        xn = x;
+    }
+
+    //us per ms times 10^6 is ppb
+    den = n * sxx - sx * sx;
+    if (den > 0)
+        ppb = ((n * sxy - sx * sy) * 1000000) / den;
+
+    for (i = 0; i < n; i++) {
+        const struct btclock_sample_t *s = &btClockHistory[(btClockHistoryNext + BTCLOCK_HISTORY - n + i) % BTCLOCK_HISTORY];
+        int64_t x = (int64_t)(s->deviceus - base->deviceus) / 1000;
+        int64_t residual = (s->offsetus - base->offsetus) - (sy + ppb * (n * x - sx) / 1000000) / n;
+
+        if ((uint32_t)llabs(residual) > maxresidual)
+            maxresidual = llabs(residual);
+    }
+    fitn = (sy + ppb * (n * xn - sx) / 1000000) / n;
+
+    model.refus = sample->deviceus;
+    model.offsetus = base->offsetus + fitn;
+    model.driftppb = ppb;
+
+    chSysLock();
+    btClockModel = model;
+    chSysUnlock();
+
+    btClockStats.driftppb = ppb;
+    btClockStats.delayus = sample->delayus;
+    btClockStats.accuracyus = sample->delayus / 2 + maxresidual;
+    btClockStats.synced = 1;
+}
+
+/*!
+ * \brief Synchronization thread
+ */
+static msg_t btclock_thread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    uint8_t sequence = 0;
+
+    chRegSetThreadName("btclock");
+
+    while (!chThdShouldTerminate()) {
+        struct btclock_sample_t best = {0, 0, 0}, sample;
+        int i, got = 0;
+
+        for (i = 0; i < BTCLOCK_BURST && !chThdShouldTerminate(); i++) {
+            if (!++sequence)
+                sequence = 1;
+            if (btclock_exchange(instance, sequence, &sample) != EXIT_SUCCESS)
+                continue;
+            if (!got || sample.delayus < best.delayus)
+                best = sample;
+            got = 1;
+        }
+
+        if (got)
+            btclock_fit(&best);
+
+        chEvtWaitAnyTimeout(BTCLOCK_EVENT_STOP,
+                            MS2ST(btClockHistoryCount < BTCLOCK_HISTORY / 2 ? BTCLOCK_FAST_INTERVAL_MS
+                                                                            : BTCLOCK_INTERVAL_MS));
+    }
+
+    return 0;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Starts synchronizing with the host
+ *
+ *  The host has to answer on BTFRAME_CHANNEL_CLOCK, see tools/btclock.py.
+ *
+ * \param[in] instance A BluetoothDriver object, the frame receiver has to run on it
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already or the frames do not
+ */
+int btClockStart(struct BluetoothDriver *instance){
+
+    if (!instance || btClockThreadTp || !btFrameGetStats()->running)
+        return EXIT_FAILURE;
+
+    memset(&btClockStats, 0, sizeof(btClockStats));
+    btClockHistoryCount = 0;
+    btClockHistoryNext = 0;
+    btClockPending = 0;
+    btClockStats.running = 1;
+
+    chSysLock();
+    btclock_extend();
+    if (!chVTIsArmedI(&btClockWrapTimer))
+        chVTSetI(&btClockWrapTimer, MS2ST(BTCLOCK_WRAP_CHECK_MS), btclock_wrapcb, NULL);
+    chSysUnlock();
+
+    btFrameSetHandler(BTFRAME_CHANNEL_CLOCK, btclock_answer, NULL);
+    btClockThreadTp = chThdCreateStatic(btClockThreadWa, sizeof(btClockThreadWa),
+                                        NORMALPRIO, btclock_thread, instance);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops synchronizing, btTimeToHost gives device time again
+ */
+void btClockStop(void){
+
+    Thread *tp = btClockThreadTp;
+
+    if (!tp)
+        return;
+
+    btFrameSetHandler(BTFRAME_CHANNEL_CLOCK, NULL, NULL);
+    chThdTerminate(tp);
+    chEvtSignal(tp, BTCLOCK_EVENT_STOP);
+    chThdWait(tp);
+
+    chSysLock();
+    btClockThreadTp = NULL;
+    if (chVTIsArmedI(&btClockWrapTimer))
+        chVTResetI(&btClockWrapTimer);
+    memset(&btClockModel, 0, sizeof(btClockModel));
+    chSysUnlock();
+
+    btClockStats.running = 0;
+    btClockStats.synced = 0;
+}
+
+/*!
+ * \brief Returns the device clock
+ *
+ *  Only monotonic while the synchronization runs, else the counter may wrap unseen.
+ *
+ * \return microseconds
+ */
+uint64_t btClockNow(void){
+
+    uint64_t cycles;
+
+    chSysLock();
+    cycles = btclock_extend();
+    chSysUnlock();
+
+    return cycles / (halGetCounterFrequency() / 1000000);
+}
+
+/*!
+ * \brief Converts a time of the device clock to host time
+ *
+ * \param[in] deviceus A time of btClockNow
+ * \return the host time in microseconds, the device time as long as it is not synchronized
+ */
+uint64_t btTimeToHost(uint64_t deviceus){
+
+    struct btclock_model_t model;
+
+    chSysLock();
+    model = btClockModel;
+    chSysUnlock();
+
+    return deviceus + model.offsetus + (int64_t)(deviceus - model.refus) * model.driftppb / 1000000000;
+}
+
+/*!
+ * \brief Returns the clock statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct btclock_stats_t *btClockGetStats(void){
+
+    uint64_t now = btClockNow();
+
+    btClockStats.offsetus = (int64_t)(btTimeToHost(now) - now);
+
+    return &btClockStats;
+}
+
+/** @} */
@@ -0,0 +1,101 @@
+/*!
+ * @file btclock.h
+ * @brief Header file for the clock synchronization over the bluetooth link in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTCLOCK_H_INCLUDED
+#define BTCLOCK_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Clock configuration options
+ * @{
+ */
+/**
+ * @brief   Exchanges in a row, the one with the shortest round trip is kept.
+ */
+#if !defined(BTCLOCK_BURST) || defined(__DOXYGEN__)
+#define BTCLOCK_BURST 4
+#endif
+/**
+ * @brief   Kept samples, the drift is fitted over them.
+ */
+#if !defined(BTCLOCK_HISTORY) || defined(__DOXYGEN__)
+#define BTCLOCK_HISTORY 8
+#endif
+/**
+ * @brief   Time between two bursts once synchronized, in milliseconds.
+ */
+#if !defined(BTCLOCK_INTERVAL_MS) || defined(__DOXYGEN__)
+#define BTCLOCK_INTERVAL_MS 30000
+#endif
+/**
+ * @brief   Time between two bursts until there are enough samples for the drift, in milliseconds.
+ */
+#if !defined(BTCLOCK_FAST_INTERVAL_MS) || defined(__DOXYGEN__)
+#define BTCLOCK_FAST_INTERVAL_MS 2000
+#endif
+/**
+ * @brief   How long an exchange waits for the answer of the host, in milliseconds.
+ */
+#if !defined(BTCLOCK_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define BTCLOCK_TIMEOUT_MS 500
+#endif
+/**
+ * @brief   Stack size of the synchronization thread.
+ */
+#if !defined(BTCLOCK_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTCLOCK_THREAD_STACK_SIZE 512
+#endif
+/** @} */
+
+#if !HAL_IMPLEMENTS_COUNTERS
+#error "btclock needs the realtime counter of the HAL"
+#endif
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Clock statistics
+ */
+struct btclock_stats_t{
+    int running;
+    int synced;                 //btTimeToHost gives host time
+    uint32_t exchanges;         //answered
+    uint32_t timeouts;
+    uint32_t samples;           //kept, one per burst
+    int64_t offsetus;           //host time - device time, now
+    int32_t driftppb;           //how much faster the host clock runs
+    uint32_t delayus;           //round trip of the last sample
+    uint32_t accuracyus;        //error bound of btTimeToHost
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btClockStart(struct BluetoothDriver *instance);
+void btClockStop(void);
+uint64_t btClockNow(void);
+uint64_t btTimeToHost(uint64_t deviceus);
+const struct btclock_stats_t *btClockGetStats(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTCLOCK_H_INCLUDED
+/** @} */
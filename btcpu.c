@@ -0,0 +1,303 @@
+/*!
+ * @file btcpu.c
+ * @brief Source file for the per thread CPU load sampling in ChibiosRT.
+ *
+ *  With CH_DBG_THREADS_PROFILING the kernel adds every system tick to p_time of the thread it
+ *  interrupted. Two snapshots of the registry a window apart give the ticks every thread got
+ *  in the window, their share of all ticks is its load. It is a statistical measure: the
+ *  resolution is a tick, interrupts count for the thread they interrupted, and a thread that
+ *  always runs between two ticks is not seen. Over a window of a second or more it shows well
+ *  which thread is hot.
+ *
+ *  The peak of every thread, and when it was, is kept over all windows until btCpuReset.
+ *  btCpuStart samples in the background, so the peaks also cover the time nobody watched.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btcpu.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief The ticks of a thread at a time
+ */
+struct btcpu_snapshot_t{
+    Thread *tp;
+    systime_t time;
+};
+
+/**
+ * @brief Kept state of a thread
+ */
+struct btcpu_thread_t{
+    const char *name;
+    int running;
+    uint16_t load;
+    uint16_t peak;
+    uint32_t peakms;
+    uint32_t ticks;             //of the thread, all windows
+    uint32_t windowticks;       //of all threads, the windows the thread was seen in
+};
+
+/**
+ * @brief Names of the threads of the bluetooth link begin so
+ */
+static const char * const btCpuLinkPrefixes[] = {"bt", "bridge", "hc05", "telemetry"};
+
+static struct btcpu_thread_t btCpuThreads[BTCPU_THREADS];
+static int btCpuThreadCount;
+
+/**
+ * @brief One sampler at a time, the snapshots are shared
+ */
+static MUTEX_DECL(btCpuMutex);
+static struct btcpu_snapshot_t btCpuBefore[BTCPU_THREADS];
+static struct btcpu_snapshot_t btCpuAfter[BTCPU_THREADS];
+static systime_t btCpuDelta[BTCPU_THREADS];
+
+static uint32_t btCpuWindowMs;
+static WORKING_AREA(btCpuThreadWa, BTCPU_THREAD_STACK_SIZE);
+static Thread *btCpuThreadTp = NULL;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Takes the ticks of all threads
+ *
+ * \return the number of threads taken
+ */
+static int btcpu_snapshot(struct btcpu_snapshot_t *snapshot){
+
+    Thread *tp = chRegFirstThread();
+    int count = 0;
+
+    do {
+        if (count < BTCPU_THREADS) {
+            snapshot[count].tp = tp;
+            snapshot[count].time = tp->p_time;
+            count++;
+        }
+        tp = chRegNextThread(tp);
+    } while (tp != NULL);
+
+    return count;
+}
+
+/*!
+ * \brief Finds or adds the kept state of a thread, called locked
+ *
+ * \return the kept state, NULL if the table is full
+ */
+static struct btcpu_thread_t *btcpu_keep(const char *name){
+
+    struct btcpu_thread_t *thread;
+    int i;
+
+    for (i = 0; i < btCpuThreadCount; i++)
+        if (!strcmp(btCpuThreads[i].name, name))
+            return &btCpuThreads[i];
+
+    if (btCpuThreadCount == BTCPU_THREADS)
+        return NULL;
+
+    thread = &btCpuThreads[btCpuThreadCount++];
+    memset(thread, 0, sizeof(*thread));
+    thread->name = name;
+
+    return thread;
+}
+
+/*!
+ * \brief Tells if a thread belongs to the bluetooth link
+ */
+static int btcpu_islink(const char *name){
+
+    unsigned i;
+
+    for (i = 0; i < sizeof(btCpuLinkPrefixes) / sizeof(btCpuLinkPrefixes[0]); i++)
+        if (!strncmp(name, btCpuLinkPrefixes[i], strlen(btCpuLinkPrefixes[i])))
+            return 1;
+
+    return 0;
+}
+
+/*!
+ * \brief Copies the kept states into reports, called locked
+ *
+ * \return the number of reports
+ */
+static int btcpu_report(struct btcpu_usage_t *usage, int max){
+
+    int count = btCpuThreadCount < max ? btCpuThreadCount : max;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const struct btcpu_thread_t *thread = &btCpuThreads[i];
+
+        usage[i].name = thread->name;
+        usage[i].running = thread->running;
+        usage[i].link = btcpu_islink(thread->name);
+        usage[i].load = thread->running ? thread->load : 0;
+        usage[i].peak = thread->peak;
+        usage[i].peakms = thread->peakms;
+        usage[i].average = thread->windowticks
+                ? (uint16_t)(((uint64_t)thread->ticks * 1000) / thread->windowticks)
+                : 0;
+    }
+
+    return count;
+}
+
+/*!
+ * \brief Background sampler
+ */
+static msg_t btcpu_thread(void *arg){
+
+    (void)arg;
+    chRegSetThreadName("cpusampler");
+
+    while (!chThdShouldTerminate())
+        btCpuSample(btCpuWindowMs, NULL, 0);
+
+    return 0;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Samples the load of all threads over a window, blocks for the window
+ *
+ * \param[in] windowms The window in milliseconds
+ * \param[out] usage The reports, may be NULL
+ * \param[in] max Room in usage
+ * \return the number of reports
+ */
+int btCpuSample(uint32_t windowms, struct btcpu_usage_t *usage, int max){
+
+    int before, after, i, j, count;
+    uint32_t total = 0;
+    uint32_t now;
+
+    chMtxLock(&btCpuMutex);
+
+    before = btcpu_snapshot(btCpuBefore);
+    chThdSleepMilliseconds(windowms);
+    after = btcpu_snapshot(btCpuAfter);
+
+    //a thread not seen before, or a new one in the working area of an ended one, counts from 0
+    for (i = 0; i < after; i++) {
+        btCpuDelta[i] = btCpuAfter[i].time;
+        for (j = 0; j < before; j++)
+            if (btCpuBefore[j].tp == btCpuAfter[i].tp && btCpuBefore[j].time <= btCpuAfter[i].time)
+                btCpuDelta[i] = btCpuAfter[i].time - btCpuBefore[j].time;
+        total += btCpuDelta[i];
+    }
+    now = (uint32_t)(((uint64_t)chTimeNow() * 1000) / CH_FREQUENCY);
+
+    chSysLock();
+    for (i = 0; i < btCpuThreadCount; i++)
+        btCpuThreads[i].running = 0;
+
+    for (i = 0; i < after && total; i++) {
+        struct btcpu_thread_t *thread = btcpu_keep(btCpuAfter[i].tp->p_name ? btCpuAfter[i].tp->p_name : "");
+
+        if (!thread)
+            continue;
+
+        thread->running = 1;
+        thread->load = ((uint64_t)btCpuDelta[i] * 1000) / total;
+        if (thread->load > thread->peak) {
+            thread->peak = thread->load;
+            thread->peakms = now;
+        }
+        thread->ticks += btCpuDelta[i];
+        thread->windowticks += total;
+    }
+
+    count = usage ? btcpu_report(usage, max) : 0;
+    chSysUnlock();
+
+    chMtxUnlock();
+
+    return count;
+}
+
+/*!
+ * \brief Reports the loads of the last window and the peaks
+ *
+ * \param[out] usage The reports
+ * \param[in] max Room in usage
+ * \return the number of reports
+ */
+int btCpuGetUsage(struct btcpu_usage_t *usage, int max){
+
+    int count;
+
+    chSysLock();
+    count = btcpu_report(usage, max);
+    chSysUnlock();
+
+    return count;
+}
+
+/*!
+ * \brief Starts sampling in the background
+ *
+ * \param[in] windowms The window in milliseconds
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already
+ */
+int btCpuStart(uint32_t windowms){
+
+    if (btCpuThreadTp || !windowms)
+        return EXIT_FAILURE;
+
+    btCpuWindowMs = windowms;
+    //above the threads it measures, so the windows keep their length
+    btCpuThreadTp = chThdCreateStatic(btCpuThreadWa, sizeof(btCpuThreadWa),
+                                      NORMALPRIO + 10, btcpu_thread, NULL);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops the background sampling, waits for the window to end
+ */
+void btCpuStop(void){
+
+    if (!btCpuThreadTp)
+        return;
+
+    chThdTerminate(btCpuThreadTp);
+    chThdWait(btCpuThreadTp);
+    btCpuThreadTp = NULL;
+}
+
+/*!
+ * \brief Tells if the background sampling runs
+ */
+int btCpuIsRunning(void){
+
+    return btCpuThreadTp != NULL;
+}
+
+/*!
+ * \brief Forgets the peaks and the averages
+ */
+void btCpuReset(void){
+
+    chSysLock();
+    btCpuThreadCount = 0;
+    chSysUnlock();
+}
+
+/** @} */
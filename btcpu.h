@@ -0,0 +1,81 @@
+/*!
+ * @file btcpu.h
+ * @brief Header file for the per thread CPU load sampling in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTCPU_H_INCLUDED
+#define BTCPU_H_INCLUDED
+
+#include <ch.h>
+#include <stdlib.h>
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    CPU sampling configuration options
+ * @{
+ */
+/**
+ * @brief   Threads that are sampled and whose peak is kept.
+ */
+#if !defined(BTCPU_THREADS) || defined(__DOXYGEN__)
+#define BTCPU_THREADS 24
+#endif
+/**
+ * @brief   Default sampling window, in milliseconds.
+ */
+#if !defined(BTCPU_WINDOW_MS) || defined(__DOXYGEN__)
+#define BTCPU_WINDOW_MS 1000
+#endif
+/**
+ * @brief   Stack size of the background sampler.
+ */
+#if !defined(BTCPU_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTCPU_THREAD_STACK_SIZE 512
+#endif
+/** @} */
+
+#if !CH_DBG_THREADS_PROFILING
+#error "btcpu needs CH_DBG_THREADS_PROFILING"
+#endif
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief CPU load of a thread, in per mille
+ */
+struct btcpu_usage_t{
+    const char *name;
+    int running;
+    int link;                   //one of the bluetooth link threads
+    uint16_t load;              //in the last window
+    uint16_t peak;              //highest of all windows
+    uint32_t peakms;            //system time of the window with the peak
+    uint16_t average;           //over all windows
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btCpuSample(uint32_t windowms, struct btcpu_usage_t *usage, int max);
+int btCpuGetUsage(struct btcpu_usage_t *usage, int max);
+int btCpuStart(uint32_t windowms);
+void btCpuStop(void);
+int btCpuIsRunning(void);
+void btCpuReset(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTCPU_H_INCLUDED
+/** @} */
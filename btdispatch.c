@@ -0,0 +1,156 @@
+/*!
+ * @file btdispatch.c
+ * @brief Source file for the command dispatcher of the bluetooth data stream in ChibiosRT.
+ *
+ *  The command table is constant. btDispatchInit searches a seed for the hash that puts every
+ *  name in its own slot, a perfect hash for that table. A lookup hashes the command name while
+ *  it is split off the line, then compares it with the one name in its slot, so the cost
+ *  depends on the length of the line and not on the number of commands.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btdispatch.h"
+#include <string.h>
+
+#if (BTDISPATCH_TABLE_SIZE & (BTDISPATCH_TABLE_SIZE - 1)) || BTDISPATCH_TABLE_SIZE > 256
+#error "BTDISPATCH_TABLE_SIZE must be a power of two, up to 256"
+#endif
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief One step of the seeded FNV-1a hash
+ */
+#define BTDISPATCH_HASHSTEP(hash, c) (((hash) ^ (uint8_t)(c)) * 16777619u)
+
+/*!
+ * \brief Start value of the hash for a seed
+ */
+#define BTDISPATCH_HASHSTART(seed) (2166136261u ^ ((seed) * 2654435761u))
+
+/*!
+ * \brief Hashes a command name
+ *
+ * \param[in] name The name
+ * \param[in] seed The seed
+ * \return the slot of the name
+ */
+static int btdispatch_slot(const char *name, uint32_t seed){
+
+    uint32_t hash = BTDISPATCH_HASHSTART(seed);
+
+    while (*name)
+        hash = BTDISPATCH_HASHSTEP(hash, *name++);
+
+    return hash & (BTDISPATCH_TABLE_SIZE - 1);
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Builds the perfect hash for a command table
+ *
+ * \param[in] dispatch The dispatcher
+ * \param[in] commands The command table, must stay valid
+ * \param[in] count Its number of entries
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the table is too big, has a name twice, or no seed was found
+ */
+int btDispatchInit(struct btdispatch_t *dispatch, const struct btdispatch_command_t *commands, int count){
+
+    uint32_t seed;
+    int i;
+
+    if (!dispatch || !commands || count <= 0 || count >= BTDISPATCH_TABLE_SIZE)
+        return EXIT_FAILURE;
+
+    memset(dispatch, 0, sizeof(*dispatch));
+    dispatch->commands = commands;
+    dispatch->count = count;
+
+    for (seed = 0; seed < BTDISPATCH_MAX_SEEDS; seed++) {
+        memset(dispatch->slots, 0, sizeof(dispatch->slots));
+
+        for (i = 0; i < count; i++) {
+            int slot = btdispatch_slot(commands[i].name, seed);
+
+            if (dispatch->slots[slot])
+                break;
+            dispatch->slots[slot] = i + 1;
+        }
+
+        if (i == count) {
+            dispatch->seed = seed;
+            return EXIT_SUCCESS;
+        }
+    }
+
+    memset(dispatch->slots, 0, sizeof(dispatch->slots));
+    dispatch->count = 0;
+    return EXIT_FAILURE;
+}
+
+/*!
+ * \brief Runs the command of a line
+ *
+ *  The line is split at spaces into the command name and its arguments, in place.
+ *
+ * \param[in] dispatch The dispatcher
+ * \param[in] instance Passed to the handler
+ * \param[in] line The line, '\0' terminated
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it is not a known command
+ */
+int btDispatchLine(struct btdispatch_t *dispatch, struct BluetoothDriver *instance, char *line){
+
+    char *argv[BTDISPATCH_MAX_ARGS];
+    uint32_t hash;
+    int argc = 0;
+    int index;
+
+    if (!dispatch || !dispatch->count || !line)
+        return EXIT_FAILURE;
+
+    while (*line == ' ')
+        line++;
+
+    //the name, hashed on the way
+    argv[argc++] = line;
+    hash = BTDISPATCH_HASHSTART(dispatch->seed);
+    while (*line && *line != ' ') {
+        hash = BTDISPATCH_HASHSTEP(hash, *line);
+        line++;
+    }
+
+    //the arguments
+    while (*line) {
+        *line++ = '\0';
+        while (*line == ' ')
+            line++;
+        if (!*line)
+            break;
+        if (argc == BTDISPATCH_MAX_ARGS)
+            break;
+        argv[argc++] = line;
+        while (*line && *line != ' ')
+            line++;
+    }
+
+    index = dispatch->slots[hash & (BTDISPATCH_TABLE_SIZE - 1)];
+    if (!index || strcmp(dispatch->commands[index - 1].name, argv[0])) {
+        dispatch->unknown++;
+        return EXIT_FAILURE;
+    }
+
+    dispatch->dispatched++;
+    dispatch->commands[index - 1].handler(instance, argc, argv);
+
+    return EXIT_SUCCESS;
+}
+
+/** @} */
@@ -0,0 +1,90 @@
+/*!
+ * @file btdispatch.h
+ * @brief Header file for the command dispatcher of the bluetooth data stream in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTDISPATCH_H_INCLUDED
+#define BTDISPATCH_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Dispatcher configuration options
+ * @{
+ */
+/**
+ * @brief   Slots of the hash table, a power of two.
+ * @details Configuration parameter, must be larger than the number of commands. Twice or
+ *          more makes a collision free seed quick to find.
+ */
+#if !defined(BTDISPATCH_TABLE_SIZE) || defined(__DOXYGEN__)
+#define BTDISPATCH_TABLE_SIZE 32
+#endif
+/**
+ * @brief   Seeds btDispatchInit tries before it gives up.
+ */
+#if !defined(BTDISPATCH_MAX_SEEDS) || defined(__DOXYGEN__)
+#define BTDISPATCH_MAX_SEEDS 4096
+#endif
+/**
+ * @brief   Most arguments a command gets, with its name.
+ */
+#if !defined(BTDISPATCH_MAX_ARGS) || defined(__DOXYGEN__)
+#define BTDISPATCH_MAX_ARGS 4
+#endif
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Command handler, argv[0] is the command name
+ */
+typedef void (*btdispatch_handler_t)(struct BluetoothDriver *instance, int argc, char *argv[]);
+
+/**
+ * @brief One command of the table
+ */
+struct btdispatch_command_t{
+    const char *name;
+    btdispatch_handler_t handler;
+};
+
+/**
+ * @brief Dispatcher over a constant command table
+ *
+ *  slots holds the index of the command + 1 whose name hashes there, 0 if none.
+ */
+struct btdispatch_t{
+    const struct btdispatch_command_t *commands;
+    int count;
+    uint32_t seed;              //makes the hash collision free for this table
+    uint8_t slots[BTDISPATCH_TABLE_SIZE];
+    uint32_t dispatched;
+    uint32_t unknown;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btDispatchInit(struct btdispatch_t *dispatch, const struct btdispatch_command_t *commands, int count);
+int btDispatchLine(struct btdispatch_t *dispatch, struct BluetoothDriver *instance, char *line);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTDISPATCH_H_INCLUDED
+/** @} */
@@ -0,0 +1,312 @@
+/*!
+ * @file btframe.c
+ * @brief Source file for the framed channels over the bluetooth link in ChibiosRT.
+ *
+ *  A frame is SLIP encoded (RFC 1055) and ends with BTFRAME_END. Decoded it is: the channel
+ *  byte, the payload, then the CRC-16/CCITT (0x1021, start 0xFFFF) of both, little endian.
+ *  A receiver thread reads the link and hands every intact frame to the handler of its channel.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btframe.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Handler of a channel
+ */
+struct btframe_channel_t{
+    btframe_handler_t handler;
+    void *arg;
+};
+
+static struct btframe_channel_t btFrameChannels[BTFRAME_CHANNELS];
+
+/**
+ * @brief Frame being received: channel, payload, CRC
+ */
+static uint8_t btFrameRxBuffer[BTFRAME_MAX_PAYLOAD + 3];
+static int btFrameRxLength;
+static int btFrameRxEscape;
+static int btFrameRxOverflow;
+
+/**
+ * @brief Encoded frame being sent, every byte may be escaped
+ */
+static uint8_t btFrameTxBuffer[2 * (BTFRAME_MAX_PAYLOAD + 3) + 2];
+
+/**
+ * @brief Serializes the senders
+ */
+static MUTEX_DECL(btFrameTxMutex);
+
+static WORKING_AREA(btFrameThreadWa, BTFRAME_THREAD_STACK_SIZE);
+static Thread *btFrameThreadTp = NULL;
+
+static struct btframe_stats_t btFrameStats;
+
+/**
+ * @brief CRC-16/CCITT, four bits at a time
+ */
+static const uint16_t btFrameCrcTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Adds a byte to the encoded frame, escaped
+ *
+ * \return the new length
+ */
+static int btframe_put(int length, uint8_t byte){
+
+    if (byte == BTFRAME_END) {
+        btFrameTxBuffer[length++] = BTFRAME_ESC;
+        btFrameTxBuffer[length++] = BTFRAME_ESC_END;
+    }
+    else if (byte == BTFRAME_ESC) {
+        btFrameTxBuffer[length++] = BTFRAME_ESC;
+        btFrameTxBuffer[length++] = BTFRAME_ESC_ESC;
+    }
+    else
+        btFrameTxBuffer[length++] = byte;
+
+    return length;
+}
+
+/*!
+ * \brief A frame ended, checks it and calls the handler of its channel
+ */
+static void btframe_complete(struct BluetoothDriver *instance){
+
+    int length = btFrameRxLength;
+    struct btframe_channel_t *channel;
+
+    btFrameRxLength = 0;
+    btFrameRxEscape = 0;
+
+    if (btFrameRxOverflow) {
+        btFrameRxOverflow = 0;
+        btFrameStats.overflows++;
+        return;
+    }
+    //back to back ENDs, or noise
+    if (length < 3)
+        return;
+
+    if (btFrameCrc(0xFFFF, btFrameRxBuffer, length - 2) !=
+        (btFrameRxBuffer[length - 2] | (btFrameRxBuffer[length - 1] << 8))) {
+        btFrameStats.crcerrors++;
+        return;
+    }
+
+    btFrameStats.rxframes++;
+    channel = btFrameRxBuffer[0] < BTFRAME_CHANNELS ? &btFrameChannels[btFrameRxBuffer[0]] : NULL;
+    if (!channel || !channel->handler) {
+        btFrameStats.unhandled++;
+        return;
+    }
+
+    channel->handler(instance, btFrameRxBuffer[0], btFrameRxBuffer + 1, length - 3, channel->arg);
+}
+
+/*!
+ * \brief Decodes received bytes
+ */
+static void btframe_feed(struct BluetoothDriver *instance, const uint8_t *data, int length){
+
+    while (length--) {
+        uint8_t byte = *data++;
+
+        if (byte == BTFRAME_END) {
+            btframe_complete(instance);
+            continue;
+        }
+
+        if (btFrameRxEscape) {
+            btFrameRxEscape = 0;
+            byte = byte == BTFRAME_ESC_END ? BTFRAME_END : byte == BTFRAME_ESC_ESC ? BTFRAME_ESC : byte;
+        }
+        else if (byte == BTFRAME_ESC) {
+            btFrameRxEscape = 1;
+            continue;
+        }
+
+        if (btFrameRxLength < (int)sizeof(btFrameRxBuffer))
+            btFrameRxBuffer[btFrameRxLength++] = byte;
+        else
+            btFrameRxOverflow = 1;
+    }
+}
+
+/*!
+ * \brief Receiver thread
+ */
+static msg_t btframe_thread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    uint8_t chunk[32];
+
+    chRegSetThreadName("btframe");
+
+    while (!chThdShouldTerminate()) {
+        int n = btReadTimeout(instance, (char *)chunk, 1, MS2ST(BTFRAME_POLL_MS));
+
+        if (!n)
+            continue;
+        n += btReadTimeout(instance, (char *)chunk + 1, sizeof(chunk) - 1, TIME_IMMEDIATE);
+
+        btframe_feed(instance, chunk, n);
+    }
+
+    return 0;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Updates a CRC-16/CCITT
+ *
+ * \param[in] crc The CRC so far, 0xFFFF to start
+ * \param[in] data The bytes
+ * \param[in] length Their number
+ * \return the new CRC
+ */
+uint16_t btFrameCrc(uint16_t crc, const uint8_t *data, int length){
+
+    while (length--) {
+        crc = (crc << 4) ^ btFrameCrcTable[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ btFrameCrcTable[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+
+    return crc;
+}
+
+/*!
+ * \brief Sets the handler of a channel
+ *
+ * \param[in] channel The channel
+ * \param[in] handler The handler, NULL to drop the frames of the channel
+ * \param[in] arg Passed to the handler
+ * \return EXIT_SUCCESS or EXIT_FAILURE if there is no such channel
+ */
+int btFrameSetHandler(uint8_t channel, btframe_handler_t handler, void *arg){
+
+    if (channel >= BTFRAME_CHANNELS)
+        return EXIT_FAILURE;
+
+    chSysLock();
+    btFrameChannels[channel].handler = handler;
+    btFrameChannels[channel].arg = arg;
+    chSysUnlock();
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Sends a frame
+ *
+ *  Any thread may send, also the channel handlers.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] channel The channel
+ * \param[in] payload The payload
+ * \param[in] length Its length, up to BTFRAME_MAX_PAYLOAD
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int btFrameSend(struct BluetoothDriver *instance, uint8_t channel, const uint8_t *payload, int length){
+
+    uint16_t crc;
+    int encoded = 0;
+    int written, i;
+
+    if (!instance || (length && !payload) || length < 0 || length > BTFRAME_MAX_PAYLOAD)
+        return EXIT_FAILURE;
+
+    crc = btFrameCrc(btFrameCrc(0xFFFF, &channel, 1), payload, length);
+
+    chMtxLock(&btFrameTxMutex);
+
+    //a leading END flushes the noise the receiver may have collected
+    btFrameTxBuffer[encoded++] = BTFRAME_END;
+    encoded = btframe_put(encoded, channel);
+    for (i = 0; i < length; i++)
+        encoded = btframe_put(encoded, payload[i]);
+    encoded = btframe_put(encoded, crc & 0xFF);
+    encoded = btframe_put(encoded, crc >> 8);
+    btFrameTxBuffer[encoded++] = BTFRAME_END;
+
+    written = btWriteTimeout(instance, (char *)btFrameTxBuffer, encoded, MS2ST(BTFRAME_TX_TIMEOUT_MS));
+    if (written == encoded)
+        btFrameStats.txframes++;
+    else
+        btFrameStats.txfailures++;
+
+    chMtxUnlock();
+
+    return written == encoded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*!
+ * \brief Starts receiving frames
+ *
+ *  The receiver reads the link, nothing else may read it while it runs.
+ *
+ * \param[in] instance A BluetoothDriver object, open
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already
+ */
+int btFrameStart(struct BluetoothDriver *instance){
+
+    if (!instance || btFrameThreadTp)
+        return EXIT_FAILURE;
+
+    memset(&btFrameStats, 0, sizeof(btFrameStats));
+    btFrameRxLength = 0;
+    btFrameRxEscape = 0;
+    btFrameRxOverflow = 0;
+    btFrameStats.running = 1;
+
+    btFrameThreadTp = chThdCreateStatic(btFrameThreadWa, sizeof(btFrameThreadWa),
+                                        NORMALPRIO + 1, btframe_thread, instance);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops receiving frames
+ */
+void btFrameStop(void){
+
+    if (!btFrameThreadTp)
+        return;
+
+    chThdTerminate(btFrameThreadTp);
+    chThdWait(btFrameThreadTp);
+    btFrameThreadTp = NULL;
+    btFrameStats.running = 0;
+}
+
+/*!
+ * \brief Returns the frame statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct btframe_stats_t *btFrameGetStats(void){
+
+    return &btFrameStats;
+}
+
+/** @} */
@@ -0,0 +1,117 @@
+/*!
+ * @file btframe.h
+ * @brief Header file for the framed channels over the bluetooth link in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTFRAME_H_INCLUDED
+#define BTFRAME_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Frame configuration options
+ * @{
+ */
+/**
+ * @brief   Largest payload of a frame.
+ */
+#if !defined(BTFRAME_MAX_PAYLOAD) || defined(__DOXYGEN__)
+#define BTFRAME_MAX_PAYLOAD 200
+#endif
+/**
+ * @brief   Number of channels, the first byte of a frame.
+ */
+#if !defined(BTFRAME_CHANNELS) || defined(__DOXYGEN__)
+#define BTFRAME_CHANNELS 8
+#endif
+/**
+ * @brief   Stack size of the receiver thread, the channel handlers run on it.
+ */
+#if !defined(BTFRAME_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTFRAME_THREAD_STACK_SIZE 768
+#endif
+/**
+ * @brief   How often the receiver checks if it has to stop, in milliseconds.
+ */
+#if !defined(BTFRAME_POLL_MS) || defined(__DOXYGEN__)
+#define BTFRAME_POLL_MS 100
+#endif
+/**
+ * @brief   How long btFrameSend waits for room in the output, in milliseconds.
+ */
+#if !defined(BTFRAME_TX_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define BTFRAME_TX_TIMEOUT_MS 500
+#endif
+/** @} */
+
+/**
+ * @name    Channels in use
+ * @{
+ */
+#define BTFRAME_CHANNEL_RPC 1
+#define BTFRAME_CHANNEL_TELEMETRY 2
+#define BTFRAME_CHANNEL_CLOCK 3
+/** @} */
+
+/**
+ * @name    SLIP bytes
+ * @{
+ */
+#define BTFRAME_END 0xC0
+#define BTFRAME_ESC 0xDB
+#define BTFRAME_ESC_END 0xDC
+#define BTFRAME_ESC_ESC 0xDD
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Called on the receiver thread with every intact frame of a channel
+ *
+ *  The payload is only valid during the call.
+ */
+typedef void (*btframe_handler_t)(struct BluetoothDriver *instance, uint8_t channel,
+                                  uint8_t *payload, int length, void *arg);
+
+/**
+ * @brief Frame statistics
+ */
+struct btframe_stats_t{
+    int running;
+    uint32_t rxframes;
+    uint32_t txframes;
+    uint32_t crcerrors;
+    uint32_t overflows;         //frames longer than BTFRAME_MAX_PAYLOAD
+    uint32_t unhandled;         //frames of a channel without a handler
+    uint32_t txfailures;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btFrameSetHandler(uint8_t channel, btframe_handler_t handler, void *arg);
+int btFrameSend(struct BluetoothDriver *instance, uint8_t channel, const uint8_t *payload, int length);
+int btFrameStart(struct BluetoothDriver *instance);
+void btFrameStop(void);
+const struct btframe_stats_t *btFrameGetStats(void);
+uint16_t btFrameCrc(uint16_t crc, const uint8_t *data, int length);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTFRAME_H_INCLUDED
+/** @} */
@@ -0,0 +1,278 @@
+/*!
+ * @file btline.c
+ * @brief Source file for the line assembler of the bluetooth data stream in ChibiosRT.
+ *
+ *  Collects the received bytes into lines, however the reads split them. A line that is
+ *  complete in the received data is delivered in place, its line end replaced by '\0'; only
+ *  the start of a line that continues in the next feed is copied.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btline.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+#if BTLINE_USE_SWAR || defined(__DOXYGEN__)
+/*!
+ * \brief Nonzero if a byte of the word is zero (the high bit of that byte is set)
+ */
+#define BTLINE_HASZERO(w) (((w) - 0x01010101u) & ~(w) & 0x80808080u)
+
+/*!
+ * \brief Finds the first line end, four bytes at a time
+ *
+ * \param[in] data The bytes
+ * \param[in] length Their number
+ * \return index of the first '\r' or '\n', length if there is none
+ */
+static int btline_scan(const char *data, int length){
+
+    const char *p = data;
+    const char *end = data + length;
+
+    //up to the word boundary
+    while (p < end && ((size_t)p & 3)) {
+        if (*p == '\r' || *p == '\n')
+            return p - data;
+        p++;
+    }
+
+    while (end - p >= 4) {
+        uint32_t word = *(const uint32_t *)p;
+
+        if (BTLINE_HASZERO(word ^ 0x0D0D0D0Du) | BTLINE_HASZERO(word ^ 0x0A0A0A0Au))
+            break;
+        p += 4;
+    }
+
+    while (p < end) {
+        if (*p == '\r' || *p == '\n')
+            return p - data;
+        p++;
+    }
+
+    return length;
+}
+#else
+/*!
+ * \brief Finds the first line end with memchr
+ *
+ * \param[in] data The bytes
+ * \param[in] length Their number
+ * \return index of the first '\r' or '\n', length if there is none
+ */
+static int btline_scan(const char *data, int length){
+
+    const char *lf = memchr(data, '\n', length);
+    const char *cr = memchr(data, '\r', lf ? lf - data : length);
+
+    if (cr)
+        return cr - data;
+    if (lf)
+        return lf - data;
+    return length;
+}
+#endif
+
+/*!
+ * \brief Delivers the collected line and starts the next one
+ *
+ * \return 1 if a line was delivered
+ */
+static int btline_deliver(struct btline_t *line, btline_callback_t callback, void *arg){
+
+    int delivered = 0;
+
+    if (line->overflow)
+        line->overflows++;
+
+    if (line->length && !(line->overflow && line->policy == btline_drop)) {
+        line->buffer[line->length] = '\0';
+        line->lines++;
+        delivered = 1;
+        callback(line->buffer, line->length, arg);
+    }
+
+    line->length = 0;
+    line->overflow = 0;
+    return delivered;
+}
+
+/*!
+ * \brief Adds a piece of a line to the buffer, as far as the policy lets it
+ *
+ * \return the number of lines delivered (btline_split)
+ */
+static int btline_append(struct btline_t *line, const char *data, int length,
+                         btline_callback_t callback, void *arg){
+
+    int lines = 0;
+
+    while (length) {
+        int room = BTLINE_MAX_LENGTH - line->length;
+        int n = length < room ? length : room;
+
+        if (line->overflow && line->policy != btline_split)
+            return lines;
+
+        memcpy(line->buffer + line->length, data, n);
+        line->length += n;
+        data += n;
+        length -= n;
+
+        if (!length)
+            break;
+
+        //full, and more is coming
+        line->overflow = 1;
+        if (line->policy == btline_split) {
+            line->buffer[line->length] = '\0';
+            line->lines++;
+            lines++;
+            callback(line->buffer, line->length, arg);
+            line->length = 0;
+        }
+    }
+
+    return lines;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Initializes a line assembler
+ *
+ * \param[in] line The line assembler
+ * \param[in] policy What to do with the lines longer than BTLINE_MAX_LENGTH
+ */
+void btLineInit(struct btline_t *line, enum btline_overflow_t policy){
+
+    if (!line)
+        return;
+
+    memset(line, 0, sizeof(*line));
+    line->policy = policy;
+}
+
+/*!
+ * \brief Feeds received bytes to the line assembler
+ *
+ *  The line ends in data are overwritten with '\0'.
+ *
+ * \param[in] line The line assembler
+ * \param[in] data The received bytes
+ * \param[in] length Their number
+ * \param[in] callback Called with every line completed by the data
+ * \param[in] arg Passed to the callback
+ * \return the number of lines delivered, or -1 on wrong parameters
+ */
+int btLineFeed(struct btline_t *line, char *data, int length, btline_callback_t callback, void *arg){
+
+    int lines = 0;
+
+    if (!line || (length && !data) || !callback)
+        return -1;
+
+    while (length > 0) {
+        int n = btline_scan(data, length);
+
+        if (n == length) {
+            //the line goes on in the next feed
+            lines += btline_append(line, data, n, callback, arg);
+            break;
+        }
+
+        if (!line->length && !line->overflow && n <= BTLINE_MAX_LENGTH) {
+            //the whole line is here
+            if (n) {
+                data[n] = '\0';
+                line->lines++;
+                line->inplace++;
+                lines++;
+                callback(data, n, arg);
+            }
+        }
+        else {
+            lines += btline_append(line, data, n, callback, arg);
+            lines += btline_deliver(line, callback, arg);
+        }
+
+        data += n + 1;
+        length -= n + 1;
+    }
+
+    return lines;
+}
+
+/*!
+ * \brief Feeds the line assembler from an input queue, without copying the data out
+ *
+ *  The lines are delivered from the ring of the queue, the caller must be the only reader.
+ *
+ * \param[in] line The line assembler
+ * \param[in] iqp The input queue
+ * \param[in] callback Called with every line completed
+ * \param[in] arg Passed to the callback
+ * \return the number of lines delivered, or -1 on wrong parameters
+ */
+int btLineFeedQueue(struct btline_t *line, InputQueue *iqp, btline_callback_t callback, void *arg){
+
+    int lines = 0;
+
+    if (!line || !iqp || !callback)
+        return -1;
+
+    while (TRUE) {
+        uint8_t *start;
+        size_t n;
+
+        //the received bytes up to the end of the ring belong to the reader
+        chSysLock();
+        start = iqp->q_rdptr;
+        n = chIQGetFullI(iqp);
+        if (n > (size_t)(iqp->q_top - start))
+            n = iqp->q_top - start;
+        chSysUnlock();
+
+        if (!n)
+            return lines;
+
+        lines += btLineFeed(line, (char *)start, n, callback, arg);
+
+        chSysLock();
+        iqp->q_rdptr += n;
+        if (iqp->q_rdptr >= iqp->q_top)
+            iqp->q_rdptr = iqp->q_buffer;
+        iqp->q_counter -= n;
+        if (iqp->q_notify)
+            iqp->q_notify(iqp);
+        chSysUnlock();
+    }
+}
+
+/*!
+ * \brief Feeds the line assembler from the input queue of a bluetooth driver
+ *
+ * \param[in] line The line assembler
+ * \param[in] instance A BluetoothDriver object, open
+ * \param[in] callback Called with every line completed
+ * \param[in] arg Passed to the callback
+ * \return the number of lines delivered, or -1 if the driver has no input queue
+ */
+int btLineFeedDriver(struct btline_t *line, struct BluetoothDriver *instance, btline_callback_t callback, void *arg){
+
+    if (!instance || !instance->btInputQueue)
+        return -1;
+
+    return btLineFeedQueue(line, instance->btInputQueue, callback, arg);
+}
+
+/** @} */
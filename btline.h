@@ -0,0 +1,97 @@
+/*!
+ * @file btline.h
+ * @brief Header file for the line assembler of the bluetooth data stream in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTLINE_H_INCLUDED
+#define BTLINE_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Line assembler configuration options
+ * @{
+ */
+/**
+ * @brief   Longest line kept, without the line end.
+ * @details Configuration parameter, what happens to longer lines is the btline_overflow_t
+ *          given to btLineInit.
+ */
+#if !defined(BTLINE_MAX_LENGTH) || defined(__DOXYGEN__)
+#define BTLINE_MAX_LENGTH 64
+#endif
+/**
+ * @brief   Scan for the line ends a word at a time.
+ * @details Configuration parameter, on by default on Cortex-M4, elsewhere memchr is used.
+ */
+#if !defined(BTLINE_USE_SWAR) || defined(__DOXYGEN__)
+#if defined(__ARM_ARCH_7EM__)
+#define BTLINE_USE_SWAR TRUE
+#else
+#define BTLINE_USE_SWAR FALSE
+#endif
+#endif
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Called with every complete line
+ *
+ *  The line is '\0' terminated, without "\r" or "\n", and may be modified. It is only valid
+ *  during the call: it may be in the buffer or queue it was received into.
+ */
+typedef void (*btline_callback_t)(char *line, int length, void *arg);
+
+/**
+ * @brief What happens to a line longer than BTLINE_MAX_LENGTH
+ */
+enum btline_overflow_t{
+    btline_drop = 0,            //the whole line is dropped
+    btline_truncate,            //the first BTLINE_MAX_LENGTH bytes are delivered
+    btline_split                //delivered in pieces of BTLINE_MAX_LENGTH bytes
+};
+
+/**
+ * @brief Line assembler state
+ *
+ *  Lines end with '\n' or '\r', empty lines ("\r\n") are skipped. Only the lines split between
+ *  two feeds are copied into buffer, the others are delivered where they were received.
+ */
+struct btline_t{
+    char buffer[BTLINE_MAX_LENGTH+1];
+    int length;
+    int overflow;               //the current line is too long
+    enum btline_overflow_t policy;
+    uint32_t lines;
+    uint32_t inplace;           //lines delivered without a copy
+    uint32_t overflows;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void btLineInit(struct btline_t *line, enum btline_overflow_t policy);
+int btLineFeed(struct btline_t *line, char *data, int length, btline_callback_t callback, void *arg);
+int btLineFeedQueue(struct btline_t *line, InputQueue *iqp, btline_callback_t callback, void *arg);
+int btLineFeedDriver(struct btline_t *line, struct BluetoothDriver *instance, btline_callback_t callback, void *arg);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTLINE_H_INCLUDED
+/** @} */
@@ -0,0 +1,201 @@
+/*!
+ * @file btrpc.c
+ * @brief Source file for the remote procedure calls over the bluetooth link in ChibiosRT.
+ *
+ *  Requests and replies travel on BTFRAME_CHANNEL_RPC, CBOR encoded:
+ *  request [id, method, [params...]], reply [id, status, result].
+ *  The id is chosen by the caller and only copied into the reply, so the caller may have
+ *  several requests outstanding and match the replies, and time them out, on its side.
+ *  The methods run on the frame receiver thread, one after the other.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btframe.h"
+#include "btrpc.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief The method table
+ */
+static const struct btrpc_method_entry_t *btRpcMethods;
+static int btRpcMethodCount;
+
+/**
+ * @brief Index + 1 in btRpcMethods by method id, 0 if there is no such method
+ */
+static uint8_t btRpcIndex[BTRPC_MAX_METHOD_ID];
+
+/**
+ * @brief Result of the running method, then the reply around it
+ */
+static uint8_t btRpcResult[BTFRAME_MAX_PAYLOAD - 16];
+static uint8_t btRpcReply[BTFRAME_MAX_PAYLOAD];
+
+static struct btrpc_stats_t btRpcStats;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Method 0, lists the methods
+ */
+static int btrpc_list(struct btcbor_reader_t *params, struct btcbor_writer_t *result){
+
+    int i;
+
+    (void)params;
+
+    btCborPutArray(result, btRpcMethodCount);
+    for (i = 0; i < btRpcMethodCount; i++) {
+        btCborPutArray(result, 2);
+        btCborPutUint(result, btRpcMethods[i].id);
+        btCborPutText(result, btRpcMethods[i].name);
+    }
+
+    return BTRPC_OK;
+}
+
+/*!
+ * \brief Runs a method
+ *
+ * \return the status of the reply
+ */
+static int btrpc_call(uint32_t method, struct btcbor_reader_t *params, struct btcbor_writer_t *result){
+
+    const struct btrpc_method_entry_t *entry;
+    int status;
+
+    if (method == BTRPC_METHOD_LIST)
+        return btrpc_list(params, result);
+
+    if (method >= BTRPC_MAX_METHOD_ID || !btRpcIndex[method])
+        return BTRPC_ERROR_UNKNOWN_METHOD;
+
+    entry = &btRpcMethods[btRpcIndex[method] - 1];
+    status = entry->method(params, result);
+
+    if (params->error && status == BTRPC_OK)
+        status = BTRPC_ERROR_PARAMS;
+    if (result->error)
+        status = BTRPC_ERROR_RESULT_TOO_BIG;
+
+    return status;
+}
+
+/*!
+ * \brief Frame handler of BTFRAME_CHANNEL_RPC
+ */
+static void btrpc_request(struct BluetoothDriver *instance, uint8_t channel,
+                          uint8_t *payload, int length, void *arg){
+
+    struct btcbor_reader_t request;
+    struct btcbor_writer_t result, reply;
+    uint32_t id, method;
+    halrtcnt_t start;
+    int count, status;
+
+    (void)channel;
+    (void)arg;
+
+    btRpcStats.requests++;
+
+    btCborReaderInit(&request, payload, length);
+    if (btCborGetArray(&request, &count) != EXIT_SUCCESS || count < 2 ||
+        btCborGetUint(&request, &id) != EXIT_SUCCESS) {
+        btRpcStats.dropped++;
+        return;
+    }
+
+    btCborWriterInit(&result, btRpcResult, sizeof(btRpcResult));
+    start = halGetCounterValue();
+
+    if (btCborGetUint(&request, &method) != EXIT_SUCCESS || count > 3)
+        status = BTRPC_ERROR_BAD_REQUEST;
+    else if (count == 2) {
+        //no parameters, the method sees an empty array
+        static const uint8_t noparams = 0x80;
+
+        btCborReaderInit(&request, &noparams, 1);
+        status = btrpc_call(method, &request, &result);
+    }
+    else
+        status = btrpc_call(method, &request, &result);
+
+    btRpcStats.lastus = (halGetCounterValue() - start) / (halGetCounterFrequency() / 1000000);
+    if (btRpcStats.lastus > btRpcStats.maxus)
+        btRpcStats.maxus = btRpcStats.lastus;
+
+    if (status != BTRPC_OK) {
+        btRpcStats.errors++;
+        result.length = 0;
+    }
+
+    btCborWriterInit(&reply, btRpcReply, sizeof(btRpcReply));
+    btCborPutArray(&reply, 3);
+    btCborPutUint(&reply, id);
+    btCborPutInt(&reply, status);
+    if (!result.length)
+        btCborPutNull(&reply);
+    else if (reply.length + result.length <= reply.size) {
+        memcpy(reply.buffer + reply.length, result.buffer, result.length);
+        reply.length += result.length;
+    }
+
+    btFrameSend(instance, BTFRAME_CHANNEL_RPC, btRpcReply, reply.length);
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Sets the method table and takes the requests of the frame receiver
+ *
+ * \param[in] methods The method table, must stay valid
+ * \param[in] count Its number of entries
+ * \return EXIT_SUCCESS or EXIT_FAILURE if an id is out of range or used twice
+ */
+int btRpcInit(const struct btrpc_method_entry_t *methods, int count){
+
+    int i;
+
+    if (!methods && count)
+        return EXIT_FAILURE;
+
+    memset(btRpcIndex, 0, sizeof(btRpcIndex));
+    for (i = 0; i < count; i++) {
+        uint8_t id = methods[i].id;
+
+        if (id == BTRPC_METHOD_LIST || id >= BTRPC_MAX_METHOD_ID || btRpcIndex[id] || !methods[i].method) {
+            memset(btRpcIndex, 0, sizeof(btRpcIndex));
+            return EXIT_FAILURE;
+        }
+        btRpcIndex[id] = i + 1;
+    }
+
+    btRpcMethods = methods;
+    btRpcMethodCount = count;
+    memset(&btRpcStats, 0, sizeof(btRpcStats));
+
+    return btFrameSetHandler(BTFRAME_CHANNEL_RPC, btrpc_request, NULL);
+}
+
+/*!
+ * \brief Returns the RPC statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct btrpc_stats_t *btRpcGetStats(void){
+
+    return &btRpcStats;
+}
+
+/** @} */
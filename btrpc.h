@@ -0,0 +1,96 @@
+/*!
+ * @file btrpc.h
+ * @brief Header file for the remote procedure calls over the bluetooth link in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTRPC_H_INCLUDED
+#define BTRPC_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+#include "btcbor.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    RPC configuration options
+ * @{
+ */
+/**
+ * @brief   Method ids go from 0 up to this, excluded.
+ */
+#if !defined(BTRPC_MAX_METHOD_ID) || defined(__DOXYGEN__)
+#define BTRPC_MAX_METHOD_ID 32
+#endif
+/** @} */
+
+/**
+ * @name    Status of a reply
+ * @{
+ */
+#define BTRPC_OK 0
+#define BTRPC_ERROR_UNKNOWN_METHOD -1
+#define BTRPC_ERROR_BAD_REQUEST -2
+#define BTRPC_ERROR_PARAMS -3
+#define BTRPC_ERROR_RESULT_TOO_BIG -4
+/** @} */
+
+/**
+ * @brief   Method 0 lists the methods: [[id, name], ...]
+ */
+#define BTRPC_METHOD_LIST 0
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief A method
+ *
+ *  params is positioned on the parameter array of the request. The method writes one item into
+ *  result, nothing means null.
+ *
+ * \return BTRPC_OK, BTRPC_ERROR_PARAMS or a negative error of its own
+ */
+typedef int (*btrpc_method_t)(struct btcbor_reader_t *params, struct btcbor_writer_t *result);
+
+/**
+ * @brief One entry of the method table
+ */
+struct btrpc_method_entry_t{
+    uint8_t id;                 //1 to BTRPC_MAX_METHOD_ID - 1
+    const char *name;
+    btrpc_method_t method;
+};
+
+/**
+ * @brief RPC statistics
+ */
+struct btrpc_stats_t{
+    uint32_t requests;
+    uint32_t errors;            //replies with a status other than BTRPC_OK
+    uint32_t dropped;           //requests without a readable id, not answered
+    uint32_t lastus;            //time the last method took
+    uint32_t maxus;
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btRpcInit(const struct btrpc_method_entry_t *methods, int count);
+const struct btrpc_stats_t *btRpcGetStats(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTRPC_H_INCLUDED
+/** @} */
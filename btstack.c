@@ -0,0 +1,255 @@
+/*!
+ * @file btstack.c
+ * @brief Source file for the stack watermark profiling of the threads in ChibiosRT.
+ *
+ *  With CH_DBG_FILL_THREADS (USE_STACK_PROFILING = yes in the Makefile) the kernel fills every
+ *  working area with CH_STACK_FILL_VALUE when it creates a thread, and the hooks in chconf.h
+ *  keep the top of the working area in the thread. The stack grows down towards the Thread
+ *  structure at the bottom, so the fill bytes left right above it are the stack never used.
+ *  Sizes are given like the n of THD_WA_SIZE(n), what the *_STACK_SIZE settings take: without
+ *  the Thread structure and without the context and interrupt reserve of the port.
+ *
+ *  The peak of every thread is kept, the exit hook takes it before the thread is gone,
+ *  so also the threads that only run for a while (btopen, the bridge pumps...) are reported.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "btstack.h"
+#include <string.h>
+
+#if CH_DBG_FILL_THREADS || defined(__DOXYGEN__)
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Part of a working area that is not the n of THD_WA_SIZE(n)
+ */
+#define BTSTACK_OVERHEAD (THD_WA_SIZE(0) - sizeof(Thread))
+
+/**
+ * @brief Working areas larger than this are not believed, the main thread has none
+ */
+#define BTSTACK_MAX_SIZE 0x10000
+
+/**
+ * @brief Which setting sizes the working area of a thread, by thread name
+ */
+static const struct {
+    const char *name;
+    const char *macro;
+} btStackMacros[] = {
+    {"btopen", "BLUETOOTH_OPEN_THREAD_STACK_SIZE"},
+    {"bridgehost", "BTBRIDGE_THREAD_STACK_SIZE"},
+    {"bridgebt", "BTBRIDGE_THREAD_STACK_SIZE"},
+    {"btclock", "BTCLOCK_THREAD_STACK_SIZE"},
+    {"btframe", "BTFRAME_THREAD_STACK_SIZE"},
+    {"telemetrysampler", "BTTELEMETRY_SAMPLER_STACK_SIZE"},
+    {"telemetrysender", "BTTELEMETRY_SENDER_STACK_SIZE"},
+    {"hc05power", "HC05_POWER_THREAD_STACK_SIZE"},
+    {"hc05reflect", "HC05_REFLECTOR_THREAD_STACK_SIZE"},
+    {"hc05auto", "HC05_AUTOCONNECT_THREAD_STACK_SIZE"},
+    {"shell", "SHELL_STACK_SIZE"},
+    {"idle", "PORT_IDLE_THREAD_STACK_SIZE"},
+    {"usb_lld_pump", "STM32_USB_OTG_THREAD_STACK_SIZE"}
+};
+
+/**
+ * @brief Kept state of a thread
+ */
+struct btstack_peak_t{
+    const char *name;
+    int running;
+    size_t size;
+    size_t used;
+    size_t peak;
+};
+
+static struct btstack_peak_t btStackPeaks[BTSTACK_PEAKS];
+static int btStackPeakCount;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Measures the stack of a thread
+ *
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the thread has no known working area
+ */
+static int btstack_measure(Thread *tp, size_t *size, size_t *used){
+
+    uint8_t *bottom = (uint8_t *)(tp + 1);
+    uint8_t *top = tp->p_stktop;
+    uint8_t *p;
+
+    if (top <= bottom + BTSTACK_OVERHEAD || (size_t)(top - bottom) > BTSTACK_MAX_SIZE)
+        return EXIT_FAILURE;
+
+    for (p = bottom; p < top && *p == CH_STACK_FILL_VALUE; p++)
+        ;
+
+    *size = top - bottom - BTSTACK_OVERHEAD;
+    *used = (size_t)(top - p) > BTSTACK_OVERHEAD ? (size_t)(top - p) - BTSTACK_OVERHEAD : 0;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Keeps the measure of a thread, called locked
+ *
+ * \return the kept state, NULL if the thread has no name or the table is full
+ */
+static struct btstack_peak_t *btstack_keep(Thread *tp, size_t size, size_t used){
+
+    struct btstack_peak_t *peak = NULL;
+    int i;
+
+    if (!tp->p_name)
+        return NULL;
+
+    for (i = 0; i < btStackPeakCount && !peak; i++)
+        if (!strcmp(btStackPeaks[i].name, tp->p_name))
+            peak = &btStackPeaks[i];
+
+    if (!peak) {
+        if (btStackPeakCount == BTSTACK_PEAKS)
+            return NULL;
+        peak = &btStackPeaks[btStackPeakCount++];
+        peak->name = tp->p_name;
+        peak->peak = 0;
+    }
+
+    peak->size = size;
+    peak->used = used;
+    if (used > peak->peak)
+        peak->peak = used;
+
+    return peak;
+}
+
+/*!
+ * \brief Looks up the setting of a thread
+ */
+static const char *btstack_macro(const char *name){
+
+    unsigned i;
+
+    for (i = 0; i < sizeof(btStackMacros) / sizeof(btStackMacros[0]); i++)
+        if (!strcmp(btStackMacros[i].name, name))
+            return btStackMacros[i].macro;
+
+    return NULL;
+}
+
+/*!
+ * \brief Fills a report, the recommendation rounded up to the stack alignment
+ */
+static void btstack_report(const struct btstack_peak_t *peak, struct btstack_usage_t *usage){
+
+    usage->name = peak->name;
+    usage->macro = btstack_macro(peak->name);
+    usage->running = peak->running;
+    usage->size = peak->size;
+    usage->used = peak->running ? peak->used : 0;
+    usage->peak = peak->peak;
+    usage->recommended = (peak->peak + BTSTACK_MARGIN + 7) & ~(size_t)7;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Measures the stack of a running thread
+ *
+ * \param[in] tp The thread
+ * \param[out] usage Its stack use
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the thread has no known working area
+ */
+int btStackGetThreadUsage(Thread *tp, struct btstack_usage_t *usage){
+
+    struct btstack_peak_t *peak, kept;
+    size_t size, used;
+
+    if (btstack_measure(tp, &size, &used) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    chSysLock();
+    peak = btstack_keep(tp, size, used);
+    if (peak) {
+        peak->running = 1;
+        kept = *peak;
+    }
+    chSysUnlock();
+
+    if (!peak) {
+        kept.name = tp->p_name ? tp->p_name : "";
+        kept.running = 1;
+        kept.size = size;
+        kept.used = used;
+        kept.peak = used;
+    }
+    btstack_report(&kept, usage);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Reports the stack use of every thread seen so far, running or ended
+ *
+ * \param[out] usage The reports
+ * \param[in] max Room in usage
+ * \return the number of reports
+ */
+int btStackGetUsage(struct btstack_usage_t *usage, int max){
+
+    struct btstack_usage_t dummy;
+    Thread *tp;
+    int i, count;
+
+    chSysLock();
+    for (i = 0; i < btStackPeakCount; i++)
+        btStackPeaks[i].running = 0;
+    chSysUnlock();
+
+    tp = chRegFirstThread();
+    do {
+        btStackGetThreadUsage(tp, &dummy);
+        tp = chRegNextThread(tp);
+    } while (tp != NULL);
+
+    chSysLock();
+    count = btStackPeakCount < max ? btStackPeakCount : max;
+    for (i = 0; i < count; i++)
+        btstack_report(&btStackPeaks[i], &usage[i]);
+    chSysUnlock();
+
+    return count;
+}
+
+/*!
+ * \brief Keeps the peak of an ending thread, THREAD_EXT_EXIT_HOOK, called locked
+ *
+ * \param[in] tp The thread
+ */
+void btStackExitHook(Thread *tp){
+
+    struct btstack_peak_t *peak;
+    size_t size, used;
+
+    if (btstack_measure(tp, &size, &used) != EXIT_SUCCESS)
+        return;
+
+    peak = btstack_keep(tp, size, used);
+    if (peak)
+        peak->running = 0;
+}
+
+#endif //CH_DBG_FILL_THREADS
+
+/** @} */
@@ -0,0 +1,70 @@
+/*!
+ * @file btstack.h
+ * @brief Header file for the stack watermark profiling of the threads in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTSTACK_H_INCLUDED
+#define BTSTACK_H_INCLUDED
+
+#include <ch.h>
+#include <stdlib.h>
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Stack profiling configuration options
+ * @{
+ */
+/**
+ * @brief   Bytes the recommended sizes keep free above the highest watermark seen.
+ */
+#if !defined(BTSTACK_MARGIN) || defined(__DOXYGEN__)
+#define BTSTACK_MARGIN 64
+#endif
+/**
+ * @brief   Threads whose peak is kept, also after they ended.
+ */
+#if !defined(BTSTACK_PEAKS) || defined(__DOXYGEN__)
+#define BTSTACK_PEAKS 24
+#endif
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Stack use of a thread, sizes as the n of THD_WA_SIZE(n)
+ */
+struct btstack_usage_t{
+    const char *name;
+    const char *macro;          //setting of the size, NULL if not known
+    int running;
+    size_t size;
+    size_t used;                //now, 0 if it ended
+    size_t peak;                //highest seen
+    size_t recommended;         //peak and BTSTACK_MARGIN
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#if CH_DBG_FILL_THREADS || defined(__DOXYGEN__)
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btStackGetThreadUsage(Thread *tp, struct btstack_usage_t *usage);
+int btStackGetUsage(struct btstack_usage_t *usage, int max);
+void btStackExitHook(Thread *tp);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+#endif // BTSTACK_H_INCLUDED
+/** @} */
@@ -0,0 +1,334 @@
+/*!
+ * @file bttelemetry.c
+ * @brief Source file for the accelerometer telemetry over the bluetooth link in ChibiosRT.
+ *
+ *  A sampler thread reads the LIS302DL at a fixed rate into one of two batches. A full batch
+ *  goes to the sender thread, which encodes it and sends it as one frame on
+ *  BTFRAME_CHANNEL_TELEMETRY while the sampler fills the other batch. The frame payload,
+ *  all numbers unsigned LEB128 varints:
+ *
+ *  sequence, clock, time of the first sample in ms, sample period in us, sample count,
+ *  then for every sample x, y, z: the zigzag encoded difference to the previous sample
+ *  (to 0 for the first one), so every frame decodes on its own.
+ *  Clock 0: the time is device time since boot. Clock 1: btclock is synchronized and the
+ *  time is host time, as the host answering the clock exchanges counts it.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#include "ch.h"
+#include "hal.h"
+#include "lis302dl.h"
+#include "btframe.h"
+#include "btclock.h"
+#include "bttelemetry.h"
+#include <string.h>
+
+/*===========================================================================*/
+/* Driver local variables and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Longest header: sequence, clock, 64 bit time, period, count
+ */
+#define BTTELEMETRY_HEADER_MAX (5 + 1 + 10 + 5 + 1)
+
+/**
+ * @brief Longest sample: a difference of two int8 zigzags up to 510, two bytes per axis
+ */
+#define BTTELEMETRY_SAMPLE_MAX (3 * 2)
+
+#if BTTELEMETRY_HEADER_MAX + BTTELEMETRY_MAX_BATCH * BTTELEMETRY_SAMPLE_MAX > BTFRAME_MAX_PAYLOAD
+#error "BTTELEMETRY_MAX_BATCH samples do not fit BTFRAME_MAX_PAYLOAD"
+#endif
+
+/**
+ * @brief A batch of samples
+ */
+struct bttelemetry_batch_t{
+    systime_t start;            //time of the first sample
+    uint64_t starthostus;       //the same in host time, 0 if not synchronized
+    int count;
+    int8_t samples[BTTELEMETRY_MAX_BATCH][3];
+};
+
+static struct bttelemetry_batch_t btTelemetryBatches[2];
+
+/**
+ * @brief Batch the sender has to send, -1 if none
+ */
+static volatile int btTelemetryReady = -1;
+
+static uint8_t btTelemetryFrame[BTFRAME_MAX_PAYLOAD];
+
+static struct bttelemetry_config_t btTelemetryConfig;
+static struct BluetoothDriver *btTelemetryDriver;
+static struct bttelemetry_stats_t btTelemetryStats;
+static systime_t btTelemetryStarted;
+
+static WORKING_AREA(btTelemetrySamplerWa, BTTELEMETRY_SAMPLER_STACK_SIZE);
+static WORKING_AREA(btTelemetrySenderWa, BTTELEMETRY_SENDER_STACK_SIZE);
+static Thread *btTelemetrySamplerTp = NULL;
+static Thread *btTelemetrySenderTp = NULL;
+
+/**
+ * @brief SPI settings of the LIS302DL on the STM32F4 Discovery: mode 3, fPCLK/16
+ */
+static const SPIConfig btTelemetrySpiConfig = {
+    NULL,
+    GPIOE,
+    GPIOE_CS_SPI,
+    SPI_CR1_BR_0 | SPI_CR1_BR_1 | SPI_CR1_CPOL | SPI_CR1_CPHA
+};
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Adds an unsigned LEB128 varint
+ *
+ * \return the new length
+ */
+static int bttelemetry_putvarint(uint8_t *buffer, int length, uint32_t value){
+
+    while (value >= 0x80) {
+        buffer[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[length++] = value;
+
+    return length;
+}
+
+/*!
+ * \brief Adds an unsigned LEB128 varint of 64 bits, for the host time; the samples keep to 32 bits
+ *
+ * \return the new length
+ */
+static int bttelemetry_putvarint64(uint8_t *buffer, int length, uint64_t value){
+
+    while (value >= 0x80) {
+        buffer[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[length++] = value;
+
+    return length;
+}
+
+/*!
+ * \brief Maps small signed numbers to small unsigned ones: 0, -1, 1, -2 ... to 0, 1, 2, 3 ...
+ */
+static uint32_t bttelemetry_zigzag(int32_t value){
+
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/*!
+ * \brief Encodes a batch into btTelemetryFrame
+ *
+ * \return the length of the payload
+ */
+static int bttelemetry_encode(const struct bttelemetry_batch_t *batch, uint32_t sequence){
+
+    int8_t previous[3] = {0, 0, 0};
+    int length = 0;
+    int i, axis;
+
+    length = bttelemetry_putvarint(btTelemetryFrame, length, sequence);
+    if (batch->starthostus) {
+        length = bttelemetry_putvarint(btTelemetryFrame, length, 1);
+        length = bttelemetry_putvarint64(btTelemetryFrame, length, batch->starthostus / 1000);
+    }
+    else {
+        length = bttelemetry_putvarint(btTelemetryFrame, length, 0);
+        length = bttelemetry_putvarint(btTelemetryFrame, length,
+                                       (uint32_t)(((uint64_t)batch->start * 1000) / CH_FREQUENCY));
+    }
+    //the period the sampler really keeps, in whole ticks
+    length = bttelemetry_putvarint(btTelemetryFrame, length,
+                                   (uint32_t)(((uint64_t)(CH_FREQUENCY / btTelemetryConfig.ratehz) * 1000000) / CH_FREQUENCY));
+    length = bttelemetry_putvarint(btTelemetryFrame, length, batch->count);
+
+    for (i = 0; i < batch->count; i++) {
+        for (axis = 0; axis < 3; axis++) {
+            length = bttelemetry_putvarint(btTelemetryFrame, length,
+                                           bttelemetry_zigzag(batch->samples[i][axis] - previous[axis]));
+            previous[axis] = batch->samples[i][axis];
+        }
+    }
+
+    return length;
+}
+
+/*!
+ * \brief Sampler thread, reads the sensor on a fixed schedule
+ */
+static msg_t bttelemetry_sampler(void *arg){
+
+    systime_t period = CH_FREQUENCY / btTelemetryConfig.ratehz;
+    systime_t next = chTimeNow();
+    int filling = 0;
+
+    (void)arg;
+    chRegSetThreadName("telemetrysampler");
+
+    btTelemetryBatches[0].count = 0;
+
+    while (!chThdShouldTerminate()) {
+        struct bttelemetry_batch_t *batch = &btTelemetryBatches[filling];
+        SPIDriver *spip = btTelemetryConfig.spip;
+
+        //absolute deadlines, the read time does not add up
+        next += period;
+        if ((systime_t)(next - chTimeNow()) <= period)
+            chThdSleepUntil(next);
+        else
+            next = chTimeNow();
+
+        if (!batch->count) {
+            batch->start = chTimeNow();
+            batch->starthostus = btClockGetStats()->synced ? btTimeToHost(btClockNow()) : 0;
+        }
+        batch->samples[batch->count][0] = (int8_t)lis302dlReadRegister(spip, LIS302DL_OUTX);
+        batch->samples[batch->count][1] = (int8_t)lis302dlReadRegister(spip, LIS302DL_OUTY);
+        batch->samples[batch->count][2] = (int8_t)lis302dlReadRegister(spip, LIS302DL_OUTZ);
+
+        if (++batch->count < btTelemetryConfig.batch)
+            continue;
+
+        //the sender still has the other batch, this one is lost
+        if (btTelemetryReady >= 0) {
+            btTelemetryStats.overruns++;
+            batch->count = 0;
+            continue;
+        }
+
+        btTelemetryReady = filling;
+        chEvtSignal(btTelemetrySenderTp, EVENT_MASK(0));
+        filling ^= 1;
+        btTelemetryBatches[filling].count = 0;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Sender thread, encodes and sends the full batches
+ */
+static msg_t bttelemetry_sender(void *arg){
+
+    uint32_t sequence = 0;
+
+    (void)arg;
+    chRegSetThreadName("telemetrysender");
+
+    while (!chThdShouldTerminate()) {
+        int length;
+
+        chEvtWaitAnyTimeout(EVENT_MASK(0), MS2ST(100));
+        if (btTelemetryReady < 0)
+            continue;
+
+        length = bttelemetry_encode(&btTelemetryBatches[btTelemetryReady], sequence++);
+
+        if (btFrameSend(btTelemetryDriver, BTFRAME_CHANNEL_TELEMETRY, btTelemetryFrame, length) == EXIT_SUCCESS) {
+            btTelemetryStats.frames++;
+            btTelemetryStats.samples += btTelemetryBatches[btTelemetryReady].count;
+            btTelemetryStats.bytes += length;
+        }
+        else
+            btTelemetryStats.failures++;
+
+        btTelemetryReady = -1;
+    }
+
+    return 0;
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Starts the sensor and the streaming
+ *
+ *  The sampler keeps its period in whole system ticks, so the rate must divide CH_FREQUENCY.
+ *
+ * \param[in] instance A BluetoothDriver object, in communication mode
+ * \param[in] config The telemetry parameters
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already or a parameter is out of range
+ */
+int btTelemetryStart(struct BluetoothDriver *instance, const struct bttelemetry_config_t *config){
+
+    if (!instance || !config || !config->spip || btTelemetrySamplerTp ||
+        !config->ratehz || config->ratehz > BTTELEMETRY_MAX_RATE || CH_FREQUENCY % config->ratehz ||
+        !config->batch || config->batch > BTTELEMETRY_MAX_BATCH)
+        return EXIT_FAILURE;
+
+    btTelemetryConfig = *config;
+    btTelemetryDriver = instance;
+    btTelemetryReady = -1;
+    memset(&btTelemetryStats, 0, sizeof(btTelemetryStats));
+    btTelemetryStats.running = 1;
+
+    //power on, x, y and z on, 100 Hz or 400 Hz output data rate
+    spiStart(config->spip, &btTelemetrySpiConfig);
+    lis302dlWriteRegister(config->spip, LIS302DL_CTRL_REG1, config->ratehz > 100 ? 0xC7 : 0x47);
+    lis302dlWriteRegister(config->spip, LIS302DL_CTRL_REG2, 0x00);
+    lis302dlWriteRegister(config->spip, LIS302DL_CTRL_REG3, 0x00);
+
+    btTelemetryStarted = chTimeNow();
+    btTelemetrySenderTp = chThdCreateStatic(btTelemetrySenderWa, sizeof(btTelemetrySenderWa),
+                                            NORMALPRIO + 1, bttelemetry_sender, NULL);
+    //above the sender, the schedule matters more
+    btTelemetrySamplerTp = chThdCreateStatic(btTelemetrySamplerWa, sizeof(btTelemetrySamplerWa),
+                                             NORMALPRIO + 2, bttelemetry_sampler, NULL);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops the streaming and powers the sensor down
+ */
+void btTelemetryStop(void){
+
+    if (!btTelemetrySamplerTp)
+        return;
+
+    chThdTerminate(btTelemetrySamplerTp);
+    chThdWait(btTelemetrySamplerTp);
+    chThdTerminate(btTelemetrySenderTp);
+    chEvtSignal(btTelemetrySenderTp, EVENT_MASK(0));
+    chThdWait(btTelemetrySenderTp);
+    btTelemetrySamplerTp = NULL;
+    btTelemetrySenderTp = NULL;
+
+    lis302dlWriteRegister(btTelemetryConfig.spip, LIS302DL_CTRL_REG1, 0x00);
+
+    btTelemetryGetStats();
+    btTelemetryStats.running = 0;
+}
+
+/*!
+ * \brief Returns the telemetry statistics, the rates computed up to now
+ *
+ * \return pointer to the statistics
+ */
+const struct bttelemetry_stats_t *btTelemetryGetStats(void){
+
+    if (btTelemetryStats.running) {
+        btTelemetryStats.elapsedms = (uint32_t)(((uint64_t)chTimeElapsedSince(btTelemetryStarted) * 1000) / CH_FREQUENCY);
+        btTelemetryStats.samplespersecond = btTelemetryStats.elapsedms
+                ? (uint32_t)(((uint64_t)btTelemetryStats.samples * 1000) / btTelemetryStats.elapsedms)
+                : 0;
+        btTelemetryStats.bytespersample100 = btTelemetryStats.samples
+                ? (btTelemetryStats.bytes * 100) / btTelemetryStats.samples
+                : 0;
+    }
+
+    return &btTelemetryStats;
+}
+
+/** @} */
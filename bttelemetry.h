@@ -0,0 +1,89 @@
+/*!
+ * @file bttelemetry.h
+ * @brief Header file for the accelerometer telemetry over the bluetooth link in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+#ifndef BTTELEMETRY_H_INCLUDED
+#define BTTELEMETRY_H_INCLUDED
+
+#include <hal.h>
+#include <stdlib.h>
+#include "bluetooth.h"
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    Telemetry configuration options
+ * @{
+ */
+/**
+ * @brief   Most samples in a frame, the worst case frame must fit BTFRAME_MAX_PAYLOAD.
+ */
+#if !defined(BTTELEMETRY_MAX_BATCH) || defined(__DOXYGEN__)
+#define BTTELEMETRY_MAX_BATCH 24
+#endif
+/**
+ * @brief   Highest sample rate, the fastest output data rate of the LIS302DL, in Hz.
+ */
+#if !defined(BTTELEMETRY_MAX_RATE) || defined(__DOXYGEN__)
+#define BTTELEMETRY_MAX_RATE 400
+#endif
+/**
+ * @brief   Stack sizes of the sampler and the sender thread.
+ */
+#if !defined(BTTELEMETRY_SAMPLER_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTTELEMETRY_SAMPLER_STACK_SIZE 256
+#endif
+#if !defined(BTTELEMETRY_SENDER_STACK_SIZE) || defined(__DOXYGEN__)
+#define BTTELEMETRY_SENDER_STACK_SIZE 512
+#endif
+/** @} */
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief Telemetry parameters
+ */
+struct bttelemetry_config_t{
+    SPIDriver *spip;            //the LIS302DL, SPID1 on the STM32F4 Discovery
+    uint16_t ratehz;            //samples per second, up to BTTELEMETRY_MAX_RATE, divides CH_FREQUENCY
+    uint8_t batch;              //samples per frame, up to BTTELEMETRY_MAX_BATCH
+};
+
+/**
+ * @brief Telemetry statistics
+ */
+struct bttelemetry_stats_t{
+    int running;
+    uint32_t samples;           //sent
+    uint32_t frames;
+    uint32_t bytes;             //payload bytes sent
+    uint32_t overruns;          //batches dropped, the link was too slow
+    uint32_t failures;          //frames the driver did not take
+    uint32_t elapsedms;
+    uint32_t samplespersecond;
+    uint32_t bytespersample100; //bytes per sample times 100
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int btTelemetryStart(struct BluetoothDriver *instance, const struct bttelemetry_config_t *config);
+void btTelemetryStop(void);
+const struct bttelemetry_stats_t *btTelemetryGetStats(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BTTELEMETRY_H_INCLUDED
+/** @} */
@@ -442,6 +442,22 @@
  */
 /*===========================================================================*/
 
+#if CH_DBG_FILL_THREADS && !defined(__DOXYGEN__)
+/* Stack profiling, see btstack.c: the top of every working area is kept,
+   the watermarks of the threads that end are taken before they are gone.*/
+#define THREAD_EXT_FIELDS                                                   \
+  uint8_t *p_stktop;
+
+#define THREAD_EXT_INIT_HOOK(tp) {                                          \
+  (tp)->p_stktop = (uint8_t *)(tp)->p_ctx.r13 + sizeof(struct intctx);      \
+}
+
+#define THREAD_EXT_EXIT_HOOK(tp) {                                          \
+  extern void btStackExitHook(Thread *);                                    \
+  btStackExitHook(tp);                                                      \
+}
+#endif
+
 /**
  * @brief   Threads descriptor structure extension.
  * @details User fields added to the end of the @p Thread structure.
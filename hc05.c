@@ -13,10 +13,12 @@
 #include "chqueues.h"
 #include "bluetooth.h"
 #include "hc05.h"
+#include "hc05at.h"
 #include "serial.h"
 #include "serial_lld.h"
 #include "mcuconf.h"
 #include <string.h>
+#include <stdlib.h>
 
 
 #if HAL_USE_HC_05_BLUETOOTH || defined(__DOXYGEN__) || 1
@@ -36,121 +38,2695 @@ static SerialConfig hc05SerialConfig = {38400,0,0,0};
 
 /*!
  * \brief current state of the driver / HC-05
+ *
+ *  Only written with the system locked, through hc05_setstateI, which also broadcasts the change.
+ */
+static volatile enum hc05_state_t hc05CurrentState = st_unknown;
+
+/*!
+ * \brief State changes are broadcast here, see HC05_STATE_FLAG
+ */
+static EVENTSOURCE_DECL(hc05StateEventSource);
+
+/*!
+ * \brief Steps of a mode switch
+ *
+ *  key pin set --(timeout)--> reset low --(timeout)--> reset high --(timeout)--> target state
+ *  A fast switch only waits for the key pin to settle.
+ */
+enum hc05_switchstep_t {
+    sw_idle,
+    sw_keysettle,
+    sw_resetlow,
+    sw_booting,
+    sw_fastsettle
+};
+
+/*!
+ * \brief Mode switch in progress, advanced by hc05SwitchTimer
+ *
+ *  With bootms == 0 the target state is set as soon as the reset is released,
+ *  the caller then finds out itself when the module is up.
+ */
+static struct {
+    enum hc05_switchstep_t step;
+    enum hc05_state_t target;
+    struct hc05_config_t *hc05config;
+    uint32_t keysettlems;
+    uint32_t resetpulsems;
+    uint32_t bootms;
+    systime_t releasedat;
+} hc05Switch;
+
+/*!
+ * \brief Virtual timer driving the mode switches
+ */
+static VirtualTimer hc05SwitchTimer;
+
+/*!
+ * \brief AT session: commands collected between hc05AtBegin and hc05AtCommit
+ */
+static struct {
+    int isopen;
+    Thread *owner;              //only the AT commands of this thread are queued
+    int count;
+    char commands[HC05_AT_SESSION_MAX_COMMANDS][HC05_AT_COMMAND_LENGTH+1];
+} hc05AtSession;
+
+/*!
+ * \brief One AT command sent to the module, waiting for its answer
+ */
+struct hc05_at_inflight_t {
+    hc05_at_callback_t callback;
+    void *arg;
+    uint16_t timeoutms;
+    systime_t sent;
+};
+
+/*!
+ * \brief AT pipeline: commands in flight, answered in submission order
+ *
+ *  The timeout of the oldest command runs from the moment it became the oldest,
+ *  as the module only starts on it after answering the previous one.
+ */
+static struct {
+    int head;
+    int count;
+    int failures;
+    systime_t headstart;
+    struct hc05_at_result_t headresult;
+    struct hc05_at_inflight_t entries[HC05_AT_PIPELINE_DEPTH];
+} hc05AtPipeline;
+
+/*!
+ * \brief 1 while the module is in AT mode through the key pin only (no reset)
+ */
+static int hc05AtModeIsFast = 0;
+
+/*!
+ * \brief Latency of the AT mode switches
+ */
+static struct hc05_modeswitch_stats_t hc05SwitchStats;
+
+/*!
+ * \brief Timing of the reset mode switches, see hc05_enteratmode
+ */
+static struct hc05_timing_t hc05Timing = {
+    HC05_KEY_SETTLE_MS, HC05_RESET_PULSE_MS, HC05_BOOT_DEFAULT_MS, 0, 0, 0, 0
+};
+
+/*!
+ * \brief Last known configuration of the module
+ */
+static struct hc05_shadow_t hc05Shadow;
+
+/*!
+ * \brief Level of the STATE pin, 1 while a device is connected
+ */
+static volatile int hc05LinkUp = 0;
+
+/*!
+ * \brief Driver the STATE pin events go to, NULL if the pin is not used
+ */
+static struct BluetoothDriver *hc05LinkDriver = NULL;
+
+/*!
+ * \brief Connection statistics
+ */
+static struct hc05_link_stats_t hc05LinkStats;
+
+/*!
+ * \brief EXT configuration used if nobody started EXTD1 before us
+ *
+ *  Not const, extSetChannelMode writes the channel into it.
+ */
+static EXTConfig hc05ExtConfig;
+
+/*!
+ * \brief Working area of the sniff power policy thread
+ */
+static WORKING_AREA(hc05PowerThreadWa, HC05_POWER_THREAD_STACK_SIZE);
+
+/*!
+ * \brief Sniff power policy thread, NULL if not running
+ */
+static Thread *hc05PowerThreadTp = NULL;
+
+/*!
+ * \brief Serializes the AT transactions and the mode switches of every thread, and keeps the senders and readers out of them
+ *
+ *  Taken by the exported functions that enter AT mode or switch the mode, and by the link
+ *  managers (sniff policy, auto-connect) around theirs. The local functions expect it locked.
+ */
+static MUTEX_DECL(hc05LinkMutex);
+
+/*!
+ * \brief Time of the last traffic
+ */
+static volatile systime_t hc05LastActivity;
+
+/*!
+ * \brief Sniff power policy statistics
+ */
+static struct hc05_power_stats_t hc05PowerStats;
+
+/*!
+ * \brief The sniff mode parameters were written since the driver was opened
+ */
+static int hc05SniffParamsSet = 0;
+
+/*!
+ * \brief Address of the connected device, for AT+ENSNIFF
+ */
+static union hc05_at_value_t hc05SniffAddress;
+
+/*!
+ * \brief hc05SniffAddress was asked since the connection was made
+ */
+static int hc05SniffAddressKnown = 0;
+
+/*!
+ * \brief Time the sniff mode was entered
+ */
+static systime_t hc05SniffStart;
+
+/*!
+ * \brief Failed sniff entries in a row
+ */
+static int hc05SniffFailures = 0;
+
+/*!
+ * \brief Devices found by the last inquiry
+ */
+static struct hc05_inquiry_t hc05InquiryResults;
+
+/*!
+ * \brief Working area of the auto-connect thread
+ */
+static WORKING_AREA(hc05AutoThreadWa, HC05_AUTOCONNECT_THREAD_STACK_SIZE);
+
+/*!
+ * \brief Auto-connect thread, NULL if not running
+ */
+static Thread *hc05AutoThreadTp = NULL;
+
+/*!
+ * \brief Address the auto-connect manager keeps the link to
+ */
+static union hc05_at_value_t hc05AutoAddress;
+
+/*!
+ * \brief Role the auto-connect manager asked for, -1 while it does not run
+ *
+ *  hc05_syncconfig applies it instead of the role of the config, the config is left alone.
+ */
+static int hc05AutoRole = -1;
+
+/*!
+ * \brief Auto-connect statistics
+ */
+static struct hc05_autoconnect_stats_t hc05AutoStats;
+
+/*!
+ * \brief State of the backoff jitter generator (xorshift32), never 0
+ */
+static uint32_t hc05JitterState = 1;
+
+/*!
+ * \brief Working area of the reflector thread
+ */
+static WORKING_AREA(hc05ReflectorThreadWa, HC05_REFLECTOR_THREAD_STACK_SIZE);
+
+/*!
+ * \brief Reflector thread, NULL if not running
+ */
+static Thread *hc05ReflectorThreadTp = NULL;
+
+/*!
+ * \brief Reflector statistics
+ */
+static struct hc05_reflector_stats_t hc05ReflectorStats;
+
+#if HC05_USE_FLASH_FINGERPRINT || defined(__DOXYGEN__)
+/*!
+ * \brief Next free word of the fingerprint log in flash, NULL until the log was scanned
+ */
+static volatile uint32_t *hc05FingerprintNext = NULL;
+#endif
+
+/*!
+ * \brief Converts system ticks to milliseconds
+ */
+#define HC05_ST2MS(n) ((uint32_t)(((uint64_t)(n) * 1000) / CH_FREQUENCY))
+
+/*!
+ * \brief Converts milliseconds to a virtual timer delay, at least one tick
+ */
+#define HC05_VTDELAY(ms) ((ms) ? MS2ST(ms) : 1)
+
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Drops everything waiting in the input queue of the serial driver
+ *
+ *  Stale bytes (garbage after a module reset, late answers) would be parsed as
+ *  the answer of the next command.
+ *
+ * \param[in] sdp SerialDriver of the module
+ */
+static void hc05_flushinput(SerialDriver *sdp){
+
+    while (sdGetTimeout(sdp, TIME_IMMEDIATE) != Q_TIMEOUT)
+        ;
+}
+
+/*!
+ * \brief Converts a btbitrate_t to bits per second
+ *
+ * \param[in] bitrate One of the btbitrate_t values
+ * \return the bit rate, BLUETOOTH_DEFAULT_BITRATE for unknown values
+ */
+static uint32_t hc05_bitratevalue(enum btbitrate_t bitrate){
+
+    switch (bitrate) {
+        case b1200:
+            return 1200;
+        case b2400:
+            return 2400;
+        case b4800:
+            return 4800;
+        case b9600:
+            return 9600;
+        case b19200:
+            return 19200;
+        case b38400:
+            return 38400;
+        case b57600:
+            return 57600;
+        case b115200:
+            return 115200;
+        default:
+            return BLUETOOTH_DEFAULT_BITRATE;
+    }
+}
+
+/*!
+ * \brief Returns the role hc05_syncconfig applies
+ *
+ * \param[in] config A BluetoothConfig object
+ * \return the role of the auto-connect manager while it runs, the role of the config otherwise
+ */
+static int hc05_role(struct BluetoothConfig *config){
+
+    return hc05AutoRole >= 0 ? hc05AutoRole : config->myhc05config->role;
+}
+
+#if HC05_USE_FLASH_FINGERPRINT || defined(__DOXYGEN__)
+/*!
+ * \brief Calculates the fingerprint of the settings hc05SyncConfig applies
+ *
+ *  FNV-1a over name, pincode, bit rate and role. 0 and 0xFFFFFFFF are reserved for the flash log.
+ *
+ * \param[in] config A BluetoothConfig object
+ * \return the fingerprint
+ */
+static uint32_t hc05_configfingerprint(struct BluetoothConfig *config){
+
+    uint32_t hash = 2166136261u;
+    uint32_t values[2];
+    const uint8_t *p;
+    unsigned int i;
+
+    for (p = (const uint8_t *)config->name; *p; p++)
+        hash = (hash ^ *p) * 16777619u;
+    hash = (hash ^ 0xFF) * 16777619u;
+    for (p = (const uint8_t *)config->pincode; *p; p++)
+        hash = (hash ^ *p) * 16777619u;
+
+    values[0] = hc05_bitratevalue(config->baudrate);
+    values[1] = (uint32_t)hc05_role(config);
+    p = (const uint8_t *)values;
+    for (i = 0; i < sizeof(values); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    if (hash == 0 || hash == 0xFFFFFFFF)
+        hash = 1;
+
+    return hash;
+}
+
+/*!
+ * \brief Waits for the end of a flash operation and clears the error flags
+ */
+static void hc05_flashwait(void){
+
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_OPERR | FLASH_SR_WRPERR |
+                FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR;
+}
+
+/*!
+ * \brief Finds the next free word of the fingerprint log
+ *
+ *  The log is a sequence of 32 bit fingerprints in an erased sector, the last written one is valid.
+ */
+static void hc05_scanfingerprints(void){
+
+    volatile uint32_t *word = (volatile uint32_t *)HC05_FINGERPRINT_FLASH_ADDRESS;
+    volatile uint32_t *end = word + HC05_FINGERPRINT_FLASH_SIZE / sizeof(uint32_t);
+
+    while (word < end && *word != 0xFFFFFFFF)
+        word++;
+
+    hc05FingerprintNext = word;
+}
+
+/*!
+ * \brief Reads the fingerprint of the last applied configuration
+ *
+ * \return the fingerprint, 0 if there is none
+ */
+static uint32_t hc05_readfingerprint(void){
+
+    if (!hc05FingerprintNext)
+        hc05_scanfingerprints();
+
+    if (hc05FingerprintNext == (volatile uint32_t *)HC05_FINGERPRINT_FLASH_ADDRESS)
+        return 0;
+
+    return *(hc05FingerprintNext - 1);
+}
+
+/*!
+ * \brief Appends a fingerprint to the log, erasing the sector when it is full
+ *
+ * \param[in] fingerprint The fingerprint to store, 0 invalidates the stored one
+ */
+static void hc05_writefingerprint(uint32_t fingerprint){
+
+    if (!hc05FingerprintNext)
+        hc05_scanfingerprints();
+
+    if (hc05_readfingerprint() == fingerprint)
+        return;
+
+    //unlock
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = 0x45670123;
+        FLASH->KEYR = 0xCDEF89AB;
+    }
+    hc05_flashwait();
+
+    if (hc05FingerprintNext >= (volatile uint32_t *)(HC05_FINGERPRINT_FLASH_ADDRESS + HC05_FINGERPRINT_FLASH_SIZE)) {
+        FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | (HC05_FINGERPRINT_FLASH_SECTOR * FLASH_CR_SNB_0);
+        FLASH->CR |= FLASH_CR_STRT;
+        hc05_flashwait();
+        hc05FingerprintNext = (volatile uint32_t *)HC05_FINGERPRINT_FLASH_ADDRESS;
+    }
+
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    *hc05FingerprintNext++ = fingerprint;
+    hc05_flashwait();
+
+    FLASH->CR = FLASH_CR_LOCK;
+}
+#endif
+
+/*!
+ * \brief Forgets the cached configuration after a direct AT write
+ *
+ *  Queries (commands with a '?') do not change anything, so they keep the cache.
+ *  Called with hc05LinkMutex locked and the module in AT mode, right before the write: a sync
+ *  can then not mark the cache valid between this and the write, and the flash is only
+ *  programmed by one thread.
+ *
+ * \param[in] command The AT command that is sent
+ */
+static void hc05_notecommand(const char *command){
+
+    if (strchr(command, '?'))
+        return;
+
+    hc05Shadow.valid = 0;
+#if HC05_USE_FLASH_FINGERPRINT
+    hc05_writefingerprint(0);
+#endif
+}
+
+/*!
+ * \brief Returns the GPIO port of a hc05_port_t
+ *
+ * \param[in] port One of the hc05_port_t values
+ * \return the port, NULL for unknown values
+ */
+static ioportid_t hc05_gpioport(enum hc05_port_t port){
+
+    switch (port) {
+        case gpioa_port:
+            return GPIOA;
+        case gpiob_port:
+            return GPIOB;
+        case gpioc_port:
+            return GPIOC;
+        case gpiod_port:
+            return GPIOD;
+        case gpioe_port:
+            return GPIOE;
+        case gpiof_port:
+            return GPIOF;
+        case gpiog_port:
+            return GPIOG;
+        case gpioh_port:
+            return GPIOH;
+        default:
+            return NULL;
+    }
+}
+
+/*!
+ * \brief Changes the state and tells the listeners
+ *
+ *  Must be called with the system locked (thread or ISR). From a thread, chSchRescheduleS must follow.
+ *
+ * \param[in] state The new state
+ */
+static void hc05_setstateI(enum hc05_state_t state){
+
+    hc05CurrentState = state;
+    chEvtBroadcastFlagsI(&hc05StateEventSource, HC05_STATE_FLAG(state));
+}
+
+/*!
+ * \brief Changes the state and tells the listeners, from thread context
+ *
+ * \param[in] state The new state
+ */
+static void hc05_setstate(enum hc05_state_t state){
+
+    chSysLock();
+    hc05_setstateI(state);
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/*!
+ * \brief Does the next step of the running mode switch
+ *
+ *  Called with the system locked, from the virtual timer or when the switch starts.
+ */
+static void hc05_switchstepI(void);
+
+/*!
+ * \brief Virtual timer callback, advances the mode switch
+ */
+static void hc05_switchtimercb(void *arg){
+
+    (void)arg;
+
+    chSysLockFromIsr();
+    hc05_switchstepI();
+    chSysUnlockFromIsr();
+}
+
+static void hc05_switchstepI(void){
+
+    struct hc05_config_t *hc05config = hc05Switch.hc05config;
+
+    switch (hc05Switch.step) {
+
+        case sw_keysettle:
+            palClearPad(hc05_gpioport(hc05config->resetport), hc05config->resetpin);
+            hc05Switch.step = sw_resetlow;
+            chVTSetI(&hc05SwitchTimer, HC05_VTDELAY(hc05Switch.resetpulsems), hc05_switchtimercb, NULL);
+            break;
+
+        case sw_resetlow:
+            palSetPad(hc05_gpioport(hc05config->resetport), hc05config->resetpin);
+            hc05Switch.releasedat = chTimeNow();
+            if (hc05Switch.bootms == 0) {
+                hc05Switch.step = sw_idle;
+                hc05_setstateI(hc05Switch.target);
+                break;
+            }
+            hc05Switch.step = sw_booting;
+            chVTSetI(&hc05SwitchTimer, MS2ST(hc05Switch.bootms), hc05_switchtimercb, NULL);
+            break;
+
+        case sw_booting:
+        case sw_fastsettle:
+            hc05Switch.step = sw_idle;
+            hc05_setstateI(hc05Switch.target);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*!
+ * \brief Starts a mode switch, returns at once
+ *
+ *  A switch already in progress is abandoned.
+ *
+ * \param[in] hc05config HC-05 config with the pins to use
+ * \param[in] target st_ready_at_command or st_ready_communication
+ * \param[in] keysettlems Time between the key pin change and the reset, in milliseconds
+ * \param[in] resetpulsems Length of the reset pulse, in milliseconds
+ * \param[in] bootms Time to wait after the reset, in milliseconds, 0 to not wait
+ * \param[in] fast Nonzero to only set the key pin, without a reset
+ */
+static void hc05_startswitch(struct hc05_config_t *hc05config, enum hc05_state_t target,
+                             uint32_t keysettlems, uint32_t resetpulsems, uint32_t bootms, int fast){
+
+    chSysLock();
+
+    if (chVTIsArmedI(&hc05SwitchTimer))
+        chVTResetI(&hc05SwitchTimer);
+
+    hc05Switch.hc05config = hc05config;
+    hc05Switch.target = target;
+    hc05Switch.keysettlems = keysettlems;
+    hc05Switch.resetpulsems = resetpulsems;
+    hc05Switch.bootms = bootms;
+    hc05Switch.step = fast ? sw_fastsettle : sw_keysettle;
+
+    //key high at boot: AT mode, key low: communication mode
+    if (target == st_ready_at_command)
+        palSetPad(hc05_gpioport(hc05config->keyport), hc05config->keypin);
+    else
+        palClearPad(hc05_gpioport(hc05config->keyport), hc05config->keypin);
+
+    hc05_setstateI(st_initializing);
+    chVTSetI(&hc05SwitchTimer, HC05_VTDELAY(keysettlems), hc05_switchtimercb, NULL);
+
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+/*!
+ * \brief Waits for the running mode switch to end
+ *
+ *  Not for the state: a switch abandoned by a newer one or by hc05close ends the wait too,
+ *  the newer switch or hc05close wake the waiters. The wait is bounded by the planned length
+ *  of the switch and HC05_SWITCH_MARGIN_MS, in case the timer never fires.
+ *
+ * \param[in] target The state the switch should end in
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the switch ended in another state or did not end
+ */
+static int hc05_waitswitch(enum hc05_state_t target){
+
+    EventListener listener;
+    systime_t start = chTimeNow();
+    systime_t limit = MS2ST(hc05Switch.keysettlems + hc05Switch.resetpulsems +
+                            hc05Switch.bootms + HC05_SWITCH_MARGIN_MS);
+
+    chEvtRegisterMask(&hc05StateEventSource, &listener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    while (hc05Switch.step != sw_idle && chTimeElapsedSince(start) < limit)
+        chEvtWaitAnyTimeout(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID), limit - chTimeElapsedSince(start));
+
+    chEvtUnregister(&hc05StateEventSource, &listener);
+    chEvtGetAndClearEvents(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    return hc05Switch.step == sw_idle && hc05CurrentState == target ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*!
+ * \brief Switches the module into communication mode and waits for the switch, with hc05LinkMutex locked
+ *
+ * \param[in] config A BluetoothConfig object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the switch was abandoned or did not end in time
+ */
+static int hc05_setmodecomm(struct BluetoothConfig *config){
+
+    hc05RequestModeComm(config, 0);
+    return hc05_waitswitch(st_ready_communication);
+}
+
+/*!
+ * \brief Restarts the module into AT mode and learns its boot time
+ *
+ *  We wait the boot time learned so far, then probe with "AT" until the module answers.
+ *  The time from the release of the reset to the answer is the new boot time, used as is
+ *  by switches to communication mode, where the module can not be probed.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the module did not answer within HC05_BOOT_MAX_MS
+ */
+static int hc05_resetatmode(struct BluetoothDriver *instance){
+
+    uint32_t measured;
+    int retval = EXIT_FAILURE;
+
+    //start probing a bit before the module is expected up
+    hc05_startswitch(instance->config->myhc05config, st_ready_at_command,
+                     hc05Timing.keysettlems, hc05Timing.resetpulsems,
+                     hc05Timing.calibrated && hc05Timing.lastbootms > HC05_BOOT_PROBE_MS ?
+                         hc05Timing.lastbootms - HC05_BOOT_PROBE_MS : 0, 0);
+    if (hc05_waitswitch(st_ready_at_command) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    while (HC05_ST2MS(chTimeElapsedSince(hc05Switch.releasedat)) < HC05_BOOT_MAX_MS) {
+        //the boot garbage would be parsed as the answer
+        hc05_flushinput(instance->config->myhc05config->hc05serialpointer);
+        if (hc05atTransaction(instance, "AT", NULL, HC05_BOOT_PROBE_MS) == EXIT_SUCCESS) {
+            retval = EXIT_SUCCESS;
+            break;
+        }
+    }
+
+    measured = HC05_ST2MS(chTimeElapsedSince(hc05Switch.releasedat));
+
+    if (retval == EXIT_SUCCESS) {
+        hc05Timing.lastbootms = measured;
+        hc05Timing.bootms = measured + HC05_BOOT_MARGIN_MS;
+        hc05Timing.calibrated = 1;
+        hc05Timing.calibrations++;
+    } else {
+        //start over from the worst case next time
+        hc05Timing.bootms = HC05_BOOT_MAX_MS;
+        hc05Timing.calibrated = 0;
+        hc05Timing.failures++;
+    }
+
+    return retval;
+}
+
+/*!
+ * \brief Puts the module into AT mode with the key pin only, never resets
+ *
+ *  The module then accepts AT commands at its communication bit rate, without dropping the link.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the config does not allow it, the module is not in
+ *         communication mode or it did not answer the "AT" probe (it is back in communication mode then)
+ */
+static int hc05_enterfastat(struct BluetoothDriver *instance){
+
+    struct hc05_config_t *hc05config = instance->config->myhc05config;
+    systime_t start = chTimeNow();
+    uint32_t elapsed;
+
+    if (!hc05config->fastatmode || hc05CurrentState != st_ready_communication)
+        return EXIT_FAILURE;
+
+    hc05_startswitch(hc05config, st_ready_at_command, HC05_FAST_AT_SETTLE_MS, 0, 0, 1);
+    if (hc05_waitswitch(st_ready_at_command) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (hc05atTransaction(instance, "AT", NULL, HC05_FAST_AT_PROBE_TIMEOUT_MS) == EXIT_SUCCESS)
+    {
+        hc05AtModeIsFast = 1;
+        elapsed = HC05_ST2MS(chTimeElapsedSince(start));
+        hc05SwitchStats.fastcount++;
+        hc05SwitchStats.lastfastenterms = elapsed;
+        if (elapsed > hc05SwitchStats.maxfastenterms)
+            hc05SwitchStats.maxfastenterms = elapsed;
+        return EXIT_SUCCESS;
+    }
+
+    //no answer, the firmware does not know the key-held AT mode
+    palClearPad(hc05_gpioport(hc05config->keyport), hc05config->keypin);
+    hc05_setstate(st_ready_communication);
+
+    return EXIT_FAILURE;
+}
+
+/*!
+ * \brief Puts the module into AT mode, if it is not there already
+ *
+ *  If the config allows it, we only pull the key pin high (see hc05_enterfastat). If the module
+ *  does not answer the "AT" probe, we fall back to the reset (AT mode at boot).
+ *  If the module does not answer after the reset either, it is put back into communication mode.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the module did not answer in AT mode
+ */
+static int hc05_enteratmode(struct BluetoothDriver *instance){
+
+    struct hc05_config_t *hc05config = instance->config->myhc05config;
+    systime_t start;
+    uint32_t elapsed;
+
+    if (hc05CurrentState == st_ready_at_command)
+        return EXIT_SUCCESS;
+
+    start = chTimeNow();
+
+    if (hc05config->fastatmode && hc05CurrentState == st_ready_communication)
+    {
+        if (hc05_enterfastat(instance) == EXIT_SUCCESS)
+            return EXIT_SUCCESS;
+        //the switch was abandoned
+        if (hc05CurrentState != st_ready_communication)
+            return EXIT_FAILURE;
+        hc05SwitchStats.fallbackcount++;
+    }
+
+    hc05AtModeIsFast = 0;
+
+    if (hc05_resetatmode(instance) != EXIT_SUCCESS) {
+        //the commands would go to a module that does not listen
+        hc05_setmodecomm(instance->config);
+        return EXIT_FAILURE;
+    }
+
+    elapsed = HC05_ST2MS(chTimeElapsedSince(start));
+    hc05SwitchStats.resetcount++;
+    hc05SwitchStats.lastresetenterms = elapsed;
+    if (elapsed > hc05SwitchStats.maxresetenterms)
+        hc05SwitchStats.maxresetenterms = elapsed;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Returns the module to communication mode after AT commands
+ *
+ *  After a fast entry releasing the key pin is enough, unless a command that only takes effect
+ *  after a restart (role, bit rate) was written.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] needreset Nonzero to restart the module even after a fast entry
+ */
+static void hc05_leaveatmode(struct BluetoothDriver *instance, int needreset){
+
+    struct hc05_config_t *hc05config = instance->config->myhc05config;
+    systime_t start = chTimeNow();
+
+    if (hc05AtModeIsFast && !needreset)
+    {
+        palClearPad(hc05_gpioport(hc05config->keyport), hc05config->keypin);
+        hc05AtModeIsFast = 0;
+        hc05_setstate(st_ready_communication);
+        hc05SwitchStats.lastfastleavems = HC05_ST2MS(chTimeElapsedSince(start));
+        return;
+    }
+
+    hc05AtModeIsFast = 0;
+    hc05_setmodecomm(instance->config);
+    hc05SwitchStats.lastresetleavems = HC05_ST2MS(chTimeElapsedSince(start));
+}
+
+/*!
+ * \brief Reads one response line from the module
+ *
+ *  '\r' is dropped, '\n' terminates the line, empty lines are skipped.
+ *  Characters above maxlength are dropped, but the line is still read to its end.
+ *
+ * \param[in] sdp SerialDriver of the module
+ * \param[out] line Buffer for the line, maxlength+1 bytes long
+ * \param[in] maxlength Maximum number of characters to store
+ * \param[in] start System time the timeout is measured from
+ * \param[in] timeout Timeout in system ticks, measured from start
+ * \return length of the line, or -1 on timeout
+ */
+static int hc05_atreadline(SerialDriver *sdp, char *line, int maxlength, systime_t start, systime_t timeout){
+
+    int length = 0;
+    msg_t c;
+
+    while (TRUE) {
+        systime_t elapsed = chTimeElapsedSince(start);
+
+        if (elapsed >= timeout)
+            return -1;
+
+        c = sdGetTimeout(sdp, timeout - elapsed);
+
+        if (c == Q_TIMEOUT || c == Q_RESET)
+            return -1;
+        if (c == '\r')
+            continue;
+        if (c == '\n') {
+            if (!length)
+                continue;
+            line[length] = '\0';
+            return length;
+        }
+        if (length < maxlength)
+            line[length++] = (char)c;
+    }
+}
+
+/*!
+ * \brief Interprets one response line
+ *
+ *  "OK", "FAIL" and "ERROR:(n)" terminate the transaction, "+KEY:value" lines are stored,
+ *  anything else (echo, boot garbage) is ignored.
+ *
+ * \param[in] line A '\0' terminated response line
+ * \param[out] result The result to update
+ * \return 1 if the line terminated the transaction, 0 otherwise
+ */
+static int hc05_atparseline(const char *line, struct hc05_at_result_t *result){
+
+    if (!strcmp(line, "OK")) {
+        result->status = at_ok;
+        return 1;
+    }
+
+    if (!strcmp(line, "FAIL")) {
+        result->status = at_fail;
+        return 1;
+    }
+
+    if (!strncmp(line, "ERROR:(", 7)) {
+        result->status = at_error;
+        //error codes are hexadecimal: ERROR:(1D)
+        result->errorcode = (int)strtol(line + 7, NULL, 16);
+        return 1;
+    }
+
+    if (line[0] == '+') {
+        const char *separator = strchr(line, ':');
+
+        if (!result->infolines && separator) {
+            int keylength = separator - (line + 1);
+
+            if (keylength > HC05_AT_KEY_LENGTH)
+                keylength = HC05_AT_KEY_LENGTH;
+            memcpy(result->key, line + 1, keylength);
+            result->key[keylength] = '\0';
+            strncpy(result->value, separator + 1, HC05_AT_LINE_LENGTH);
+            result->value[HC05_AT_LINE_LENGTH] = '\0';
+        }
+        result->infolines++;
+    }
+
+    return 0;
+}
+
+
+/*!
+ * \brief Takes the received data, without waiting
+ *
+ *  Under hc05LinkMutex and only in communication mode: in AT mode, also for a sniff entry on a
+ *  live link, the input is the answers of the module, and they belong to the AT transaction.
+ *
+ * \param[in] sdp SerialDriver of the module
+ * \param[out] buffer A pointer to a buffer to write into
+ * \param[in] maxlength The maximum number of bytes to read
+ * \return the number of bytes read
+ */
+static int hc05_readdata(SerialDriver *sdp, char *buffer, int maxlength){
+
+    int n = 0;
+
+    chMtxLock(&hc05LinkMutex);
+    if (hc05CurrentState == st_ready_communication)
+        n = sdReadTimeout(sdp, (uint8_t *)buffer, maxlength, TIME_IMMEDIATE);
+    chMtxUnlock();
+
+    return n;
+}
+
+
+/*===========================================================================*/
+/* VMT functions                                                             */
+/*===========================================================================*/
+
+/*!
+ * \brief EXT callback of the STATE pin
+ *
+ *  Tracks the connection and broadcasts BT_EVENT_CONNECTED / BT_EVENT_DISCONNECTED on the driver.
+ *  On a disconnect the unsent data is thrown away, nobody would receive it.
+ */
+static void hc05_statepincb(EXTDriver *extp, expchannel_t channel){
+
+    struct BluetoothDriver *instance = hc05LinkDriver;
+    struct hc05_config_t *hc05config;
+    int level;
+
+    (void)extp;
+    (void)channel;
+
+    if (!instance)
+        return;
+
+    hc05config = instance->config->myhc05config;
+    level = palReadPad(hc05_gpioport(hc05config->stateport), hc05config->statepin) ? 1 : 0;
+
+    chSysLockFromIsr();
+    if (level != hc05LinkUp) {
+        hc05LinkUp = level;
+        hc05LinkStats.lastchange = chTimeNow();
+        if (level) {
+            hc05LinkStats.connects++;
+            chEvtBroadcastFlagsI(&instance->eventSource, BT_EVENT_CONNECTED);
+        } else {
+            hc05LinkStats.disconnects++;
+            //AT commands may be on their way, only data is dropped
+            if (hc05CurrentState == st_ready_communication) {
+                hc05LinkStats.flushedbytes += chOQGetFullI(&hc05config->hc05serialpointer->oqueue);
+                chOQResetI(&hc05config->hc05serialpointer->oqueue);
+            }
+            chEvtBroadcastFlagsI(&instance->eventSource, BT_EVENT_DISCONNECTED);
+        }
+    }
+    chSysUnlockFromIsr();
+}
+
+/*!
+ * \brief Checks the link before data is sent
+ *
+ *  Without a STATE pin the link is assumed to be up. Otherwise, depending on
+ *  HC05_TX_DROP_WHEN_DISCONNECTED, we fail at once or wait up to HC05_LINK_WAIT_MS for a connection.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS if the data can be sent, EXIT_FAILURE if it should be dropped
+ */
+static int hc05_waitlink(struct BluetoothDriver *instance){
+
+    if (!instance->config->myhc05config->usestatepin || hc05LinkUp)
+        return EXIT_SUCCESS;
+
+#if HC05_TX_DROP_WHEN_DISCONNECTED
+    return EXIT_FAILURE;
+#else
+    {
+        EventListener listener;
+        systime_t start = chTimeNow();
+
+        chEvtRegisterMask(&instance->eventSource, &listener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+        while (!hc05LinkUp && chTimeElapsedSince(start) < MS2ST(HC05_LINK_WAIT_MS))
+            chEvtWaitAnyTimeout(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID),
+                                MS2ST(HC05_LINK_WAIT_MS) - chTimeElapsedSince(start));
+        chEvtUnregister(&instance->eventSource, &listener);
+        chEvtGetAndClearEvents(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+        return hc05LinkUp ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#endif
+}
+
+/*!
+ * \brief Runs AT commands while the link stays up, for the sniff policy
+ *
+ *  Only the key pin is used (hc05_enterfastat), a reset would drop the link. If the module
+ *  does not answer that way, the policy is switched off for good.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] commands NULL terminated list of commands
+ * \param[out] result Result of the last command, may be NULL
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int hc05_powerat(struct BluetoothDriver *instance, const char * const *commands,
+                        struct hc05_at_result_t *result){
+
+    int retval = EXIT_SUCCESS;
+
+    if (hc05_enterfastat(instance) != EXIT_SUCCESS) {
+        //not when the switch was abandoned
+        if (hc05CurrentState == st_ready_communication)
+            hc05PowerStats.unsupported = 1;
+        return EXIT_FAILURE;
+    }
+
+    for (; retval == EXIT_SUCCESS && *commands; commands++)
+        retval = hc05atTransaction(instance, *commands, result, HC05_AT_DEFAULT_TIMEOUT_MS);
+
+    hc05_leaveatmode(instance, 0);
+
+    return retval;
+}
+
+/*!
+ * \brief Counts a failed sniff entry
+ *
+ *  The next try waits for another sniffidlems without traffic, and after HC05_SNIFF_MAX_FAILURES
+ *  in a row the policy is switched off, the key pin would toggle at every poll otherwise.
+ */
+static void hc05_snifffailed(void){
+
+    hc05PowerStats.failures++;
+    hc05LastActivity = chTimeNow();
+    if (++hc05SniffFailures >= HC05_SNIFF_MAX_FAILURES)
+        hc05PowerStats.unsupported = 1;
+}
+
+/*!
+ * \brief Puts the link into sniff mode
+ *
+ *  Called with hc05LinkMutex locked. The sniff parameters are written once per open,
+ *  the address of the remote device is asked once per connection.
+ *
+ * \param[in] instance A BluetoothDriver object
+ */
+static void hc05_entersniff(struct BluetoothDriver *instance){
+
+    static const union hc05_at_value_t sniffparams[4] = {
+        {HC05_SNIFF_MAX_INTERVAL}, {HC05_SNIFF_MIN_INTERVAL}, {HC05_SNIFF_ATTEMPT}, {HC05_SNIFF_TIMEOUT}
+    };
+    struct hc05_at_result_t result;
+    struct hc05_at_response_t response;
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    const char *commands[2] = {command, NULL};
+
+    if (!hc05SniffParamsSet) {
+        hc05AtRender(command, sizeof(command), hc05_at_sniff, hc05_op_set, sniffparams);
+        if (hc05_powerat(instance, commands, NULL) != EXIT_SUCCESS) {
+            hc05_snifffailed();
+            return;
+        }
+        hc05SniffParamsSet = 1;
+    }
+
+    if (!hc05SniffAddressKnown) {
+        hc05AtRender(command, sizeof(command), hc05_at_mrad, hc05_op_get, NULL);
+        if (hc05_powerat(instance, commands, &result) != EXIT_SUCCESS ||
+            hc05AtParse(hc05_at_mrad, &result, &response) != EXIT_SUCCESS) {
+            hc05_snifffailed();
+            return;
+        }
+        hc05SniffAddress = response.values[0];
+        hc05SniffAddressKnown = 1;
+    }
+
+    hc05AtRender(command, sizeof(command), hc05_at_ensniff, hc05_op_set, &hc05SniffAddress);
+    if (hc05_powerat(instance, commands, NULL) != EXIT_SUCCESS) {
+        hc05_snifffailed();
+        return;
+    }
+
+    hc05SniffFailures = 0;
+    hc05SniffStart = chTimeNow();
+    hc05PowerStats.sniffing = 1;
+    hc05PowerStats.entries++;
+}
+
+/*!
+ * \brief Takes the link out of sniff mode
+ *
+ *  Called with hc05LinkMutex locked.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] demandat Time the traffic showed up
+ */
+static void hc05_exitsniff(struct BluetoothDriver *instance, systime_t demandat){
+
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    const char *commands[2] = {command, NULL};
+    uint32_t wakems;
+
+    hc05AtRender(command, sizeof(command), hc05_at_exsniff, hc05_op_set, &hc05SniffAddress);
+    if (hc05_powerat(instance, commands, NULL) != EXIT_SUCCESS)
+        hc05PowerStats.failures++;
+
+    //even if it failed, the link leaves sniff mode on its own when data flows
+    hc05PowerStats.sniffing = 0;
+    hc05PowerStats.sniffms += HC05_ST2MS(demandat - hc05SniffStart);
+
+    wakems = HC05_ST2MS(chTimeElapsedSince(demandat));
+    hc05PowerStats.wakeups++;
+    hc05PowerStats.lastwakems = wakems;
+    hc05PowerStats.totalwakems += wakems;
+    if (wakems > hc05PowerStats.maxwakems)
+        hc05PowerStats.maxwakems = wakems;
+}
+
+/*!
+ * \brief Notes traffic and wakes the link before data is sent
+ *
+ *  Called with hc05LinkMutex locked, and the sender keeps it until the data is queued:
+ *  the data must not reach the module while the key pin is high, for a sniff entry or exit
+ *  or any other AT command.
+ *
+ * \param[in] instance A BluetoothDriver object
+ */
+static void hc05_powerwake(struct BluetoothDriver *instance){
+
+    systime_t demandat = chTimeNow();
+
+    hc05LastActivity = demandat;
+
+    if (!hc05PowerStats.sniffing)
+        return;
+
+    hc05_exitsniff(instance, demandat);
+
+    hc05LastActivity = chTimeNow();
+}
+
+/*!
+ * \brief Sniff power policy thread
+ *
+ *  Enters sniff mode after sniffidlems without traffic, and leaves it when data comes in.
+ *  Outgoing data wakes the link in hc05_powerwake.
+ */
+static msg_t hc05_powerthread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    struct hc05_config_t *hc05config = instance->config->myhc05config;
+    SerialDriver *sdp = hc05config->hc05serialpointer;
+    size_t pending;
+
+    chRegSetThreadName("hc05power");
+
+    while (!chThdShouldTerminate()) {
+
+        chThdSleepMilliseconds(HC05_POWER_POLL_MS);
+
+        if (hc05PowerStats.unsupported || hc05CurrentState != st_ready_communication)
+            continue;
+
+        //a new connection may be another device
+        if (!hc05isConnected(instance)) {
+            hc05PowerStats.sniffing = 0;
+            hc05SniffAddressKnown = 0;
+            continue;
+        }
+
+        chSysLock();
+        pending = chIQGetFullI(&sdp->iqueue) + chOQGetFullI(&sdp->oqueue);
+        chSysUnlock();
+
+        if (pending) {
+            systime_t demandat = chTimeNow();
+
+            hc05LastActivity = demandat;
+            if (hc05PowerStats.sniffing) {
+                chMtxLock(&hc05LinkMutex);
+                if (hc05PowerStats.sniffing)
+                    hc05_exitsniff(instance, demandat);
+                chMtxUnlock();
+            }
+            continue;
+        }
+
+        if (!hc05PowerStats.sniffing && hc05config->sniffidlems &&
+            chTimeElapsedSince(hc05LastActivity) >= MS2ST(hc05config->sniffidlems)) {
+            chMtxLock(&hc05LinkMutex);
+            hc05_entersniff(instance);
+            chMtxUnlock();
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Sends the given buffer
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer to read from
+ * \param[in] bufferlength The number of bytes to send
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05sendBuffer(struct BluetoothDriver *instance, char *buffer, int bufferlength){
+
+    int retval;
+
+	if ( !instance || !buffer )
+		return EXIT_FAILURE;
+	if ( !bufferlength )
+		return EXIT_SUCCESS;
+
+    if (hc05_waitlink(instance) != EXIT_SUCCESS) {
+        hc05LinkStats.droppedbytes += bufferlength;
+        return EXIT_FAILURE;
+    }
+
+    chMtxLock(&hc05LinkMutex);
+    hc05_powerwake(instance);
+    retval = sdWriteTimeout(instance->config->myhc05config->hc05serialpointer, buffer, bufferlength, TIME_IMMEDIATE) > 0
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE;
+    chMtxUnlock();
+
+    return retval;
+}
+
+/*!
+ * \brief Sends the given byte
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] mybyte A byte to send
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05sendByte(struct BluetoothDriver *instance, int mybyte){
+
+    int retval;
+
+	if ( !instance )
+		return EXIT_FAILURE;
+
+    if (hc05_waitlink(instance) != EXIT_SUCCESS) {
+        hc05LinkStats.droppedbytes++;
+        return EXIT_FAILURE;
+    }
+
+    chMtxLock(&hc05LinkMutex);
+    hc05_powerwake(instance);
+    retval = sdPut(instance->config->myhc05config->hc05serialpointer, mybyte);
+    chMtxUnlock();
+
+    return retval;
+}
+
+
+/*!
+ * \brief Checks if there is incoming data
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return 1 if there is data, 0 if there isn't
+ */
+int hc05canRecieve(struct BluetoothDriver *instance){
+
+	if ( !instance )
+		return EXIT_FAILURE;
+
+	//in AT mode the input is the answers of the module, not data
+	if (hc05CurrentState != st_ready_communication)
+		return 0;
+
+	return sdGetWouldBlock(instance->config->myhc05config->hc05serialpointer) == 0 ? 1 : 0;
+
+}
+
+/*!
+ * \brief Reads from the bluetooth module into the buffer
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer to write into
+ * \param[in] maxlength The maximum number of bytes to read (size of the buffer)
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05readBuffer(struct BluetoothDriver *instance, char *buffer, int maxlength){
+
+	if ( !instance || !buffer )
+		return EXIT_FAILURE;
+	if ( !maxlength )
+		return EXIT_SUCCESS;
+
+	return hc05_readdata(instance->config->myhc05config->hc05serialpointer, buffer, maxlength) > 0
+            ? EXIT_SUCCESS
+            : EXIT_FAILURE;
+
+}
+
+/*!
+ * \brief Sends the given buffer, waits for room in the output queue
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer to read from
+ * \param[in] bufferlength The number of bytes to send
+ * \param[in] timeout Timeout in system ticks
+ * \return the number of bytes queued
+ */
+int hc05writeTimeout(struct BluetoothDriver *instance, const char *buffer, int bufferlength, systime_t timeout){
+
+    int written;
+
+    if ( !instance || !buffer || bufferlength <= 0 )
+        return 0;
+
+    if (hc05_waitlink(instance) != EXIT_SUCCESS) {
+        hc05LinkStats.droppedbytes += bufferlength;
+        return 0;
+    }
+
+    chMtxLock(&hc05LinkMutex);
+    hc05_powerwake(instance);
+    written = sdWriteTimeout(instance->config->myhc05config->hc05serialpointer, (const uint8_t *)buffer, bufferlength, timeout);
+    chMtxUnlock();
+
+    return written;
+}
+
+/*!
+ * \brief Reads from the bluetooth module, waits for the data
+ *
+ *  Outside communication mode nothing is read, the wait goes on until the module is back.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] buffer A pointer to a buffer to write into
+ * \param[in] maxlength The maximum number of bytes to read
+ * \param[in] timeout Timeout in system ticks
+ * \return the number of bytes read
+ */
+int hc05readTimeout(struct BluetoothDriver *instance, char *buffer, int maxlength, systime_t timeout){
+
+    SerialDriver *sdp;
+    EventListener inputlistener, statelistener;
+    systime_t start = chTimeNow();
+    int n;
+
+    if ( !instance || !buffer || maxlength <= 0 )
+        return 0;
+
+    sdp = instance->config->myhc05config->hc05serialpointer;
+    n = hc05_readdata(sdp, buffer, maxlength);
+    if (n || timeout == TIME_IMMEDIATE)
+        return n;
+
+    //waits without taking anything from the queue, an AT span may begin meanwhile
+    chEvtRegisterMask(chnGetEventSource(sdp), &inputlistener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+    chEvtRegisterMask(&hc05StateEventSource, &statelistener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    while (!(n = hc05_readdata(sdp, buffer, maxlength))) {
+        if (timeout == TIME_INFINITE)
+            chEvtWaitAny(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+        else if (chTimeElapsedSince(start) >= timeout ||
+                 !chEvtWaitAnyTimeout(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID), timeout - chTimeElapsedSince(start)))
+            break;
+        chEvtGetAndClearFlags(&inputlistener);
+    }
+
+    chEvtUnregister(&hc05StateEventSource, &statelistener);
+    chEvtUnregister(chnGetEventSource(sdp), &inputlistener);
+    chEvtGetAndClearEvents(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    return n;
+}
+
+/*!
+ * \brief Moves the received bytes straight into the output queue
+ *
+ *  Copies from ring to ring under the system lock, one contiguous piece at a time, with no
+ *  buffer between them. The caller must be the only reader of the input queue and the only
+ *  writer of the output queue, so no thread waits on the queue ends it moves.
+ *
+ * \param[in] sdp The serial driver
+ * \return the number of bytes moved
+ */
+static size_t hc05_reflect(SerialDriver *sdp){
+
+    InputQueue *iqp = &sdp->iqueue;
+    OutputQueue *oqp = &sdp->oqueue;
+    size_t moved = 0;
+    size_t n;
+
+    while (TRUE) {
+        chSysLock();
+        n = chIQGetFullI(iqp);
+        if (n > chOQGetEmptyI(oqp))
+            n = chOQGetEmptyI(oqp);
+        if (n > (size_t)(iqp->q_top - iqp->q_rdptr))
+            n = iqp->q_top - iqp->q_rdptr;
+        if (n > (size_t)(oqp->q_top - oqp->q_wrptr))
+            n = oqp->q_top - oqp->q_wrptr;
+        if (!n) {
+            chSysUnlock();
+            return moved;
+        }
+
+        memcpy(oqp->q_wrptr, iqp->q_rdptr, n);
+
+        iqp->q_rdptr += n;
+        if (iqp->q_rdptr >= iqp->q_top)
+            iqp->q_rdptr = iqp->q_buffer;
+        iqp->q_counter -= n;
+        if (iqp->q_notify)
+            iqp->q_notify(iqp);
+
+        oqp->q_wrptr += n;
+        if (oqp->q_wrptr >= oqp->q_top)
+            oqp->q_wrptr = oqp->q_buffer;
+        oqp->q_counter -= n;
+        //starts the transmission
+        if (oqp->q_notify)
+            oqp->q_notify(oqp);
+        chSysUnlock();
+
+        moved += n;
+    }
+}
+
+/*!
+ * \brief Reflector thread
+ *
+ *  Sleeps until the serial driver reports input or an empty output queue.
+ *  Data is only moved in communication mode.
+ */
+static msg_t hc05_reflectorthread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    SerialDriver *sdp = instance->config->myhc05config->hc05serialpointer;
+    EventListener listener;
+    size_t pending, moved;
+
+    chRegSetThreadName("hc05reflect");
+    chEvtRegisterMask(chnGetEventSource(sdp), &listener, EVENT_MASK(0));
+
+    while (!chThdShouldTerminate()) {
+
+        chEvtWaitAnyTimeout(EVENT_MASK(0), MS2ST(HC05_REFLECTOR_POLL_MS));
+        chEvtGetAndClearFlags(&listener);
+
+        chSysLock();
+        pending = chIQGetFullI(&sdp->iqueue);
+        chSysUnlock();
+        if (!pending)
+            continue;
+
+        //keeps off the answers of a sniff exit the power thread is waiting for
+        chMtxLock(&hc05LinkMutex);
+        hc05_powerwake(instance);
+        //in AT mode the input is the answers of the module, not data to echo
+        moved = hc05CurrentState == st_ready_communication ? hc05_reflect(sdp) : 0;
+        chMtxUnlock();
+        if (!moved && hc05CurrentState != st_ready_communication)
+            continue;
+
+        hc05ReflectorStats.bytes += moved;
+        if (moved) {
+            hc05ReflectorStats.bursts++;
+            if (moved > hc05ReflectorStats.maxburst)
+                hc05ReflectorStats.maxburst = moved;
+        }
+        chSysLock();
+        if (chIQGetFullI(&sdp->iqueue))
+            hc05ReflectorStats.stalls++;
+        chSysUnlock();
+    }
+
+    chEvtUnregister(chnGetEventSource(sdp), &listener);
+    return 0;
+}
+
+/*!
+ * \brief Starts sending the received bytes back as soon as they arrive
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it runs already or the module is not in communication mode
+ */
+int hc05startReflector(struct BluetoothDriver *instance){
+
+    if (!instance || hc05ReflectorThreadTp || hc05CurrentState != st_ready_communication)
+        return EXIT_FAILURE;
+
+    memset(&hc05ReflectorStats, 0, sizeof(hc05ReflectorStats));
+    hc05ReflectorStats.running = 1;
+    hc05ReflectorThreadTp = chThdCreateStatic(hc05ReflectorThreadWa, sizeof(hc05ReflectorThreadWa),
+                                              NORMALPRIO + 1, hc05_reflectorthread, instance);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Stops the reflector
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it was not running
+ */
+int hc05stopReflector(struct BluetoothDriver *instance){
+
+    (void)instance;
+
+    if (!hc05ReflectorThreadTp)
+        return EXIT_FAILURE;
+
+    chThdTerminate(hc05ReflectorThreadTp);
+    chThdWait(hc05ReflectorThreadTp);
+    hc05ReflectorThreadTp = NULL;
+    hc05ReflectorStats.running = 0;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Returns the reflector statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct hc05_reflector_stats_t *hc05GetReflectorStats(void){
+
+    return &hc05ReflectorStats;
+}
+
+/*!
+ * \brief Resets the result the oldest in-flight command collects its answer into
+ */
+static void hc05_atresetheadresult(void){
+
+    memset(&hc05AtPipeline.headresult, 0, sizeof(hc05AtPipeline.headresult));
+    hc05AtPipeline.headresult.status = at_timeout;
+    hc05AtPipeline.headresult.errorcode = -1;
+    hc05AtPipeline.headstart = chTimeNow();
+}
+
+/*!
+ * \brief Removes the oldest in-flight command and calls its callback
+ */
+static void hc05_atpophead(void){
+
+    struct hc05_at_inflight_t *entry = &hc05AtPipeline.entries[hc05AtPipeline.head];
+
+    hc05AtPipeline.headresult.elapsedms = HC05_ST2MS(chTimeElapsedSince(entry->sent));
+    if (hc05AtPipeline.headresult.status != at_ok)
+        hc05AtPipeline.failures++;
+
+    hc05AtPipeline.head = (hc05AtPipeline.head + 1) % HC05_AT_PIPELINE_DEPTH;
+    hc05AtPipeline.count--;
+
+    if (entry->callback)
+        entry->callback(&hc05AtPipeline.headresult, entry->arg);
+
+    hc05_atresetheadresult();
+}
+
+/*!
+ * \brief Waits for the answer of the oldest in-flight command
+ *
+ *  If it times out, the answers of the rest can not be matched reliably any more,
+ *  so they are completed with at_timeout too and the input is flushed.
+ *
+ * \param[in] sdp SerialDriver of the module
+ */
+static void hc05_atcompletehead(SerialDriver *sdp){
+
+    char line[HC05_AT_LINE_LENGTH+1];
+    struct hc05_at_inflight_t *entry = &hc05AtPipeline.entries[hc05AtPipeline.head];
+
+    while (hc05_atreadline(sdp, line, HC05_AT_LINE_LENGTH,
+                           hc05AtPipeline.headstart, MS2ST(entry->timeoutms)) >= 0) {
+        if (hc05_atparseline(line, &hc05AtPipeline.headresult)) {
+            hc05_atpophead();
+            return;
+        }
+    }
+
+    while (hc05AtPipeline.count)
+        hc05_atpophead();
+
+    hc05_flushinput(sdp);
+}
+
+/*!
+ * \brief Submits an AT command to the pipeline
+ *
+ *  The module must already be in AT mode. The command is written right away, without waiting
+ *  for the answers of the earlier ones. If HC05_AT_PIPELINE_DEPTH commands are already in flight,
+ *  we wait for the oldest one first. The callback is called when the answer arrives, during a later
+ *  hc05AtSubmit or hc05AtFlush call.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] command AT command to use, without "\r\n". Must be '\0' terminated string
+ * \param[in] callback Called with the parsed answer, can be NULL
+ * \param[in] arg Passed to the callback
+ * \param[in] timeoutms Maximum time the module may take to answer this command in milliseconds
+ * \return EXIT_SUCCESS if the command was sent, EXIT_FAILURE otherwise
+ */
+int hc05AtSubmit(struct BluetoothDriver *instance, const char *command,
+                 hc05_at_callback_t callback, void *arg, uint16_t timeoutms){
+
+    SerialDriver *sdp;
+    struct hc05_at_inflight_t *entry;
+
+    if ( !instance || !command )
+        return EXIT_FAILURE;
+
+    sdp = instance->config->myhc05config->hc05serialpointer;
+
+    if (hc05AtPipeline.count == HC05_AT_PIPELINE_DEPTH)
+        hc05_atcompletehead(sdp);
+
+    if (!hc05AtPipeline.count) {
+        //nothing to match against, anything waiting is garbage
+        hc05_flushinput(sdp);
+        hc05_atresetheadresult();
+    }
+
+    entry = &hc05AtPipeline.entries[(hc05AtPipeline.head + hc05AtPipeline.count) % HC05_AT_PIPELINE_DEPTH];
+    entry->callback = callback;
+    entry->arg = arg;
+    entry->timeoutms = timeoutms;
+    entry->sent = chTimeNow();
+    hc05AtPipeline.count++;
+
+    sdWrite(sdp, (const uint8_t *)command, strlen(command));
+    sdWrite(sdp, (const uint8_t *)"\r\n", 2);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Waits until every in-flight AT command is answered
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS if every command completed since the last flush answered "OK", EXIT_FAILURE otherwise
+ */
+int hc05AtFlush(struct BluetoothDriver *instance){
+
+    SerialDriver *sdp;
+    int failures;
+
+    if ( !instance )
+        return EXIT_FAILURE;
+
+    sdp = instance->config->myhc05config->hc05serialpointer;
+
+    while (hc05AtPipeline.count)
+        hc05_atcompletehead(sdp);
+
+    failures = hc05AtPipeline.failures;
+    hc05AtPipeline.failures = 0;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Pipeline callback that copies the answer for a synchronous caller
+ */
+static void hc05_atcopyresult(struct hc05_at_result_t *result, void *arg){
+
+    memcpy(arg, result, sizeof(*result));
+}
+
+/*!
+ * \brief Runs one AT command transaction
+ *
+ *  The module must already be in AT mode. The command is written, then the response lines
+ *  are read until "OK", "ERROR:(n)" or "FAIL" arrives, or the timeout expires.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] command AT command to use, without "\r\n". Must be '\0' terminated string
+ * \param[out] result Parsed response, can be NULL if only success matters
+ * \param[in] timeoutms Maximum time to wait for the terminating line in milliseconds
+ * \return EXIT_SUCCESS if the module answered "OK", EXIT_FAILURE otherwise
+ */
+int hc05atTransaction(struct BluetoothDriver *instance, const char *command,
+                      struct hc05_at_result_t *result, uint16_t timeoutms){
+
+    struct hc05_at_result_t localresult;
+
+    if ( !instance || !command )
+        return EXIT_FAILURE;
+
+    if (!result)
+        result = &localresult;
+
+    //drain the pipeline first, so the answer can not be mixed up with earlier ones
+    hc05AtFlush(instance);
+
+    hc05AtSubmit(instance, command, hc05_atcopyresult, result, timeoutms);
+    hc05AtFlush(instance);
+
+    return result->status == at_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*!
+ * \brief Sends an AT command and reads its response
+ *
+ *  Switches the module to AT mode, runs the transaction, then returns to communication mode,
+ *  with a restart if the command only takes effect after it (see hc05AtNeedsReset).
+ *  Waits for the AT transactions of the other threads.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] command AT command to use, without "\r\n". Must be '\0' terminated string
+ * \param[out] result Parsed response, can be NULL if only success matters
+ * \param[in] timeoutms Maximum time to wait for the terminating line in milliseconds
+ * \return EXIT_SUCCESS if the module answered "OK", EXIT_FAILURE otherwise
+ */
+int hc05executeAtCommand(struct BluetoothDriver *instance, const char *command,
+                         struct hc05_at_result_t *result, uint16_t timeoutms){
+
+    int retval;
+
+    if ( !instance || !command )
+        return EXIT_FAILURE;
+
+    chMtxLock(&hc05LinkMutex);
+
+    if (hc05_enteratmode(instance) != EXIT_SUCCESS) {
+        chMtxUnlock();
+        if (result) {
+            memset(result, 0, sizeof(*result));
+            result->status = at_timeout;
+            result->errorcode = -1;
+        }
+        return EXIT_FAILURE;
+    }
+
+    hc05_notecommand(command);
+    retval = hc05atTransaction(instance, command, result, timeoutms);
+
+    hc05_leaveatmode(instance, hc05AtNeedsReset(command));
+
+    chMtxUnlock();
+
+    return retval;
+}
+
+/*!
+*	\brief Sends an AT command
+*
+*	While the calling thread has an AT session open the command is only queued, and runs at hc05AtCommit.
+*
+*	\param[in] instance A BluetoothDriver object
+*	\param[in] command AT command to use. Must be '\0' terminated string
+*	\return EXIT_SUCCESS if the module answered "OK" (or the command was queued), EXIT_FAILURE otherwise
+*/
+int hc05sendAtCommand(struct BluetoothDriver *instance, char* command){
+
+	if (hc05AtSession.isopen && hc05AtSession.owner == chThdSelf())
+		return hc05AtQueue(instance, command);
+
+	return hc05executeAtCommand(instance, command, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+}
+
+/*!
+ * \brief Opens an AT session
+ *
+ *  Every AT command sent until hc05AtCommit (including the ones from hc05setName,
+ *  hc05setPinCode and hc05resetDefaults) is queued, then run back to back with
+ *  a single AT mode / communication mode switch.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return EXIT_SUCCESS or EXIT_FAILURE (a session is already open)
+ */
+int hc05AtBegin(struct BluetoothDriver *instance){
+
+    if ( !instance || hc05AtSession.isopen )
+        return EXIT_FAILURE;
+
+    hc05AtSession.count = 0;
+    hc05AtSession.owner = chThdSelf();
+    hc05AtSession.isopen = 1;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Queues an AT command in the open session
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] command AT command to queue, without "\r\n". Must be '\0' terminated string
+ * \return EXIT_SUCCESS or EXIT_FAILURE (no open session, queue full or command too long)
+ */
+int hc05AtQueue(struct BluetoothDriver *instance, const char *command){
+
+    if ( !instance || !command || !hc05AtSession.isopen || hc05AtSession.owner != chThdSelf() )
+        return EXIT_FAILURE;
+
+    if (hc05AtSession.count >= HC05_AT_SESSION_MAX_COMMANDS ||
+        strlen(command) > HC05_AT_COMMAND_LENGTH)
+        return EXIT_FAILURE;
+
+    strcpy(hc05AtSession.commands[hc05AtSession.count++], command);
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Callback argument of one command of a committed session
+ */
+struct hc05_at_sessionslot_t {
+    int index;
+    int *firstfailed;
+};
+
+/*!
+ * \brief Pipeline callback of hc05AtCommit, remembers the first failed command
+ */
+static void hc05_atsessioncallback(struct hc05_at_result_t *result, void *arg){
+
+    struct hc05_at_sessionslot_t *slot = arg;
+
+    if (result->status != at_ok && *(slot->firstfailed) < 0)
+        *(slot->firstfailed) = slot->index;
+}
+
+/*!
+ * \brief Runs the queued commands and closes the session
+ *
+ *  Enters AT mode once, pipelines the commands in order and returns to communication mode once,
+ *  with a restart if one of them only takes effect after it (see hc05AtNeedsReset).
+ *  The commands are sent without waiting for each other, so a failure does not stop the later ones.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] failedindex Index of the first failed command, -1 if all succeeded or none ran. Can be NULL
+ * \return EXIT_SUCCESS if every command answered "OK", EXIT_FAILURE otherwise
+ */
+int hc05AtCommit(struct BluetoothDriver *instance, int *failedindex){
+
+    int i;
+    int retval;
+    int needreset = 0;
+    int firstfailed = -1;
+    struct hc05_at_sessionslot_t slots[HC05_AT_SESSION_MAX_COMMANDS];
+
+    if (failedindex)
+        *failedindex = -1;
+
+    if ( !instance || !hc05AtSession.isopen || hc05AtSession.owner != chThdSelf() )
+        return EXIT_FAILURE;
+
+    hc05AtSession.isopen = 0;
+
+    if (!hc05AtSession.count)
+        return EXIT_SUCCESS;
+
+    chMtxLock(&hc05LinkMutex);
+
+    if (hc05_enteratmode(instance) != EXIT_SUCCESS) {
+        chMtxUnlock();
+        hc05AtSession.count = 0;
+        return EXIT_FAILURE;
+    }
+
+    hc05AtFlush(instance);
+    for (i = 0; i < hc05AtSession.count; i++) {
+        hc05_notecommand(hc05AtSession.commands[i]);
+        slots[i].index = i;
+        slots[i].firstfailed = &firstfailed;
+        hc05AtSubmit(instance, hc05AtSession.commands[i], hc05_atsessioncallback,
+                     &slots[i], HC05_AT_DEFAULT_TIMEOUT_MS);
+        needreset |= hc05AtNeedsReset(hc05AtSession.commands[i]);
+    }
+    retval = hc05AtFlush(instance);
+
+    hc05_leaveatmode(instance, needreset);
+
+    chMtxUnlock();
+
+    hc05AtSession.count = 0;
+
+    if (failedindex)
+        *failedindex = firstfailed;
+
+    return retval;
+}
+
+/*!
+ * \brief Discards the queued commands and closes the session
+ *
+ * \param[in] instance A BluetoothDriver object
+ */
+void hc05AtAbort(struct BluetoothDriver *instance){
+
+    (void)instance;
+
+    if (hc05AtSession.owner != chThdSelf())
+        return;
+
+    hc05AtSession.isopen = 0;
+    hc05AtSession.count = 0;
+}
+
+
+/*!
+ * \brief Pipeline callback of hc05SyncConfig, stores the answer of a query in the shadow
+ */
+static void hc05_shadowcallback(struct hc05_at_result_t *result, void *arg){
+
+    (void)arg;
+
+    if (result->status != at_ok || !result->infolines)
+        return;
+
+    if (!strcmp(result->key, "NAME")) {
+        strncpy(hc05Shadow.name, result->value, BLUETOOTH_MAX_NAME_LENGTH);
+        hc05Shadow.name[BLUETOOTH_MAX_NAME_LENGTH] = '\0';
+    }
+    else if (!strcmp(result->key, "PSWD") || !strcmp(result->key, "PIN")) {
+        strncpy(hc05Shadow.pincode, result->value, BLUETOOTH_MAX_PINCODE_LENGTH);
+        hc05Shadow.pincode[BLUETOOTH_MAX_PINCODE_LENGTH] = '\0';
+    }
+    else if (!strcmp(result->key, "UART")) {
+        hc05Shadow.baudrate = strtoul(result->value, NULL, 10);
+    }
+    else if (!strcmp(result->key, "ROLE")) {
+        hc05Shadow.role = atoi(result->value);
+    }
+}
+
+/*!
+ * \brief Fills the shadow from the configuration, after it was applied
+ *
+ * \param[in] config A BluetoothConfig object
+ */
+static void hc05_shadowfromconfig(struct BluetoothConfig *config){
+
+    strcpy(hc05Shadow.name, config->name);
+    strcpy(hc05Shadow.pincode, config->pincode);
+    hc05Shadow.baudrate = hc05_bitratevalue(config->baudrate);
+    hc05Shadow.role = hc05_role(config);
+    hc05Shadow.valid = 1;
+}
+
+/*!
+ * \brief hc05SyncConfig with hc05LinkMutex locked
+ */
+static int hc05_syncconfig(struct BluetoothDriver *instance, int force){
+
+    static const enum hc05_at_cmd_t queries[4] = {hc05_at_name, hc05_at_pswd, hc05_at_uart, hc05_at_role};
+    struct BluetoothConfig *config;
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    union hc05_at_value_t params[3];
+    uint32_t baudrate;
+    int needreset;
+    int retval;
+    int i;
+#if HC05_USE_FLASH_FINGERPRINT
+    uint32_t fingerprint;
+#endif
+
+    if ( !instance || !instance->config || !instance->config->myhc05config )
+        return EXIT_FAILURE;
+
+    config = instance->config;
+    baudrate = hc05_bitratevalue(config->baudrate);
+#if HC05_USE_FLASH_FINGERPRINT
+    fingerprint = hc05_configfingerprint(config);
+#endif
+
+    hc05Shadow.writes = 0;
+    hc05Shadow.queried = 0;
+    hc05Shadow.failed = 0;
+
+    if (!force) {
+#if HC05_USE_FLASH_FINGERPRINT
+        if (hc05_readfingerprint() == fingerprint) {
+            hc05_shadowfromconfig(config);
+            return EXIT_SUCCESS;
+        }
+#endif
+        if (hc05Shadow.valid &&
+            !strcmp(hc05Shadow.name, config->name) &&
+            !strcmp(hc05Shadow.pincode, config->pincode) &&
+            hc05Shadow.baudrate == baudrate &&
+            hc05Shadow.role == hc05_role(config))
+            return EXIT_SUCCESS;
+    }
+
+    hc05Shadow.valid = 0;
+    hc05Shadow.queried = 1;
+    hc05Shadow.name[0] = '\0';
+    hc05Shadow.pincode[0] = '\0';
+    hc05Shadow.baudrate = 0;
+    hc05Shadow.role = -1;
+
+    if (hc05_enteratmode(instance) != EXIT_SUCCESS) {
+        hc05Shadow.failed = 1;
+        return EXIT_FAILURE;
+    }
+
+    hc05AtFlush(instance);
+    for (i = 0; i < 4; i++) {
+        hc05AtRender(command, sizeof(command), queries[i], hc05_op_get, NULL);
+        hc05AtSubmit(instance, command, hc05_shadowcallback, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+    }
+    hc05AtFlush(instance);
+
+    if (config->name[0] && strcmp(hc05Shadow.name, config->name)) {
+        params[0].s = config->name;
+        hc05AtRender(command, sizeof(command), hc05_at_name, hc05_op_set, params);
+        hc05AtSubmit(instance, command, NULL, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+        hc05Shadow.writes++;
+    }
+
+    if (config->pincode[0] && strcmp(hc05Shadow.pincode, config->pincode)) {
+        params[0].s = config->pincode;
+        hc05AtRender(command, sizeof(command), hc05_at_pswd, hc05_op_set, params);
+        hc05AtSubmit(instance, command, NULL, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+        hc05Shadow.writes++;
+    }
+
+    //role and bit rate only take effect after a restart
+    needreset = (hc05Shadow.baudrate != baudrate ||
+                 hc05Shadow.role != hc05_role(config));
+
+    if (hc05Shadow.baudrate != baudrate) {
+        //one stop bit, no parity
+        params[0].u = baudrate;
+        params[1].u = 0;
+        params[2].u = 0;
+        hc05AtRender(command, sizeof(command), hc05_at_uart, hc05_op_set, params);
+        hc05AtSubmit(instance, command, NULL, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+        hc05Shadow.writes++;
+    }
+
+    if (hc05Shadow.role != hc05_role(config)) {
+        params[0].u = hc05_role(config);
+        hc05AtRender(command, sizeof(command), hc05_at_role, hc05_op_set, params);
+        hc05AtSubmit(instance, command, NULL, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+        hc05Shadow.writes++;
+    }
+
+    retval = hc05AtFlush(instance);
+
+    hc05_leaveatmode(instance, needreset);
+
+    if (retval == EXIT_SUCCESS) {
+        hc05_shadowfromconfig(config);
+#if HC05_USE_FLASH_FINGERPRINT
+        hc05_writefingerprint(fingerprint);
+#endif
+    } else
+        hc05Shadow.failed = 1;
+
+    return retval;
+}
+
+/*!
+ * \brief Applies name, pin code, bit rate and role of the BluetoothConfig to the module
+ *
+ *  Only the settings that differ from the module are written. The module state is taken from
+ *  (in this order) the flash fingerprint of the last applied configuration, the shadow kept
+ *  in RAM, or one pipelined round of AT+NAME?, AT+PSWD?, AT+UART? and AT+ROLE?.
+ *  An empty name or pin code in the config is left alone. While the auto-connect manager runs,
+ *  the role is master whatever the config says.
+ *
+ *  If the module had to be asked, it is left in communication mode, otherwise its mode is not touched.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] force Nonzero to ignore the fingerprint and the shadow and always ask the module
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05SyncConfig(struct BluetoothDriver *instance, int force){
+
+    int retval;
+
+    chMtxLock(&hc05LinkMutex);
+    retval = hc05_syncconfig(instance, force);
+    chMtxUnlock();
+
+    return retval;
+}
+
+/*!
+ * \brief Returns the latency statistics of the AT mode switches
+ *
+ * \return pointer to the statistics
+ */
+const struct hc05_modeswitch_stats_t *hc05GetModeSwitchStats(void){
+
+    return &hc05SwitchStats;
+}
+
+/*!
+ * \brief Checks if a remote device is connected
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \return 1 if connected or the STATE pin is not used, 0 if not
+ */
+int hc05isConnected(struct BluetoothDriver *instance){
+
+    if (!instance || !instance->config || !instance->config->myhc05config)
+        return 0;
+
+    if (!instance->config->myhc05config->usestatepin)
+        return 1;
+
+    return hc05LinkUp;
+}
+
+/*!
+ * \brief Returns the connection statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct hc05_link_stats_t *hc05GetLinkStats(void){
+
+    return &hc05LinkStats;
+}
+
+/*!
+ * \brief Returns the sniff power policy statistics
+ *
+ * \return pointer to the statistics
+ */
+const struct hc05_power_stats_t *hc05GetPowerStats(void){
+
+    return &hc05PowerStats;
+}
+
+/*!
+ * \brief Returns the timing of the reset mode switches
+ *
+ * \return pointer to the timing, check its calibrated flag
+ */
+const struct hc05_timing_t *hc05GetTiming(void){
+
+    return &hc05Timing;
+}
+
+/*!
+ * \brief Forgets the learned boot time, the next AT mode entry measures it again
+ */
+void hc05ResetTiming(void){
+
+    hc05Timing.bootms = HC05_BOOT_DEFAULT_MS;
+    hc05Timing.lastbootms = 0;
+    hc05Timing.calibrated = 0;
+}
+
+/*!
+ * \brief Returns the last known configuration of the module
+ *
+ * \return pointer to the shadow, check its valid flag
+ */
+const struct hc05_shadow_t *hc05GetShadow(void){
+
+    return &hc05Shadow;
+}
+
+/*!
+ * \brief Parses a Bluetooth address
+ *
+ *  Accepts the forms the module prints and takes: "2:72:D2224" or "2,72,D2224", hexadecimal.
+ *
+ * \param[in] text The address as text
+ * \param[out] address The parsed address
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05ParseAddress(const char *text, struct hc05_bdaddr_t *address){
+
+    char *end;
+    unsigned long nap, uap, lap;
+
+    if (!text || !address)
+        return EXIT_FAILURE;
+
+    nap = strtoul(text, &end, 16);
+    if (end == text || (*end != ':' && *end != ',') || nap > 0xFFFF)
+        return EXIT_FAILURE;
+    text = end + 1;
+
+    uap = strtoul(text, &end, 16);
+    if (end == text || (*end != ':' && *end != ',') || uap > 0xFF)
+        return EXIT_FAILURE;
+    text = end + 1;
+
+    lap = strtoul(text, &end, 16);
+    if (end == text || lap > 0xFFFFFF)
+        return EXIT_FAILURE;
+
+    address->nap = (uint16_t)nap;
+    address->uap = (uint8_t)uap;
+    address->lap = (uint32_t)lap;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Prints a Bluetooth address the way the module does
+ *
+ * \param[in] address The address
+ * \param[out] text At least HC05_ADDRESS_TEXT_LENGTH characters
+ * \param[in] separator ':' for display, ',' for the commands taking an address (AT+BIND, AT+LINK...)
+ */
+void hc05FormatAddress(const struct hc05_bdaddr_t *address, char *text, char separator){
+
+    static const char hexdigits[] = "0123456789ABCDEF";
+    uint32_t parts[3];
+    int part;
+
+    if (!address || !text)
+        return;
+
+    parts[0] = address->nap;
+    parts[1] = address->uap;
+    parts[2] = address->lap;
+
+    for (part = 0; part < 3; part++) {
+        char digits[6];
+        int count = 0;
+        uint32_t value = parts[part];
+
+        do {
+            digits[count++] = hexdigits[value & 0xF];
+            value >>= 4;
+        } while (value);
+
+        while (count)
+            *text++ = digits[--count];
+        if (part < 2)
+            *text++ = separator;
+    }
+    *text = '\0';
+}
+
+/*!
+ * \brief Parses "+INQ:address,class,rssi" into the device table
+ *
+ * \param[in] line The line, without the "+INQ:"
+ * \param[in] start Start of the inquiry
+ * \return the device if it is new, NULL if it was seen before, does not fit or can not be parsed
+ */
+static const struct hc05_inquiry_device_t *hc05_inquiryline(const char *line, systime_t start){
+
+    struct hc05_bdaddr_t address;
+    struct hc05_inquiry_device_t *device;
+    const char *field;
+    uint32_t deviceclass;
+    int16_t rssi;
+    int i;
+
+    if (hc05ParseAddress(line, &address) != EXIT_SUCCESS)
+        return NULL;
+
+    //the address is NAP:UAP:LAP, the first ',' starts the class
+    field = strchr(line, ',');
+    if (field && strchr(line, ':') > field)
+        return NULL;
+    deviceclass = field ? strtoul(field + 1, NULL, 16) : 0;
+    field = field ? strchr(field + 1, ',') : NULL;
+    //16 bit two's complement in hexadecimal: FFBC is -68 dBm
+    rssi = field ? (int16_t)strtoul(field + 1, NULL, 16) : 0;
+
+    for (i = 0; i < hc05InquiryResults.count; i++) {
+        device = &hc05InquiryResults.devices[i];
+        if (device->address.lap == address.lap && device->address.uap == address.uap &&
+            device->address.nap == address.nap) {
+            device->rssi = rssi;
+            device->answers++;
+            return NULL;
+        }
+    }
+
+    if (hc05InquiryResults.count >= HC05_INQUIRY_MAX_DEVICES) {
+        hc05InquiryResults.missed++;
+        return NULL;
+    }
+
+    device = &hc05InquiryResults.devices[hc05InquiryResults.count++];
+    device->address = address;
+    device->deviceclass = deviceclass;
+    device->rssi = rssi;
+    device->answers = 1;
+    device->foundms = HC05_ST2MS(chTimeElapsedSince(start));
+
+    return device;
+}
+
+/*!
+ * \brief Initializes the profile and sets the inquiry mode, in AT mode
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] maxdevices See hc05Inquiry
+ * \param[in] timeout See hc05Inquiry
+ * \return EXIT_SUCCESS or EXIT_FAILURE
  */
-static volatile enum hc05_state_t hc05CurrentState = st_unknown;
+static int hc05_inquiryprepare(struct BluetoothDriver *instance, int maxdevices, int timeout){
 
+    struct hc05_at_result_t result;
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    union hc05_at_value_t params[3];
 
-/*===========================================================================*/
-/* VMT functions                                                             */
-/*===========================================================================*/
+    //error 17: already initialized
+    hc05AtRender(command, sizeof(command), hc05_at_init, hc05_op_exec, NULL);
+    if (hc05atTransaction(instance, command, &result, HC05_AT_DEFAULT_TIMEOUT_MS) != EXIT_SUCCESS &&
+        !(result.status == at_error && result.errorcode == 0x17))
+        return EXIT_FAILURE;
+
+    //RSSI mode, stop after maxdevices answers or timeout * 1.28 s
+    params[0].u = 1;
+    params[1].u = maxdevices;
+    params[2].u = timeout;
+    hc05AtRender(command, sizeof(command), hc05_at_inqm, hc05_op_set, params);
+
+    return hc05atTransaction(instance, command, NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+}
 
 /*!
- * \brief Sends the given buffer
+ * \brief Searches for devices
+ *
+ *  The answers are parsed as they arrive, every new address goes to the callback at once,
+ *  so the caller can act before the inquiry window ends. The module must be in master role.
  *
  * \param[in] instance A BluetoothDriver object
- * \param[in] buffer A pointer to a buffer to read from
- * \param[in] bufferlength The number of bytes to send
- * \return EXIT_SUCCESS or EXIT_FAILURE
+ * \param[in] maxdevices The module stops after this many answers (AT+INQM)
+ * \param[in] timeout Length of the inquiry in 1.28 s units (AT+INQM), 1..48
+ * \param[in] callback Called for every new device, may be NULL
+ * \param[in] arg Passed to the callback
+ * \return EXIT_SUCCESS or EXIT_FAILURE, the devices are in hc05GetInquiryResults
  */
-int hc05sendBuffer(struct BluetoothDriver *instance, char *buffer, int bufferlength){
+int hc05Inquiry(struct BluetoothDriver *instance, int maxdevices, int timeout,
+                hc05_inquiry_callback_t callback, void *arg){
 
-	if ( !instance || !buffer )
-		return EXIT_FAILURE;
-	if ( !bufferlength )
-		return EXIT_SUCCESS;
+    char line[HC05_AT_LINE_LENGTH + 1];
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    SerialDriver *sdp;
+    systime_t start, window;
+    int ends = 0, expected = 1;
+    int retval = EXIT_FAILURE;
 
-    return sdWriteTimeout(instance->config->myhc05config->hc05serialpointer, buffer, bufferlength, TIME_IMMEDIATE) > 0
-            ? EXIT_SUCCESS
-            : EXIT_FAILURE;
+    if (!instance || maxdevices < 1 || timeout < 1 || timeout > 48)
+        return EXIT_FAILURE;
+
+    sdp = instance->config->myhc05config->hc05serialpointer;
+    memset(&hc05InquiryResults, 0, sizeof(hc05InquiryResults));
+
+    chMtxLock(&hc05LinkMutex);
+
+    if (hc05_enteratmode(instance) != EXIT_SUCCESS) {
+        chMtxUnlock();
+        return EXIT_FAILURE;
+    }
+
+    if (hc05_inquiryprepare(instance, maxdevices, timeout) == EXIT_SUCCESS) {
+
+        //not through the pipeline: the answer is streamed line by line
+        hc05_flushinput(sdp);
+        hc05AtRender(command, sizeof(command) - 2, hc05_at_inq, hc05_op_exec, NULL);
+        strcat(command, "\r\n");
+        sdWrite(sdp, (const uint8_t *)command, strlen(command));
+
+        start = chTimeNow();
+        window = MS2ST((uint32_t)timeout * 1280 + HC05_AT_DEFAULT_TIMEOUT_MS);
+
+        //after INQC two lines end it, the one of INQ and the one of INQC
+        while (ends < expected && hc05_atreadline(sdp, line, HC05_AT_LINE_LENGTH, start, window) >= 0) {
+            const struct hc05_inquiry_device_t *device;
+
+            if (!strcmp(line, "OK") || !strcmp(line, "FAIL") || !strncmp(line, "ERROR", 5)) {
+                if (!ends++)
+                    retval = strcmp(line, "OK") ? EXIT_FAILURE : EXIT_SUCCESS;
+                continue;
+            }
+            if (strncmp(line, "+INQ:", 5))
+                continue;
+
+            device = hc05_inquiryline(line + 5, start);
+            if (device && callback && !hc05InquiryResults.stopped && callback(device, arg)) {
+                hc05InquiryResults.stopped = 1;
+                expected = 2;
+                hc05AtRender(command, sizeof(command) - 2, hc05_at_inqc, hc05_op_exec, NULL);
+                strcat(command, "\r\n");
+                sdWrite(sdp, (const uint8_t *)command, strlen(command));
+                //INQC answers at once, the window of the inquiry is not needed any more
+                if (chTimeElapsedSince(start) + MS2ST(HC05_AT_DEFAULT_TIMEOUT_MS) < window)
+                    window = chTimeElapsedSince(start) + MS2ST(HC05_AT_DEFAULT_TIMEOUT_MS);
+            }
+        }
+
+        hc05_flushinput(sdp);
+    }
+
+    hc05_leaveatmode(instance, 0);
 
+    chMtxUnlock();
+
+    return retval;
 }
 
 /*!
- * \brief Sends the given byte
+ * \brief Returns the devices found by the last inquiry
+ *
+ * \return pointer to the device table
+ */
+const struct hc05_inquiry_t *hc05GetInquiryResults(void){
+
+    return &hc05InquiryResults;
+}
+
+/*!
+ * \brief Runs AT commands for the auto-connect manager, while the link may be up
+ *
+ *  Only the key pin is used (hc05_enterfastat), a reset would drop the link the manager is
+ *  looking after.
  *
  * \param[in] instance A BluetoothDriver object
- * \param[in] mybyte A byte to send
+ * \param[in] commands NULL terminated list of commands
+ * \param[out] result Result of the last command, may be NULL
+ * \param[in] timeoutms Timeout of each command in milliseconds
  * \return EXIT_SUCCESS or EXIT_FAILURE
  */
-int hc05sendByte(struct BluetoothDriver *instance, int mybyte){
+static int hc05_autoat(struct BluetoothDriver *instance, const char * const *commands,
+                       struct hc05_at_result_t *result, uint16_t timeoutms){
 
-	if ( !instance )
-		return EXIT_FAILURE;
+    int retval = EXIT_SUCCESS;
 
-    return sdPut(instance->config->myhc05config->hc05serialpointer, mybyte);
-}
+    if (hc05_enterfastat(instance) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (; retval == EXIT_SUCCESS && *commands; commands++)
+        retval = hc05atTransaction(instance, *commands, result, timeoutms);
 
+    hc05_leaveatmode(instance, 0);
+
+    return retval;
+}
 
 /*!
- * \brief Checks if there is incoming data
+ * \brief Checks the link for the auto-connect manager
+ *
+ *  The STATE pin if it is wired, AT+STATE? in fast AT mode otherwise.
  *
  * \param[in] instance A BluetoothDriver object
- * \return 1 if there is data, 0 if there isn't
+ * \return 1 if connected, 0 if not
  */
-int hc05canRecieve(struct BluetoothDriver *instance){
+static int hc05_autoconnected(struct BluetoothDriver *instance){
 
-	if ( !instance )
-		return EXIT_FAILURE;
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    const char *commands[2] = {command, NULL};
+    struct hc05_at_result_t result;
+    struct hc05_at_response_t response;
+    int connected;
 
-	return sdGetWouldBlock(instance->config->myhc05config->hc05serialpointer) == 0 ? 1 : 0;
+    if (instance->config->myhc05config->usestatepin)
+        return hc05LinkUp;
+
+    hc05AtRender(command, sizeof(command), hc05_at_state, hc05_op_get, NULL);
+    chMtxLock(&hc05LinkMutex);
+    connected = hc05_autoat(instance, commands, &result, HC05_AT_DEFAULT_TIMEOUT_MS) == EXIT_SUCCESS &&
+                hc05AtParse(hc05_at_state, &result, &response) == EXIT_SUCCESS &&
+                !strcmp(response.values[0].s, "CONNECTED");
+    chMtxUnlock();
 
+    return connected;
 }
 
 /*!
- * \brief Reads from the bluetooth module into the buffer
+ * \brief Waits for the driver events or the timeout, in the auto-connect thread
+ *
+ * \param[in] timeoutms Timeout in milliseconds, 0 to wait forever
+ */
+static void hc05_autowait(uint32_t timeoutms){
+
+    chEvtWaitAnyTimeout(ALL_EVENTS, timeoutms ? MS2ST(timeoutms) : TIME_INFINITE);
+}
+
+/*!
+ * \brief Sets the module up as the master of the bound device
+ *
+ *  ROLE=1 goes through hc05_syncconfig (hc05AutoRole), it only takes effect after a restart.
+ *  CMODE=0 makes the module connect to the bound address only.
  *
  * \param[in] instance A BluetoothDriver object
- * \param[in] buffer A pointer to a buffer to write into
- * \param[in] maxlength The maximum number of bytes to read (size of the buffer)
  * \return EXIT_SUCCESS or EXIT_FAILURE
  */
-int hc05readBuffer(struct BluetoothDriver *instance, char *buffer, int maxlength){
+static int hc05_autosetup(struct BluetoothDriver *instance){
+
+    static const union hc05_at_value_t cmode = {0};
+    char cmodecommand[HC05_AT_COMMAND_LENGTH+1];
+    char bindcommand[HC05_AT_COMMAND_LENGTH+1];
+    const char *commands[3] = {cmodecommand, bindcommand, NULL};
+    int retval, i;
+
+    hc05AtRender(cmodecommand, sizeof(cmodecommand), hc05_at_cmode, hc05_op_set, &cmode);
+    hc05AtRender(bindcommand, sizeof(bindcommand), hc05_at_bind, hc05_op_set, &hc05AutoAddress);
+
+    chMtxLock(&hc05LinkMutex);
+    hc05AutoRole = 1;
+    retval = hc05_syncconfig(instance, 0);
+    //before the first connection, the reset entry is allowed here
+    if (retval == EXIT_SUCCESS && (retval = hc05_enteratmode(instance)) == EXIT_SUCCESS) {
+        for (i = 0; retval == EXIT_SUCCESS && commands[i]; i++)
+            retval = hc05atTransaction(instance, commands[i], NULL, HC05_AT_DEFAULT_TIMEOUT_MS);
+        hc05_leaveatmode(instance, 0);
+    }
+    chMtxUnlock();
 
-	if ( !instance || !buffer )
-		return EXIT_FAILURE;
-	if ( !maxlength )
-		return EXIT_SUCCESS;
+    return retval;
+}
 
-	return sdReadTimeout(instance->config->myhc05config->hc05serialpointer, buffer, maxlength, TIME_IMMEDIATE) > 0
-            ? EXIT_SUCCESS
-            : EXIT_FAILURE;
+/*!
+ * \brief Tries to connect to the bound device once
+ *
+ *  In fast AT mode with AT+LINK, for at most HC05_LINK_AT_TIMEOUT_MS: the senders wait for
+ *  hc05LinkMutex meanwhile. Otherwise a restart, then the module pages the bound device by
+ *  itself (CMODE=0), and we wait for the STATE pin.
+ *
+ * \param[in] instance A BluetoothDriver object
+ */
+static void hc05_autoattempt(struct BluetoothDriver *instance){
+
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    struct hc05_at_result_t result;
+    systime_t start;
+
+    if (instance->config->myhc05config->fastatmode) {
+        hc05AtRender(command, sizeof(command), hc05_at_link, hc05_op_set, &hc05AutoAddress);
+        chMtxLock(&hc05LinkMutex);
+        if (hc05_enterfastat(instance) == EXIT_SUCCESS) {
+            hc05atTransaction(instance, command, &result, HC05_LINK_AT_TIMEOUT_MS);
+            //the late answer of a page still running would reach the data readers, the restart
+            //cuts it, then the module pages the bound device by itself
+            hc05_leaveatmode(instance, result.status == at_timeout);
+        }
+        chMtxUnlock();
+        return;
+    }
 
+    chMtxLock(&hc05LinkMutex);
+    hc05_setmodecomm(instance->config);
+    chMtxUnlock();
+
+    start = chTimeNow();
+    while (!hc05LinkUp && !chThdShouldTerminate() &&
+           chTimeElapsedSince(start) < MS2ST(HC05_LINK_TIMEOUT_MS))
+        hc05_autowait(HC05_POWER_POLL_MS);
 }
 
 /*!
-*	\brief Sends an AT command
-*
-*	\param[in] instance A BluetoothDriver object
-*	\param[in] command AT command to use. Must be '\0' terminated string
-*	\return EXIT_SUCCESS or EXIT_FAILURE
-*/
-int hc05sendAtCommand(struct BluetoothDriver *instance, char* command){
+ * \brief Returns the next backoff delay with jitter
+ *
+ *  Uniform in [backoff/2, backoff], so units that lost the link together do not retry in step.
+ *
+ * \param[in] backoffms The current backoff
+ * \return the delay in milliseconds
+ */
+static uint32_t hc05_jitter(uint32_t backoffms){
 
-	if ( !instance || !command )
-		return EXIT_FAILURE;
+    hc05JitterState ^= hc05JitterState << 13;
+    hc05JitterState ^= hc05JitterState >> 17;
+    hc05JitterState ^= hc05JitterState << 5;
+
+    return backoffms / 2 + hc05JitterState % (backoffms / 2 + 1);
+}
+
+/*!
+ * \brief Auto-connect thread
+ *
+ *  Keeps the link to the bound device: sleeps while connected, retries with a jittered
+ *  exponential backoff (HC05_BACKOFF_MIN_MS doubling up to HC05_BACKOFF_MAX_MS) while not.
+ */
+static msg_t hc05_autoconnectthread(void *arg){
+
+    struct BluetoothDriver *instance = arg;
+    struct hc05_config_t *hc05config = instance->config->myhc05config;
+    EventListener listener;
+    systime_t lostat = chTimeNow();
+    uint32_t backoffms = HC05_BACKOFF_MIN_MS;
+    uint32_t reconnectms;
+    int wasconnected = 0;
+
+    chRegSetThreadName("hc05auto");
+    chEvtRegisterMask(&instance->eventSource, &listener, EVENT_MASK(0));
+
+    while (!chThdShouldTerminate() && hc05_autosetup(instance) != EXIT_SUCCESS) {
+        hc05AutoStats.failures++;
+        hc05_autowait(hc05_jitter(backoffms));
+        backoffms = backoffms * 2 > HC05_BACKOFF_MAX_MS ? HC05_BACKOFF_MAX_MS : backoffms * 2;
+    }
+    backoffms = HC05_BACKOFF_MIN_MS;
+
+    while (!chThdShouldTerminate()) {
+
+        if (hc05_autoconnected(instance)) {
+            if (!wasconnected) {
+                wasconnected = 1;
+                reconnectms = HC05_ST2MS(chTimeElapsedSince(lostat));
+                hc05AutoStats.connects++;
+                hc05AutoStats.lastconnectms = reconnectms;
+                hc05AutoStats.totalconnectms += reconnectms;
+                if (reconnectms > hc05AutoStats.maxconnectms)
+                    hc05AutoStats.maxconnectms = reconnectms;
+                backoffms = HC05_BACKOFF_MIN_MS;
+                hc05AutoStats.backoffms = 0;
+            }
+            //the STATE pin wakes us, without it we have to look
+            hc05_autowait(hc05config->usestatepin ? 0 : HC05_AUTOCONNECT_POLL_MS);
+            continue;
+        }
+
+        if (wasconnected) {
+            wasconnected = 0;
+            lostat = chTimeNow();
+            hc05AutoStats.drops++;
+        }
+
+        hc05AutoStats.attempts++;
+        hc05_autoattempt(instance);
+        if (hc05_autoconnected(instance))
+            continue;
+
+        hc05AutoStats.failures++;
+        hc05AutoStats.backoffms = hc05_jitter(backoffms);
+        hc05_autowait(hc05AutoStats.backoffms);
+        backoffms = backoffms * 2 > HC05_BACKOFF_MAX_MS ? HC05_BACKOFF_MAX_MS : backoffms * 2;
+    }
+
+    chEvtUnregister(&instance->eventSource, &listener);
+
+    return 0;
+}
+
+/*!
+ * \brief Starts keeping a link to the given device, as master
+ *
+ *  Sets ROLE=1, CMODE=0 and BIND, connects, and reconnects after every drop.
+ *  Needs the STATE pin or the fast AT mode to see the link.
+ *
+ * \param[in] instance A BluetoothDriver object, opened
+ * \param[in] address The device to connect to
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05AutoConnectStart(struct BluetoothDriver *instance, const struct hc05_bdaddr_t *address){
+
+    struct hc05_config_t *hc05config;
+
+    if (!instance || !address || !instance->config || !instance->config->myhc05config)
+        return EXIT_FAILURE;
+
+    hc05config = instance->config->myhc05config;
+    if (!hc05config->usestatepin && !hc05config->fastatmode)
+        return EXIT_FAILURE;
 
+    hc05AutoConnectStop();
 
-	if (hc05CurrentState != st_ready_at_command)
-	{
-		hc05CurrentState = st_unknown;
-		//enter AT mode here, but wait for threads to detect state change
+    hc05AutoAddress.a = *address;
+    memset(&hc05AutoStats, 0, sizeof(hc05AutoStats));
+    hc05JitterState ^= (uint32_t)chTimeNow() ^ address->lap;
+    if (!hc05JitterState)
+        hc05JitterState = 1;
 
-        hc05SetModeAt(instance->config, 200);
-        //chThdSleepMilliseconds(instance->commSleepTimeMs);
-        chThdSleepMilliseconds(500);
-	}
+    hc05AutoThreadTp = chThdCreateStatic(hc05AutoThreadWa, sizeof(hc05AutoThreadWa),
+                                         NORMALPRIO, hc05_autoconnectthread, instance);
 
+    return EXIT_SUCCESS;
+}
 
-    sdWrite(instance->config->myhc05config->hc05serialpointer, command, strlen(command));
-    sdWrite(instance->config->myhc05config->hc05serialpointer,"\r\n",2);
+/*!
+ * \brief Stops the auto-connect manager, the link is left as it is
+ *
+ *  The module stays master, the next hc05SyncConfig (or open) applies the role of the config again.
+ */
+void hc05AutoConnectStop(void){
 
-    chThdSleepMilliseconds(1000);
+    if (!hc05AutoThreadTp)
+        return;
 
-    hc05SetModeComm(instance->config, 200);
+    chThdTerminate(hc05AutoThreadTp);
+    //wake it from the backoff
+    chEvtSignal(hc05AutoThreadTp, EVENT_MASK(1));
+    chThdWait(hc05AutoThreadTp);
+    hc05AutoThreadTp = NULL;
 
-	return EXIT_SUCCESS;
+    chMtxLock(&hc05LinkMutex);
+    hc05AutoRole = -1;
+    chMtxUnlock();
 }
 
+/*!
+ * \brief Returns the auto-connect statistics
+ *
+ *  connectms is the time from a link drop (or the start) to the next connection.
+ *
+ * \return pointer to the statistics
+ */
+const struct hc05_autoconnect_stats_t *hc05GetAutoConnectStats(void){
+
+    return &hc05AutoStats;
+}
 
 /*!
  * \brief Sets the pin/access code for the HC-05 module
@@ -164,30 +2740,22 @@ int hc05sendAtCommand(struct BluetoothDriver *instance, char* command){
  */
 int hc05setPinCode(struct BluetoothDriver *instance, char *pin, int pinlength){
 
-	if ( !instance || !pin )
-		return EXIT_FAILURE;
-
-    char Command[] = "AT+PIN=";
-    int cmdLen = strlen(Command);
-    int bufLen = cmdLen + pinlength + 1;
-
-    char *CmdBuf = chHeapAlloc(NULL, bufLen);
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    char pincode[BLUETOOTH_MAX_PINCODE_LENGTH+1];
+    union hc05_at_value_t param;
 
-    if(!CmdBuf)
+	if ( !instance || !pin || pinlength < 0 || pinlength > BLUETOOTH_MAX_PINCODE_LENGTH )
 		return EXIT_FAILURE;
-    else
-        memset(CmdBuf, '\0', bufLen);
 
-    strcpy(CmdBuf, Command);
-    strncpy(CmdBuf+cmdLen, pin, pinlength);
-    //must terminate the string with a \0
-    *(CmdBuf+bufLen-1) = '\0';
+    //the pin does not have to be terminated
+    memcpy(pincode, pin, pinlength);
+    pincode[pinlength] = '\0';
+    param.s = pincode;
 
-    if ( (hc05sendAtCommand(instance, CmdBuf) == EXIT_FAILURE))
+    if (hc05AtRender(command, sizeof(command), hc05_at_pswd, hc05_op_set, &param) < 0)
         return EXIT_FAILURE;
 
-    chHeapFree(CmdBuf);
-    return EXIT_SUCCESS;
+    return hc05sendAtCommand(instance, command);
 }
 
 /*!
@@ -202,30 +2770,22 @@ int hc05setPinCode(struct BluetoothDriver *instance, char *pin, int pinlength){
  */
 int hc05setName(struct BluetoothDriver *instance, char *newname, int namelength){
 
-    if ( !instance || !newname )
-		return EXIT_FAILURE;
-
-    char Command[] = "AT+NAME=";
-    int cmdLen = strlen(Command);
-    int bufLen = cmdLen + namelength + 1;
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    char name[BLUETOOTH_MAX_NAME_LENGTH+1];
+    union hc05_at_value_t param;
 
-    char *CmdBuf = chHeapAlloc(NULL, bufLen);
-
-    if(!CmdBuf)
+    if ( !instance || !newname || namelength < 0 || namelength > BLUETOOTH_MAX_NAME_LENGTH )
 		return EXIT_FAILURE;
-    else
-        memset(CmdBuf, '\0', bufLen);
 
-    strcpy(CmdBuf, Command);
-    strncpy(CmdBuf+cmdLen, newname, namelength);
-    //must terminate the string with a \0
-    *(CmdBuf+bufLen-1) = '\0';
+    //the name does not have to be terminated
+    memcpy(name, newname, namelength);
+    name[namelength] = '\0';
+    param.s = name;
 
-    if ( (hc05sendAtCommand(instance, CmdBuf) == EXIT_FAILURE))
+    if (hc05AtRender(command, sizeof(command), hc05_at_name, hc05_op_set, &param) < 0)
         return EXIT_FAILURE;
 
-    chHeapFree(CmdBuf);
-    return EXIT_SUCCESS;
+    return hc05sendAtCommand(instance, command);
 }
 
 /*!
@@ -238,29 +2798,14 @@ int hc05setName(struct BluetoothDriver *instance, char *newname, int namelength)
  */
 int hc05resetDefaults(struct BluetoothDriver *instance){
 
-    if ( !instance )
-		return EXIT_FAILURE;
-
-    char Command[] = "AT+ORGL";
-    int cmdLen = strlen(Command);
-    int bufLen = cmdLen + 1;
+    char command[HC05_AT_COMMAND_LENGTH+1];
 
-    char *CmdBuf = chHeapAlloc(NULL, bufLen);
-
-    if(!CmdBuf)
+    if ( !instance )
 		return EXIT_FAILURE;
-    else
-        memset(CmdBuf, '\0', bufLen);
-
-    strcpy(CmdBuf, Command);
-    //must terminate the string with a \0
-    *(CmdBuf+bufLen-1) = '\0';
 
-    if ( (hc05sendAtCommand(instance, CmdBuf) == EXIT_FAILURE))
-        return EXIT_FAILURE;
+    hc05AtRender(command, sizeof(command), hc05_at_orgl, hc05_op_exec, NULL);
 
-    chHeapFree(CmdBuf);
-    return EXIT_SUCCESS;
+    return hc05sendAtCommand(instance, command);
 }
 
 
@@ -269,21 +2814,31 @@ int hc05resetDefaults(struct BluetoothDriver *instance){
  *
  *  Read config
  *  Set the apropriate port/pin settings
- *  Set the name/pin according to the config
  *  Initialize the serial driver
+ *  Set the name/pin according to the config (see hc05SyncConfig)
  *  Set the ready flag
  *
+ *  If the module did not take the config, the driver is still opened (the link carries data
+ *  with the old settings), BT_EVENT_CONFIG_FAILED is broadcast and hc05GetShadow shows it.
+ *
+ *  AT commands of other threads wait until the module is up.
+ *
  * \param[in] instance A BluetoothDriver object
  * \param[in] config A BluetoothConfig the use
  * \return EXIT_SUCCESS or EXIT_FAILURE
  */
 int hc05open(struct BluetoothDriver *instance, struct  BluetoothConfig *config){
 
+    int synced;
+
     if(!instance || !config || !(config->myhc05config))
         return EXIT_FAILURE;
 
+    //the AT commands of other threads (the shell while btOpenAsync runs) wait for the bring-up
+    chMtxLock(&hc05LinkMutex);
+
     //flag
-    hc05CurrentState = st_initializing;
+    hc05_setstate(st_initializing);
     // set config location
     instance->config = config;
     //set up the key and reset pins... using external functions
@@ -292,16 +2847,39 @@ int hc05open(struct BluetoothDriver *instance, struct  BluetoothConfig *config){
     //set up the RX and TX pins
     hc05_settxpin(config);
     hc05_setrxpin(config);
+    //connection tracking
+    hc05_setstatepin(instance);
 
     //serial driver
     hc05_updateserialconfig(config);
     hc05_startserial(config);
-
-    //flag
-    hc05CurrentState = st_ready_communication;
-
-    //return to communication mode
-    hc05SetModeComm(config, 200);
+    //for the readers that work on the ring directly, see btLineFeedDriver
+    instance->btInputQueue = &config->myhc05config->hc05serialpointer->iqueue;
+    instance->btOutputQueue = &config->myhc05config->hc05serialpointer->oqueue;
+
+    //apply name/pin/bit rate/role, only the ones that differ from the module
+    synced = hc05_syncconfig(instance, 0);
+
+    //return to communication mode, unless the sync already did
+    if (!hc05Shadow.queried)
+        hc05_setmodecomm(config);
+
+    chMtxUnlock();
+
+    //the module still carries data, but the caller must know it has not got its settings
+    if (synced != EXIT_SUCCESS)
+        chEvtBroadcastFlags(&instance->eventSource, BT_EVENT_CONFIG_FAILED);
+
+    //sniff power policy, it needs the fast AT mode to keep the link
+    hc05SniffParamsSet = 0;
+    hc05SniffAddressKnown = 0;
+    hc05PowerStats.sniffing = 0;
+    hc05PowerStats.unsupported = 0;
+    hc05SniffFailures = 0;
+    hc05LastActivity = chTimeNow();
+    if (config->myhc05config->fastatmode && !hc05PowerThreadTp)
+        hc05PowerThreadTp = chThdCreateStatic(hc05PowerThreadWa, sizeof(hc05PowerThreadWa),
+                                              NORMALPRIO, hc05_powerthread, instance);
 
     return EXIT_SUCCESS;
 }
@@ -319,11 +2897,39 @@ int hc05close(struct BluetoothDriver *instance){
     if(!instance)
         return EXIT_FAILURE;
 
+    //abandon a running mode switch, its waiters give up
+    chSysLock();
+    if (chVTIsArmedI(&hc05SwitchTimer))
+        chVTResetI(&hc05SwitchTimer);
+    hc05Switch.step = sw_idle;
+    chEvtBroadcastFlagsI(&hc05StateEventSource, HC05_STATE_FLAG(hc05CurrentState));
+    chSchRescheduleS();
+    chSysUnlock();
+
+    //stop the link managers before the module goes away
+    hc05AutoConnectStop();
+    hc05stopReflector(instance);
+    if (hc05PowerThreadTp) {
+        chThdTerminate(hc05PowerThreadTp);
+        chThdWait(hc05PowerThreadTp);
+        hc05PowerThreadTp = NULL;
+    }
+
+    //no more connection events
+    if (instance->config && instance->config->myhc05config && instance->config->myhc05config->usestatepin)
+        extChannelDisable(&EXTD1, instance->config->myhc05config->statepin);
+    hc05LinkDriver = NULL;
+    hc05LinkUp = 0;
+
     //flag --> threads will stop
-    hc05CurrentState = st_shutting_down;
+    hc05_setstate(st_shutting_down);
     chThdSleepMilliseconds(100);
     //stop serial driver
     hc05_stopserial(instance->config);
+    instance->btInputQueue = NULL;
+    instance->btOutputQueue = NULL;
+
+    hc05_setstate(st_unknown);
 
     return EXIT_SUCCESS;
 }
@@ -344,7 +2950,12 @@ struct BluetoothDeviceVMT hc05BtDevVMT = {
     .setName = hc05setName,
     .open = hc05open,
     .close = hc05close,
-    .resetModuleSettings = hc05resetDefaults
+    .resetModuleSettings = hc05resetDefaults,
+    .isConnected = hc05isConnected,
+    .writeTimeout = hc05writeTimeout,
+    .readTimeout = hc05readTimeout,
+    .startReflector = hc05startReflector,
+    .stopReflector = hc05stopReflector
 };
 
 /*===========================================================================*/
@@ -734,6 +3345,48 @@ int hc05_setkeypin(struct BluetoothConfig *config){
     return EXIT_SUCCESS;
 }
 
+/*!
+ * \brief Sets up the STATE pin and its EXT interrupt
+ *
+ *  EXTD1 is started with an empty configuration if the application did not start it.
+ *
+ * \param[in] instance A BluetoothDriver object, its config must be set
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05_setstatepin(struct BluetoothDriver *instance){
+
+    struct hc05_config_t *hc05config;
+    EXTChannelConfig channelconfig;
+    ioportid_t port;
+
+    if(!instance || !instance->config || !(instance->config->myhc05config))
+        return EXIT_FAILURE;
+
+    hc05config = instance->config->myhc05config;
+    if (!hc05config->usestatepin)
+        return EXIT_SUCCESS;
+
+    port = hc05_gpioport(hc05config->stateport);
+    if (!port || hc05config->statepin < 0 || hc05config->statepin > 15)
+        return EXIT_FAILURE;
+
+    palSetPadMode(port, hc05config->statepin, PAL_MODE_INPUT_PULLDOWN);
+
+    hc05LinkDriver = instance;
+    hc05LinkUp = palReadPad(port, hc05config->statepin) ? 1 : 0;
+
+    if (EXTD1.state != EXT_ACTIVE)
+        extStart(&EXTD1, &hc05ExtConfig);
+
+    //hc05_port_t counts the ports the same way as EXT_MODE_GPIOx
+    channelconfig.mode = EXT_CH_MODE_BOTH_EDGES | EXT_CH_MODE_AUTOSTART |
+                         (((uint32_t)hc05config->stateport) << EXT_MODE_GPIO_OFF);
+    channelconfig.cb = hc05_statepincb;
+    extSetChannelMode(&EXTD1, hc05config->statepin, &channelconfig);
+
+    return EXIT_SUCCESS;
+}
+
 /*!
  * \brief Updates the SerialConfig from the BluetoothConfig (change of baud rate)
  *
@@ -746,36 +3399,7 @@ int hc05_updateserialconfig(struct BluetoothConfig *config){
     if(!config || !(config->myhc05config))
         return EXIT_FAILURE;
 
-    switch (config->baudrate) {
-
-        case b1200:
-            hc05SerialConfig.speed = 1200;
-            break;
-        case b2400:
-            hc05SerialConfig.speed = 2400;
-            break;
-        case b4800:
-            hc05SerialConfig.speed = 4800;
-            break;
-        case b9600:
-            hc05SerialConfig.speed = 9600;
-            break;
-        case b19200:
-            hc05SerialConfig.speed = 19200;
-            break;
-        case b38400:
-            hc05SerialConfig.speed = 38400;
-            break;
-        case b57600:
-            hc05SerialConfig.speed = 57600;
-            break;
-        case b115200:
-            hc05SerialConfig.speed = 115200;
-            break;
-        default:
-            hc05SerialConfig.speed = BLUETOOTH_DEFAULT_BITRATE;
-            break;
-    }
+    hc05SerialConfig.speed = hc05_bitratevalue(config->baudrate);
 
     return EXIT_SUCCESS;
 }
@@ -884,123 +3508,151 @@ int hc05_stopserial(struct BluetoothConfig *config){
 }
 
 /*!
- * \brief Enters HC05 to AT command mode
+ * \brief Starts switching the HC05 to AT command mode
+ *
+ *  Returns at once, the switch is done by a virtual timer. The state is st_initializing
+ *  until it is done, then st_ready_at_command. See hc05WaitState.
+ *
+ * \param[in] config A BluetoothConfig object
+ * \param[in] timeout Time to wait after each pin change in milliseconds, 0 to use the learned timing
+ */
+void hc05RequestModeAt(struct BluetoothConfig *config, uint16_t timeout){
+
+    if(!config || !config->myhc05config)
+        return;
+
+    if (timeout)
+        hc05_startswitch(config->myhc05config, st_ready_at_command, timeout, timeout, timeout, 0);
+    else
+        hc05_startswitch(config->myhc05config, st_ready_at_command,
+                         hc05Timing.keysettlems, hc05Timing.resetpulsems, hc05Timing.bootms, 0);
+}
+
+/*!
+ * \brief Starts switching the HC05 to communication mode
  *
+ *  Returns at once, the switch is done by a virtual timer. The state is st_initializing
+ *  until it is done, then st_ready_communication. See hc05WaitState.
  *
  * \param[in] config A BluetoothConfig object
- * \param[in] timeout Time to wait in milliseconds
+ * \param[in] timeout Time to wait after each pin change in milliseconds, 0 to use the learned timing
  */
-void hc05SetModeAt(struct BluetoothConfig *config, uint16_t timeout){
+void hc05RequestModeComm(struct BluetoothConfig *config, uint16_t timeout){
 
-    if(!config)
+    if(!config || !config->myhc05config)
         return;
 
-    //reset module (low), pull key high
+    if (timeout)
+        hc05_startswitch(config->myhc05config, st_ready_communication, timeout, timeout, timeout, 0);
+    else
+        hc05_startswitch(config->myhc05config, st_ready_communication,
+                         hc05Timing.keysettlems, hc05Timing.resetpulsems, hc05Timing.bootms, 0);
+}
+
+/*!
+ * \brief Enters HC05 to AT command mode
+ *
+ *  Blocking version of hc05RequestModeAt, waits until the switch ends. Waits for the AT
+ *  transactions of the other threads first.
+ *
+ * \param[in] config A BluetoothConfig object
+ * \param[in] timeout Time to wait in milliseconds, 0 to use the learned timing
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the switch was abandoned or did not end in time
+ */
+int hc05SetModeAt(struct BluetoothConfig *config, uint16_t timeout){
 
-    palSetPad((((config->myhc05config->keyport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->keyport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->keyport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->keyport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->keyport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->keyport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->keyport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->keyport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->keypin));
+    int retval;
 
+    if(!config || !config->myhc05config)
+        return EXIT_FAILURE;
 
-    chThdSleepMilliseconds(timeout);
+    chMtxLock(&hc05LinkMutex);
+    hc05RequestModeAt(config, timeout);
+    //we should be in AT mode, with 38400 baud
+    retval = hc05_waitswitch(st_ready_at_command);
+    chMtxUnlock();
 
+    return retval;
+}
 
-    palClearPad((((config->myhc05config->resetport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->resetport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->resetport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->resetport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->resetport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->resetport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->resetport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->resetport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->resetpin));
 
+/*!
+ * \brief Enters HC05 to communication mode
+ *
+ *  Blocking version of hc05RequestModeComm, waits until the switch ends. Waits for the AT
+ *  transactions of the other threads first.
+ *
+ * \param[in] config A BluetoothConfig object
+ * \param[in] timeout Time to wait in milliseconds, 0 to use the learned timing
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the switch was abandoned or did not end in time
+ */
+int hc05SetModeComm(struct BluetoothConfig *config, uint16_t timeout){
 
+    int retval;
 
-    chThdSleepMilliseconds(timeout);   //wait for reset
+    if(!config || !config->myhc05config)
+        return EXIT_FAILURE;
 
-    palSetPad((((config->myhc05config->resetport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->resetport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->resetport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->resetport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->resetport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->resetport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->resetport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->resetport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->resetpin));
+    chMtxLock(&hc05LinkMutex);
+    hc05RequestModeComm(config, timeout);
+    retval = hc05_waitswitch(st_ready_communication);
+    chMtxUnlock();
 
+    return retval;
+}
 
-    chThdSleepMilliseconds(timeout);   //wait for module recovery
-    //we should be in AT mode, with 38400 baud
-    hc05CurrentState = st_ready_at_command;
-};
+/*!
+ * \brief Returns the current state of the module
+ *
+ * \return the state
+ */
+enum hc05_state_t hc05GetState(void){
 
+    return hc05CurrentState;
+}
 
 /*!
- * \brief Enters HC05 to communication mode
+ * \brief Returns the event source the state changes are broadcast on
  *
+ *  The flags of the listener are HC05_STATE_FLAG(new state).
  *
- * \param[in] config A BluetoothConfig object
- * \param[in] timeout Time to wait in milliseconds
+ * \return the event source
  */
-void hc05SetModeComm(struct BluetoothConfig *config, uint16_t timeout){
+EventSource *hc05GetStateEventSource(void){
 
-    if(!config)
-        return;
+    return &hc05StateEventSource;
+}
 
-    //reset module (low), pull key low
-    palClearPad((((config->myhc05config->keyport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->keyport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->keyport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->keyport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->keyport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->keyport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->keyport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->keyport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->keypin));
-
-    chThdSleepMilliseconds(timeout);
-
-
-    palClearPad((((config->myhc05config->resetport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->resetport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->resetport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->resetport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->resetport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->resetport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->resetport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->resetport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->resetpin));
-
-
-    chThdSleepMilliseconds(timeout);   //wait for reset
-
-    palSetPad((((config->myhc05config->resetport) == gpioa_port) ? GPIOA :
-              ((config->myhc05config->resetport) == gpiob_port) ? GPIOB :
-              ((config->myhc05config->resetport) == gpioc_port) ? GPIOC :
-              ((config->myhc05config->resetport) == gpiod_port) ? GPIOD :
-              ((config->myhc05config->resetport) == gpioe_port) ? GPIOE :
-              ((config->myhc05config->resetport) == gpiof_port) ? GPIOF :
-              ((config->myhc05config->resetport) == gpiog_port) ? GPIOG :
-              ((config->myhc05config->resetport) == gpioh_port) ? GPIOH :
-              NULL),
-              (config->myhc05config->resetpin));
-
-
-    chThdSleepMilliseconds(timeout);   //wait for module recovery
-    hc05CurrentState = st_ready_communication;
-};
+/*!
+ * \brief Waits until the module reaches the given state
+ *
+ * \param[in] state The state to wait for
+ * \param[in] timeout Maximum time to wait, TIME_INFINITE to wait forever
+ * \return EXIT_SUCCESS if the state was reached, EXIT_FAILURE on timeout
+ */
+int hc05WaitState(enum hc05_state_t state, systime_t timeout){
+
+    EventListener listener;
+    systime_t start = chTimeNow();
+
+    chEvtRegisterMask(&hc05StateEventSource, &listener, EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    //register first, then check, so the change can not slip through between the two
+    while (hc05CurrentState != state) {
+        systime_t elapsed = chTimeElapsedSince(start);
+
+        if (timeout != TIME_INFINITE && elapsed >= timeout)
+            break;
+
+        chEvtWaitAnyTimeout(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID),
+                            timeout == TIME_INFINITE ? TIME_INFINITE : timeout - elapsed);
+    }
+
+    chEvtUnregister(&hc05StateEventSource, &listener);
+    chEvtGetAndClearEvents(EVENT_MASK(BLUETOOTH_WAIT_EVENT_ID));
+
+    return hc05CurrentState == state ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 #endif //HAL_USE_HC_05_BLUETOOTH || defined(__DOXYGEN__)
  /** @} */
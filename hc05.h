@@ -19,6 +19,247 @@
 
 #if HAL_USE_HC_05_BLUETOOTH || defined(__DOXYGEN__) || 1
 
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @name    HC-05 configuration options
+ * @{
+ */
+/**
+ * @brief   Maximum length of one AT response line.
+ * @details Configuration parameter, longer lines are truncated (the terminator is still detected).
+ */
+#if !defined(HC05_AT_LINE_LENGTH) || defined(__DOXYGEN__)
+#define HC05_AT_LINE_LENGTH 64
+#endif
+/**
+ * @brief   Maximum length of the key in a "+KEY:value" response line.
+ */
+#if !defined(HC05_AT_KEY_LENGTH) || defined(__DOXYGEN__)
+#define HC05_AT_KEY_LENGTH 16
+#endif
+/**
+ * @brief   Default AT command timeout.
+ * @details Configuration parameter, the time in milliseconds we wait for the terminating
+ *          "OK" / "ERROR:(n)" / "FAIL" line of an AT command. The transaction returns as
+ *          soon as the terminating line arrives, this is only the upper bound.
+ */
+#if !defined(HC05_AT_DEFAULT_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define HC05_AT_DEFAULT_TIMEOUT_MS 1000
+#endif
+/**
+ * @brief   Maximum length of an AT command.
+ * @details Configuration parameter, the longest command (without "\r\n") that can be queued
+ *          in an AT session.
+ */
+#if !defined(HC05_AT_COMMAND_LENGTH) || defined(__DOXYGEN__)
+#define HC05_AT_COMMAND_LENGTH 48
+#endif
+/**
+ * @brief   Maximum number of commands in an AT session.
+ */
+#if !defined(HC05_AT_SESSION_MAX_COMMANDS) || defined(__DOXYGEN__)
+#define HC05_AT_SESSION_MAX_COMMANDS 8
+#endif
+/**
+ * @brief   Maximum number of AT commands in flight.
+ * @details Configuration parameter, this many commands can be sent before the answer of the
+ *          first one arrives. 1 means strict request/response.
+ */
+#if !defined(HC05_AT_PIPELINE_DEPTH) || defined(__DOXYGEN__)
+#define HC05_AT_PIPELINE_DEPTH 4
+#endif
+/**
+ * @brief   Settle time of the key pin before a fast AT mode entry is probed, in milliseconds.
+ */
+#if !defined(HC05_FAST_AT_SETTLE_MS) || defined(__DOXYGEN__)
+#define HC05_FAST_AT_SETTLE_MS 10
+#endif
+/**
+ * @brief   Timeout of the "AT" probe after a fast AT mode entry, in milliseconds.
+ * @details Configuration parameter, if the module does not answer in time, we fall back to the reset.
+ */
+#if !defined(HC05_FAST_AT_PROBE_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define HC05_FAST_AT_PROBE_TIMEOUT_MS 200
+#endif
+/**
+ * @brief   Settle time of the key pin before the module is reset, in milliseconds.
+ */
+#if !defined(HC05_KEY_SETTLE_MS) || defined(__DOXYGEN__)
+#define HC05_KEY_SETTLE_MS 10
+#endif
+/**
+ * @brief   Length of the reset pulse, in milliseconds.
+ */
+#if !defined(HC05_RESET_PULSE_MS) || defined(__DOXYGEN__)
+#define HC05_RESET_PULSE_MS 10
+#endif
+/**
+ * @brief   Boot time assumed until the first calibration, in milliseconds.
+ * @details Only used by switches to communication mode before the driver could measure it.
+ */
+#if !defined(HC05_BOOT_DEFAULT_MS) || defined(__DOXYGEN__)
+#define HC05_BOOT_DEFAULT_MS 700
+#endif
+/**
+ * @brief   Longest boot time the calibration waits for, in milliseconds.
+ */
+#if !defined(HC05_BOOT_MAX_MS) || defined(__DOXYGEN__)
+#define HC05_BOOT_MAX_MS 2000
+#endif
+/**
+ * @brief   Timeout of one "AT" probe while the module boots, in milliseconds.
+ */
+#if !defined(HC05_BOOT_PROBE_MS) || defined(__DOXYGEN__)
+#define HC05_BOOT_PROBE_MS 20
+#endif
+/**
+ * @brief   Added to the measured boot time when it is reused without probing, in milliseconds.
+ */
+#if !defined(HC05_BOOT_MARGIN_MS) || defined(__DOXYGEN__)
+#define HC05_BOOT_MARGIN_MS 20
+#endif
+/**
+ * @brief   Added to the planned length of a mode switch before its waiters give up, in milliseconds.
+ * @details The switch is driven by a virtual timer, this only bounds the wait if it never ends.
+ */
+#if !defined(HC05_SWITCH_MARGIN_MS) || defined(__DOXYGEN__)
+#define HC05_SWITCH_MARGIN_MS 500
+#endif
+/**
+ * @brief   Keep a fingerprint of the applied module configuration in MCU flash.
+ * @details Configuration parameter, when TRUE a warm boot with an unchanged BluetoothConfig
+ *          skips the AT configuration queries completely. The fingerprint sector must not
+ *          be used by the firmware image.
+ */
+#if !defined(HC05_USE_FLASH_FINGERPRINT) || defined(__DOXYGEN__)
+#define HC05_USE_FLASH_FINGERPRINT FALSE
+#endif
+/**
+ * @brief   Flash sector number holding the configuration fingerprints.
+ */
+#if !defined(HC05_FINGERPRINT_FLASH_SECTOR) || defined(__DOXYGEN__)
+#define HC05_FINGERPRINT_FLASH_SECTOR 11
+#endif
+/**
+ * @brief   Start address of the fingerprint flash sector.
+ */
+#if !defined(HC05_FINGERPRINT_FLASH_ADDRESS) || defined(__DOXYGEN__)
+#define HC05_FINGERPRINT_FLASH_ADDRESS 0x080E0000
+#endif
+/**
+ * @brief   Size of the fingerprint flash sector in bytes.
+ */
+#if !defined(HC05_FINGERPRINT_FLASH_SIZE) || defined(__DOXYGEN__)
+#define HC05_FINGERPRINT_FLASH_SIZE 0x20000
+#endif
+/**
+ * @brief   Drop the data sent while no remote device is connected.
+ * @details Configuration parameter, when FALSE the senders wait up to HC05_LINK_WAIT_MS for a
+ *          connection instead. Only used when the STATE pin is wired (usestatepin).
+ */
+#if !defined(HC05_TX_DROP_WHEN_DISCONNECTED) || defined(__DOXYGEN__)
+#define HC05_TX_DROP_WHEN_DISCONNECTED TRUE
+#endif
+/**
+ * @brief   Longest time a sender waits for a connection, in milliseconds.
+ */
+#if !defined(HC05_LINK_WAIT_MS) || defined(__DOXYGEN__)
+#define HC05_LINK_WAIT_MS 1000
+#endif
+/**
+ * @brief   Stack size of the sniff power policy thread.
+ */
+#if !defined(HC05_POWER_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define HC05_POWER_THREAD_STACK_SIZE 512
+#endif
+/**
+ * @brief   How often the power policy looks at the traffic, in milliseconds.
+ */
+#if !defined(HC05_POWER_POLL_MS) || defined(__DOXYGEN__)
+#define HC05_POWER_POLL_MS 100
+#endif
+/**
+ * @brief   Sniff parameters written with AT+SNIFF, in 0.625 ms slots.
+ * @details Max and min interval, attempt and timeout. The defaults wake the link about every 0.5-1 s.
+ */
+#if !defined(HC05_SNIFF_MAX_INTERVAL) || defined(__DOXYGEN__)
+#define HC05_SNIFF_MAX_INTERVAL 1600
+#endif
+#if !defined(HC05_SNIFF_MIN_INTERVAL) || defined(__DOXYGEN__)
+#define HC05_SNIFF_MIN_INTERVAL 800
+#endif
+#if !defined(HC05_SNIFF_ATTEMPT) || defined(__DOXYGEN__)
+#define HC05_SNIFF_ATTEMPT 4
+#endif
+#if !defined(HC05_SNIFF_TIMEOUT) || defined(__DOXYGEN__)
+#define HC05_SNIFF_TIMEOUT 1
+#endif
+/**
+ * @brief   Failed sniff entries in a row after which the policy is switched off.
+ * @details A failed entry is tried again after the next sniffidlems without traffic.
+ */
+#if !defined(HC05_SNIFF_MAX_FAILURES) || defined(__DOXYGEN__)
+#define HC05_SNIFF_MAX_FAILURES 3
+#endif
+/**
+ * @brief   Size of the discovered device table of the inquiry.
+ */
+#if !defined(HC05_INQUIRY_MAX_DEVICES) || defined(__DOXYGEN__)
+#define HC05_INQUIRY_MAX_DEVICES 8
+#endif
+/**
+ * @brief   Stack size of the auto-connect thread.
+ */
+#if !defined(HC05_AUTOCONNECT_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define HC05_AUTOCONNECT_THREAD_STACK_SIZE 768
+#endif
+/**
+ * @brief   First and longest delay between two connection attempts, in milliseconds.
+ */
+#if !defined(HC05_BACKOFF_MIN_MS) || defined(__DOXYGEN__)
+#define HC05_BACKOFF_MIN_MS 500
+#endif
+#if !defined(HC05_BACKOFF_MAX_MS) || defined(__DOXYGEN__)
+#define HC05_BACKOFF_MAX_MS 30000
+#endif
+/**
+ * @brief   Time one connection attempt may take, in milliseconds.
+ */
+#if !defined(HC05_LINK_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define HC05_LINK_TIMEOUT_MS 10000
+#endif
+/**
+ * @brief   Time AT+LINK may keep the module in AT mode, in milliseconds.
+ * @details The senders and the other AT users wait for it. A page still running then is cut by
+ *          a restart, after which the module pages the bound device by itself.
+ */
+#if !defined(HC05_LINK_AT_TIMEOUT_MS) || defined(__DOXYGEN__)
+#define HC05_LINK_AT_TIMEOUT_MS 2000
+#endif
+/**
+ * @brief   How often the link is checked with AT+STATE? when the STATE pin is not wired, in milliseconds.
+ */
+#if !defined(HC05_AUTOCONNECT_POLL_MS) || defined(__DOXYGEN__)
+#define HC05_AUTOCONNECT_POLL_MS 5000
+#endif
+/**
+ * @brief   Stack size of the reflector thread.
+ */
+#if !defined(HC05_REFLECTOR_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define HC05_REFLECTOR_THREAD_STACK_SIZE 256
+#endif
+/**
+ * @brief   Longest sleep of the reflector, in milliseconds.
+ * @details Arriving data and a drained output queue wake it earlier.
+ */
+#if !defined(HC05_REFLECTOR_POLL_MS) || defined(__DOXYGEN__)
+#define HC05_REFLECTOR_POLL_MS 10
+#endif
+/** @} */
+
 
 /**
  * @brief SerialDrivers that can be used by the HC-05
@@ -34,6 +275,8 @@ enum hc05_seriald_t{
 
 /**
  * @brief Possible states of the HC-05 module
+ *
+ *  st_initializing is also the state while a mode switch is in progress.
  */
 enum hc05_state_t{
     st_unknown = 0,
@@ -43,6 +286,198 @@ enum hc05_state_t{
     st_shutting_down = 4
 };
 
+/**
+ * @brief Event flag broadcast when the module enters the given hc05_state_t
+ */
+#define HC05_STATE_FLAG(state) ((flagsmask_t)1 << (state))
+
+
+/**
+ * @brief Outcome of an AT command transaction
+ */
+enum hc05_at_status_t{
+    at_ok = 0,          //"OK" received
+    at_error = 1,       //"ERROR:(n)" received, see errorcode
+    at_fail = 2,        //"FAIL" received (e.g. pairing or linking failed)
+    at_timeout = 3      //no terminating line before the timeout
+};
+
+/**
+ * @brief Parsed response of an AT command transaction
+ *
+ *  Queries answer with one or more "+KEY:value" lines before the final "OK".
+ *  The first one is kept in key/value, the rest are only counted.
+ */
+struct hc05_at_result_t{
+    enum hc05_at_status_t status;
+    int errorcode;                          //code of "ERROR:(n)", -1 if there was none
+    int infolines;                          //number of "+KEY:value" lines received
+    char key[HC05_AT_KEY_LENGTH+1];         //key of the first "+KEY:value" line, without the '+'
+    char value[HC05_AT_LINE_LENGTH+1];      //value of the first "+KEY:value" line
+    uint32_t elapsedms;                     //time from sending the command to the terminating line
+};
+
+/**
+ * @brief Completion callback of a pipelined AT command
+ *
+ *  Called from the thread that submits or flushes the pipeline, in submission order.
+ */
+typedef void (*hc05_at_callback_t)(struct hc05_at_result_t *result, void *arg);
+
+/**
+ * @brief Last known configuration of the module
+ *
+ *  Filled by hc05SyncConfig from the answers of the module (or from the BluetoothConfig, when the
+ *  flash fingerprint shows it has already been applied). Direct AT writes invalidate it.
+ */
+struct hc05_shadow_t{
+    int valid;
+    char name[BLUETOOTH_MAX_NAME_LENGTH+1];
+    char pincode[BLUETOOTH_MAX_PINCODE_LENGTH+1];
+    uint32_t baudrate;
+    int role;
+    int writes;             //number of settings written by the last sync
+    int queried;            //1 if the last sync had to ask the module
+    int failed;             //1 if the last sync could not apply the configuration
+};
+
+/**
+ * @brief Latency of the AT mode switches
+ *
+ *  Fast switches only toggle the key pin, reset switches restart the module.
+ *  A fallback is a fast entry the module did not answer, followed by a reset entry.
+ */
+struct hc05_modeswitch_stats_t{
+    uint32_t fastcount;
+    uint32_t resetcount;
+    uint32_t fallbackcount;
+    uint32_t lastfastenterms;
+    uint32_t lastfastleavems;
+    uint32_t lastresetenterms;
+    uint32_t lastresetleavems;
+    uint32_t maxfastenterms;
+    uint32_t maxresetenterms;
+};
+
+/**
+ * @brief Timing of the reset mode switches, learned from the module
+ *
+ *  bootms is the time from the release of the reset until the module answers "AT".
+ */
+struct hc05_timing_t{
+    uint32_t keysettlems;
+    uint32_t resetpulsems;
+    uint32_t bootms;
+    uint32_t lastbootms;
+    uint32_t calibrations;
+    uint32_t failures;
+    int calibrated;
+};
+
+/**
+ * @brief Connection statistics, from the STATE pin
+ *
+ *  droppedbytes were refused because no device was connected,
+ *  flushedbytes were still in the output queue at a disconnect.
+ */
+struct hc05_link_stats_t{
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t droppedbytes;
+    uint32_t flushedbytes;
+    systime_t lastchange;
+};
+
+/**
+ * @brief Sniff power policy statistics
+ *
+ *  A wakeup is a sniff exit because of traffic, wakems is the time the first byte
+ *  waited for it (the latency cost of the sniff mode).
+ */
+struct hc05_power_stats_t{
+    int sniffing;
+    int unsupported;            //no fast AT mode or too many failures, the policy is off
+    uint32_t entries;
+    uint32_t wakeups;
+    uint32_t failures;
+    uint32_t sniffms;           //total time spent in sniff mode
+    uint32_t lastwakems;
+    uint32_t maxwakems;
+    uint32_t totalwakems;
+};
+
+/**
+ * @brief Length of a Bluetooth address as text, "NAP:UAP:LAP" in hexadecimal, with the '\\0'
+ */
+#define HC05_ADDRESS_TEXT_LENGTH 15
+
+/**
+ * @brief Bluetooth device address, split the way the HC-05 prints it
+ */
+struct hc05_bdaddr_t{
+    uint16_t nap;
+    uint8_t uap;
+    uint32_t lap;               //24 bits
+};
+
+/**
+ * @brief A device found by the inquiry
+ */
+struct hc05_inquiry_device_t{
+    struct hc05_bdaddr_t address;
+    uint32_t deviceclass;
+    int16_t rssi;               //of the last answer, dBm
+    uint16_t answers;           //answers of this device during the inquiry
+    uint32_t foundms;           //time of the first answer, from the start of the inquiry
+};
+
+/**
+ * @brief Devices found by the last inquiry, each address only once
+ */
+struct hc05_inquiry_t{
+    int count;
+    int missed;                 //new devices that did not fit in the table
+    int stopped;                //the callback stopped the inquiry
+    struct hc05_inquiry_device_t devices[HC05_INQUIRY_MAX_DEVICES];
+};
+
+/**
+ * @brief Called for every new device while the inquiry runs
+ *
+ *  Runs in the thread of hc05Inquiry, with the module in AT mode and the AT transactions of
+ *  the other threads held off, so it must not run AT commands or send data itself.
+ *  Returning nonzero stops the inquiry (AT+INQC).
+ */
+typedef int (*hc05_inquiry_callback_t)(const struct hc05_inquiry_device_t *device, void *arg);
+
+/**
+ * @brief Auto-connect statistics
+ *
+ *  connectms is the time to (re)connect, from the start or a link drop.
+ */
+struct hc05_autoconnect_stats_t{
+    uint32_t attempts;
+    uint32_t failures;
+    uint32_t connects;
+    uint32_t drops;
+    uint32_t backoffms;         //current delay before the next attempt, 0 while connected
+    uint32_t lastconnectms;
+    uint32_t maxconnectms;
+    uint32_t totalconnectms;
+};
+
+/**
+ * @brief Reflector statistics
+ *
+ *  A burst is what one pass moved, a stall is a pass that left data behind for a full output queue.
+ */
+struct hc05_reflector_stats_t{
+    int running;
+    uint32_t bytes;
+    uint32_t bursts;
+    uint32_t maxburst;
+    uint32_t stalls;
+};
 
 /**
  * @brief GPIO ports that can be used
@@ -87,6 +522,12 @@ struct hc05_config_t {
     int keypin;
     enum hc05_seriald_t serialdriver;
     SerialDriver *hc05serialpointer;
+    int role;                   //0: slave, 1: master, 2: slave-loop (AT+ROLE)
+    int fastatmode;             //nonzero: the module accepts AT commands while key is held high, without a reset
+    enum hc05_port_t stateport;
+    int statepin;               //STATE output of the module, high while a device is connected
+    int usestatepin;            //nonzero: the STATE pin is wired, the line of statepin must be free in EXTD1
+    int sniffidlems;            //nonzero: sniff after this long without traffic, needs fastatmode
 };
 
 #ifdef __cplusplus
@@ -96,7 +537,39 @@ extern "C" {
     int hc05sendByte(struct BluetoothDriver *instance, int mybyte);
     int hc05canRecieve(struct BluetoothDriver *instance);
     int hc05readBuffer(struct BluetoothDriver *instance, char *buffer, int maxlength);
+    int hc05writeTimeout(struct BluetoothDriver *instance, const char *buffer, int bufferlength, systime_t timeout);
+    int hc05readTimeout(struct BluetoothDriver *instance, char *buffer, int maxlength, systime_t timeout);
     int hc05sendAtCommand(struct BluetoothDriver *instance, char* command);
+    int hc05executeAtCommand(struct BluetoothDriver *instance, const char *command,
+                             struct hc05_at_result_t *result, uint16_t timeoutms);
+    int hc05atTransaction(struct BluetoothDriver *instance, const char *command,
+                          struct hc05_at_result_t *result, uint16_t timeoutms);
+    int hc05AtSubmit(struct BluetoothDriver *instance, const char *command,
+                     hc05_at_callback_t callback, void *arg, uint16_t timeoutms);
+    int hc05AtFlush(struct BluetoothDriver *instance);
+    int hc05AtBegin(struct BluetoothDriver *instance);
+    int hc05AtQueue(struct BluetoothDriver *instance, const char *command);
+    int hc05AtCommit(struct BluetoothDriver *instance, int *failedindex);
+    void hc05AtAbort(struct BluetoothDriver *instance);
+    const struct hc05_modeswitch_stats_t *hc05GetModeSwitchStats(void);
+    int hc05SyncConfig(struct BluetoothDriver *instance, int force);
+    const struct hc05_shadow_t *hc05GetShadow(void);
+    const struct hc05_timing_t *hc05GetTiming(void);
+    int hc05isConnected(struct BluetoothDriver *instance);
+    const struct hc05_link_stats_t *hc05GetLinkStats(void);
+    const struct hc05_power_stats_t *hc05GetPowerStats(void);
+    int hc05ParseAddress(const char *text, struct hc05_bdaddr_t *address);
+    void hc05FormatAddress(const struct hc05_bdaddr_t *address, char *text, char separator);
+    int hc05Inquiry(struct BluetoothDriver *instance, int maxdevices, int timeout,
+                    hc05_inquiry_callback_t callback, void *arg);
+    const struct hc05_inquiry_t *hc05GetInquiryResults(void);
+    int hc05AutoConnectStart(struct BluetoothDriver *instance, const struct hc05_bdaddr_t *address);
+    void hc05AutoConnectStop(void);
+    const struct hc05_autoconnect_stats_t *hc05GetAutoConnectStats(void);
+    int hc05startReflector(struct BluetoothDriver *instance);
+    int hc05stopReflector(struct BluetoothDriver *instance);
+    const struct hc05_reflector_stats_t *hc05GetReflectorStats(void);
+    void hc05ResetTiming(void);
     int hc05setPinCode(struct BluetoothDriver *instance, char *pin, int pinlength);
     int hc05setName(struct BluetoothDriver *instance, char *newname, int namelength);
     int hc05resetDefaults(struct BluetoothDriver *instance);
@@ -108,11 +581,17 @@ extern "C" {
     int hc05_setctspin(struct BluetoothConfig *config);
     int hc05_setresetpin(struct BluetoothConfig *config);
     int hc05_setkeypin(struct BluetoothConfig *config);
+    int hc05_setstatepin(struct BluetoothDriver *instance);
     int hc05_updateserialconfig(struct BluetoothConfig *config);
     int hc05_startserial(struct BluetoothConfig *config);
     int hc05_stopserial(struct BluetoothConfig *config);
-    void hc05SetModeAt(struct BluetoothConfig *config, uint16_t timeout);
-    void hc05SetModeComm(struct BluetoothConfig *config, uint16_t timeout);
+    int hc05SetModeAt(struct BluetoothConfig *config, uint16_t timeout);
+    int hc05SetModeComm(struct BluetoothConfig *config, uint16_t timeout);
+    void hc05RequestModeAt(struct BluetoothConfig *config, uint16_t timeout);
+    void hc05RequestModeComm(struct BluetoothConfig *config, uint16_t timeout);
+    enum hc05_state_t hc05GetState(void);
+    EventSource *hc05GetStateEventSource(void);
+    int hc05WaitState(enum hc05_state_t state, systime_t timeout);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,480 @@
+/*!
+ * @file hc05at.c
+ * @brief Source file for the AT command catalog of the HC-05 SPP device for bluetooth module in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "bluetooth.h"
+#include "hc05.h"
+#include "hc05at.h"
+#include <string.h>
+#include <stdlib.h>
+
+#if HAL_USE_HC_05_BLUETOOTH || defined(__DOXYGEN__) || 1
+
+/*===========================================================================*/
+/* Driver exported variables.                                                */
+/*===========================================================================*/
+
+/**
+ * @brief The HC-05 AT command set, indexed by hc05_at_cmd_t
+ */
+const struct hc05_at_command_t hc05AtCatalog[hc05_at_count] = {
+    [hc05_at_test]    = {"",        hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_reset]   = {"RESET",   hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_version] = {"VERSION", hc05_op_get,                 NULL,   "",   "s",    0},
+    [hc05_at_orgl]    = {"ORGL",    hc05_op_exec,                NULL,   NULL, NULL,   hc05_op_exec},
+    [hc05_at_addr]    = {"ADDR",    hc05_op_get,                 NULL,   "",   "a",    0},
+    [hc05_at_name]    = {"NAME",    hc05_op_set | hc05_op_get,   "s",    "",   "s",    0},
+    [hc05_at_rname]   = {"RNAME",   hc05_op_get,                 NULL,   "a",  "s",    0},
+    [hc05_at_role]    = {"ROLE",    hc05_op_set | hc05_op_get,   "u",    "",   "u",    hc05_op_set},
+    [hc05_at_class]   = {"CLASS",   hc05_op_set | hc05_op_get,   "x",    "",   "x",    0},
+    [hc05_at_iac]     = {"IAC",     hc05_op_set | hc05_op_get,   "x",    "",   "x",    0},
+    [hc05_at_inqm]    = {"INQM",    hc05_op_set | hc05_op_get,   "uuu",  "",   "uuu",  0},
+    [hc05_at_pswd]    = {"PSWD",    hc05_op_set | hc05_op_get,   "s",    "",   "s",    0},
+    [hc05_at_uart]    = {"UART",    hc05_op_set | hc05_op_get,   "uuu",  "",   "uuu",  hc05_op_set},
+    [hc05_at_cmode]   = {"CMODE",   hc05_op_set | hc05_op_get,   "u",    "",   "u",    0},
+    [hc05_at_bind]    = {"BIND",    hc05_op_set | hc05_op_get,   "a",    "",   "a",    0},
+    [hc05_at_polar]   = {"POLAR",   hc05_op_set | hc05_op_get,   "uu",   "",   "uu",   0},
+    [hc05_at_pio]     = {"PIO",     hc05_op_set,                 "uu",   NULL, NULL,   0},
+    [hc05_at_mpio]    = {"MPIO",    hc05_op_set | hc05_op_get,   "x",    "",   "x",    0},
+    [hc05_at_ipscan]  = {"IPSCAN",  hc05_op_set | hc05_op_get,   "uuuu", "",   "uuuu", 0},
+    [hc05_at_sniff]   = {"SNIFF",   hc05_op_set | hc05_op_get,   "uuuu", "",   "uuuu", 0},
+    [hc05_at_senm]    = {"SENM",    hc05_op_set | hc05_op_get,   "uu",   "",   "uu",   0},
+    [hc05_at_pmsad]   = {"PMSAD",   hc05_op_set,                 "a",    NULL, NULL,   0},
+    [hc05_at_rmaad]   = {"RMAAD",   hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_fsad]    = {"FSAD",    hc05_op_set,                 "a",    NULL, NULL,   0},
+    [hc05_at_adcn]    = {"ADCN",    hc05_op_get,                 NULL,   "",   "u",    0},
+    [hc05_at_mrad]    = {"MRAD",    hc05_op_get,                 NULL,   "",   "a",    0},
+    [hc05_at_state]   = {"STATE",   hc05_op_get,                 NULL,   "",   "s",    0},
+    [hc05_at_init]    = {"INIT",    hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_inq]     = {"INQ",     hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_inqc]    = {"INQC",    hc05_op_exec,                NULL,   NULL, NULL,   0},
+    [hc05_at_pair]    = {"PAIR",    hc05_op_set,                 "au",   NULL, NULL,   0},
+    [hc05_at_link]    = {"LINK",    hc05_op_set,                 "a",    NULL, NULL,   0},
+    [hc05_at_disc]    = {"DISC",    hc05_op_exec,                NULL,   NULL, "s",    0},
+    [hc05_at_ensniff] = {"ENSNIFF", hc05_op_set,                 "a",    NULL, NULL,   0},
+    [hc05_at_exsniff] = {"EXSNIFF", hc05_op_set,                 "a",    NULL, NULL,   0}
+};
+
+/*===========================================================================*/
+/* Driver local variables.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief Names of hc05_module_state_t, as AT+STATE? prints them
+ */
+static const char * const hc05ModuleStateNames[] = {
+    "UNKNOWN", "INITIALIZED", "READY", "PAIRABLE", "PAIRED",
+    "INQUIRING", "CONNECTING", "CONNECTED", "DISCONNECTED"
+};
+
+/**
+ * @brief Answers that never change, asked once
+ */
+static struct {
+    int addressvalid;
+    struct hc05_bdaddr_t address;
+    int versionvalid;
+    char version[HC05_VERSION_LENGTH+1];
+} hc05AtCache;
+
+/*===========================================================================*/
+/* Local functions                                                           */
+/*===========================================================================*/
+
+/*!
+ * \brief Appends a string, if it fits
+ *
+ * \param[in,out] buffer The buffer, '\0' terminated
+ * \param[in] length Size of the buffer
+ * \param[in] text The string to append
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it did not fit
+ */
+static int hc05at_append(char *buffer, int length, const char *text){
+
+    int used = strlen(buffer);
+    int needed = strlen(text);
+
+    if (used + needed >= length)
+        return EXIT_FAILURE;
+
+    memcpy(buffer + used, text, needed + 1);
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Appends a number, if it fits
+ *
+ * \param[in,out] buffer The buffer, '\0' terminated
+ * \param[in] length Size of the buffer
+ * \param[in] value The number
+ * \param[in] base 10 or 16
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it did not fit
+ */
+static int hc05at_appendnumber(char *buffer, int length, uint32_t value, uint32_t base){
+
+    static const char hexdigits[] = "0123456789ABCDEF";
+    char digits[11];
+    int count = sizeof(digits) - 1;
+
+    digits[count] = '\0';
+    do {
+        digits[--count] = hexdigits[value % base];
+        value /= base;
+    } while (value);
+
+    return hc05at_append(buffer, length, digits + count);
+}
+
+/*===========================================================================*/
+/* Driver exported functions.                                                */
+/*===========================================================================*/
+
+/*!
+ * \brief Renders a command of the catalog
+ *
+ *  No heap is used, the command is written into the given buffer.
+ *
+ * \param[out] buffer The command, without the "\r\n"
+ * \param[in] length Size of the buffer
+ * \param[in] cmd The command
+ * \param[in] op The form of the command, must be supported by the catalog entry
+ * \param[in] params One value per character of the parameter format, may be NULL if there are none
+ * \return the length of the command or -1 if the form is not supported or it did not fit
+ */
+int hc05AtRender(char *buffer, int length, enum hc05_at_cmd_t cmd, enum hc05_at_op_t op,
+                 const union hc05_at_value_t *params){
+
+    const struct hc05_at_command_t *entry;
+    const char *format = NULL;
+    char address[HC05_ADDRESS_TEXT_LENGTH];
+    int retval = EXIT_SUCCESS;
+    int i;
+
+    if (!buffer || length < 3 || cmd >= hc05_at_count)
+        return -1;
+
+    entry = &hc05AtCatalog[cmd];
+    if (!(entry->ops & op))
+        return -1;
+
+    strcpy(buffer, "AT");
+    if (entry->name[0]) {
+        retval |= hc05at_append(buffer, length, "+");
+        retval |= hc05at_append(buffer, length, entry->name);
+    }
+
+    if (op == hc05_op_set) {
+        retval |= hc05at_append(buffer, length, "=");
+        format = entry->setparams;
+    } else if (op == hc05_op_get) {
+        retval |= hc05at_append(buffer, length, "?");
+        format = entry->getparams;
+    }
+
+    for (i = 0; format && format[i] && retval == EXIT_SUCCESS; i++) {
+        if (!params)
+            return -1;
+        if (i)
+            retval |= hc05at_append(buffer, length, ",");
+
+        switch (format[i]) {
+            case 'u':
+                retval |= hc05at_appendnumber(buffer, length, params[i].u, 10);
+                break;
+            case 'x':
+                retval |= hc05at_appendnumber(buffer, length, params[i].u, 16);
+                break;
+            case 's':
+                retval |= hc05at_append(buffer, length, params[i].s ? params[i].s : "");
+                break;
+            case 'a':
+                //the commands take the address with commas
+                hc05FormatAddress(&params[i].a, address, ',');
+                retval |= hc05at_append(buffer, length, address);
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return retval == EXIT_SUCCESS ? (int)strlen(buffer) : -1;
+}
+
+/*!
+ * \brief Parses the answer of a command into typed values
+ *
+ *  The values of "+NAME:v1,v2,..." are converted by the response format of the catalog.
+ *  A string as the last value takes the rest of the line (names may contain commas).
+ *
+ * \param[in] cmd The command the answer belongs to
+ * \param[in] result The answer
+ * \param[out] response The values
+ * \return EXIT_SUCCESS or EXIT_FAILURE if the command failed or the answer does not match the format
+ */
+int hc05AtParse(enum hc05_at_cmd_t cmd, const struct hc05_at_result_t *result,
+                struct hc05_at_response_t *response){
+
+    const char *format;
+    char *field;
+    int i;
+
+    if (!result || !response || cmd >= hc05_at_count)
+        return EXIT_FAILURE;
+
+    response->count = 0;
+    response->text[0] = '\0';
+
+    if (result->status != at_ok)
+        return EXIT_FAILURE;
+
+    format = hc05AtCatalog[cmd].response;
+    if (!format)
+        return EXIT_SUCCESS;
+    if (!result->infolines)
+        return EXIT_FAILURE;
+
+    strncpy(response->text, result->value, HC05_AT_LINE_LENGTH);
+    response->text[HC05_AT_LINE_LENGTH] = '\0';
+
+    field = response->text;
+    for (i = 0; format[i] && i < HC05_AT_MAX_PARAMS; i++) {
+        char *next = NULL;
+        char *end;
+
+        if (!field)
+            return EXIT_FAILURE;
+
+        if (format[i + 1]) {
+            next = strchr(field, ',');
+            if (next)
+                *next++ = '\0';
+        }
+
+        switch (format[i]) {
+            case 'u':
+            case 'x':
+                response->values[i].u = strtoul(field, &end, format[i] == 'u' ? 10 : 16);
+                if (end == field)
+                    return EXIT_FAILURE;
+                break;
+            case 's':
+                response->values[i].s = field;
+                break;
+            case 'a':
+                if (hc05ParseAddress(field, &response->values[i].a) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+
+        response->count++;
+        field = next;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Renders, executes and parses a command of the catalog
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[in] cmd The command
+ * \param[in] op The form of the command
+ * \param[in] params The parameters, see hc05AtRender
+ * \param[out] response The parsed answer, may be NULL
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05AtCall(struct BluetoothDriver *instance, enum hc05_at_cmd_t cmd, enum hc05_at_op_t op,
+               const union hc05_at_value_t *params, struct hc05_at_response_t *response){
+
+    char command[HC05_AT_COMMAND_LENGTH+1];
+    struct hc05_at_result_t result;
+    struct hc05_at_response_t localresponse;
+
+    if (!instance || hc05AtRender(command, sizeof(command), cmd, op, params) < 0)
+        return EXIT_FAILURE;
+
+    if (hc05executeAtCommand(instance, command, &result, HC05_AT_DEFAULT_TIMEOUT_MS) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return hc05AtParse(cmd, &result, response ? response : &localresponse);
+}
+
+/*!
+ * \brief Tells if a command only takes effect after a restart of the module
+ *
+ *  After a fast AT mode entry the module is then restarted on the way back to communication mode.
+ *
+ * \param[in] command The command, without "\r\n"
+ * \return 1 if it does, 0 if not or if the command is not in the catalog
+ */
+int hc05AtNeedsReset(const char *command){
+
+    enum hc05_at_op_t op;
+    size_t length;
+    int i;
+
+    if (!command || strncmp(command, "AT+", 3))
+        return 0;
+
+    command += 3;
+    length = strcspn(command, "=?");
+    if (command[length] == '=')
+        op = hc05_op_set;
+    else if (command[length] == '?')
+        op = hc05_op_get;
+    else
+        op = hc05_op_exec;
+
+    for (i = 0; i < hc05_at_count; i++)
+        if (strlen(hc05AtCatalog[i].name) == length && !strncmp(hc05AtCatalog[i].name, command, length))
+            return (hc05AtCatalog[i].resetops & op) ? 1 : 0;
+
+    return 0;
+}
+
+/*!
+ * \brief Returns the address of the module
+ *
+ *  Asked once, later calls cost nothing.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] address The address
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05GetAddress(struct BluetoothDriver *instance, struct hc05_bdaddr_t *address){
+
+    struct hc05_at_response_t response;
+
+    if (!address)
+        return EXIT_FAILURE;
+
+    if (!hc05AtCache.addressvalid) {
+        if (hc05AtCall(instance, hc05_at_addr, hc05_op_get, NULL, &response) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        hc05AtCache.address = response.values[0].a;
+        hc05AtCache.addressvalid = 1;
+    }
+
+    *address = hc05AtCache.address;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Returns the firmware version of the module
+ *
+ *  Asked once, later calls cost nothing.
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] version The version, '\0' terminated
+ * \param[in] length Size of version
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05GetVersion(struct BluetoothDriver *instance, char *version, int length){
+
+    struct hc05_at_response_t response;
+
+    if (!version || length < 1)
+        return EXIT_FAILURE;
+
+    if (!hc05AtCache.versionvalid) {
+        if (hc05AtCall(instance, hc05_at_version, hc05_op_get, NULL, &response) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        strncpy(hc05AtCache.version, response.values[0].s, HC05_VERSION_LENGTH);
+        hc05AtCache.version[HC05_VERSION_LENGTH] = '\0';
+        hc05AtCache.versionvalid = 1;
+    }
+
+    strncpy(version, hc05AtCache.version, length - 1);
+    version[length - 1] = '\0';
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Asks the module for its state
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] state The state, hc05_module_unknown if the answer is not known
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05GetModuleState(struct BluetoothDriver *instance, enum hc05_module_state_t *state){
+
+    struct hc05_at_response_t response;
+    unsigned int i;
+
+    if (!state)
+        return EXIT_FAILURE;
+
+    *state = hc05_module_unknown;
+
+    if (hc05AtCall(instance, hc05_at_state, hc05_op_get, NULL, &response) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < sizeof(hc05ModuleStateNames) / sizeof(hc05ModuleStateNames[0]); i++)
+        if (!strcmp(response.values[0].s, hc05ModuleStateNames[i]))
+            *state = (enum hc05_module_state_t)i;
+
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Asks the module for its serial settings
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] uart The settings
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05GetUart(struct BluetoothDriver *instance, struct hc05_uart_t *uart){
+
+    struct hc05_at_response_t response;
+
+    if (!uart || hc05AtCall(instance, hc05_at_uart, hc05_op_get, NULL, &response) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    uart->baudrate = response.values[0].u;
+    uart->stopbits = response.values[1].u;
+    uart->parity = response.values[2].u;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Asks the module how many devices are in its pairing list
+ *
+ * \param[in] instance A BluetoothDriver object
+ * \param[out] count The number of paired devices
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int hc05GetPairedCount(struct BluetoothDriver *instance, int *count){
+
+    struct hc05_at_response_t response;
+
+    if (!count || hc05AtCall(instance, hc05_at_adcn, hc05_op_get, NULL, &response) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    *count = (int)response.values[0].u;
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * \brief Returns the name of a module state
+ *
+ * \param[in] state The state
+ * \return the name as AT+STATE? prints it
+ */
+const char *hc05ModuleStateName(enum hc05_module_state_t state){
+
+    if ((unsigned int)state >= sizeof(hc05ModuleStateNames) / sizeof(hc05ModuleStateNames[0]))
+        state = hc05_module_unknown;
+
+    return hc05ModuleStateNames[state];
+}
+
+#endif //HAL_USE_HC_05_BLUETOOTH
+/** @} */
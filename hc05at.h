@@ -0,0 +1,177 @@
+/*!
+ * @file hc05at.h
+ * @brief Header file for the AT command catalog of the HC-05 SPP device for bluetooth module in ChibiosRT.
+ *
+ * @addtogroup BLUETOOTH
+ * @{
+ */
+
+#ifndef HC05AT_H_INCLUDED
+#define HC05AT_H_INCLUDED
+
+#include "hal.h"
+#include "bluetooth.h"
+#include "hc05.h"
+
+#if HAL_USE_HC_05_BLUETOOTH || defined(__DOXYGEN__) || 1
+
+/*===========================================================================*/
+/* Driver pre-compile time settings.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief   Most parameters a command takes or answers.
+ */
+#define HC05_AT_MAX_PARAMS 4
+
+/**
+ * @brief   Longest firmware version string kept by hc05GetVersion.
+ */
+#if !defined(HC05_VERSION_LENGTH) || defined(__DOXYGEN__)
+#define HC05_VERSION_LENGTH 32
+#endif
+
+/*===========================================================================*/
+/* Driver data structures and types.                                         */
+/*===========================================================================*/
+
+/**
+ * @brief The HC-05 AT commands, index of hc05AtCatalog
+ */
+enum hc05_at_cmd_t{
+    hc05_at_test = 0,       //AT
+    hc05_at_reset,          //AT+RESET
+    hc05_at_version,        //AT+VERSION?
+    hc05_at_orgl,           //AT+ORGL
+    hc05_at_addr,           //AT+ADDR?
+    hc05_at_name,           //AT+NAME=name, AT+NAME?
+    hc05_at_rname,          //AT+RNAME?address
+    hc05_at_role,           //AT+ROLE=role, AT+ROLE?
+    hc05_at_class,          //AT+CLASS=class, AT+CLASS?
+    hc05_at_iac,            //AT+IAC=iac, AT+IAC?
+    hc05_at_inqm,           //AT+INQM=mode,max,timeout, AT+INQM?
+    hc05_at_pswd,           //AT+PSWD=pin, AT+PSWD?
+    hc05_at_uart,           //AT+UART=baud,stop,parity, AT+UART?
+    hc05_at_cmode,          //AT+CMODE=mode, AT+CMODE?
+    hc05_at_bind,           //AT+BIND=address, AT+BIND?
+    hc05_at_polar,          //AT+POLAR=pio8,pio9, AT+POLAR?
+    hc05_at_pio,            //AT+PIO=pin,level
+    hc05_at_mpio,           //AT+MPIO=mask, AT+MPIO?
+    hc05_at_ipscan,         //AT+IPSCAN=interval,duration,interval,duration, AT+IPSCAN?
+    hc05_at_sniff,          //AT+SNIFF=max,min,attempt,timeout, AT+SNIFF?
+    hc05_at_senm,           //AT+SENM=security,encryption, AT+SENM?
+    hc05_at_pmsad,          //AT+PMSAD=address
+    hc05_at_rmaad,          //AT+RMAAD
+    hc05_at_fsad,           //AT+FSAD=address
+    hc05_at_adcn,           //AT+ADCN?
+    hc05_at_mrad,           //AT+MRAD?
+    hc05_at_state,          //AT+STATE?
+    hc05_at_init,           //AT+INIT
+    hc05_at_inq,            //AT+INQ, the answers are streamed, see hc05Inquiry
+    hc05_at_inqc,           //AT+INQC
+    hc05_at_pair,           //AT+PAIR=address,timeout
+    hc05_at_link,           //AT+LINK=address
+    hc05_at_disc,           //AT+DISC
+    hc05_at_ensniff,        //AT+ENSNIFF=address
+    hc05_at_exsniff,        //AT+EXSNIFF=address
+    hc05_at_count
+};
+
+/**
+ * @brief Forms of an AT command
+ */
+enum hc05_at_op_t{
+    hc05_op_exec = 1,       //AT+CMD
+    hc05_op_set = 2,        //AT+CMD=params
+    hc05_op_get = 4         //AT+CMD?params
+};
+
+/**
+ * @brief One entry of the catalog
+ *
+ *  The formats have one character per parameter:
+ *  'u' unsigned decimal, 'x' unsigned hexadecimal, 's' string, 'a' Bluetooth address.
+ */
+struct hc05_at_command_t{
+    const char *name;           //after "AT+", empty for the bare "AT"
+    uint8_t ops;                //hc05_at_op_t bits the command supports
+    const char *setparams;      //parameters of the set form
+    const char *getparams;      //parameters of the query form
+    const char *response;       //values of the "+NAME:" answer, NULL if there is none
+    uint8_t resetops;           //hc05_at_op_t bits of the forms that only take effect after a restart
+};
+
+/**
+ * @brief A parameter or answer value, its type is given by the format character
+ */
+union hc05_at_value_t{
+    uint32_t u;                 //'u' and 'x'
+    const char *s;              //'s'
+    struct hc05_bdaddr_t a;     //'a'
+};
+
+/**
+ * @brief States the module reports with AT+STATE?
+ */
+enum hc05_module_state_t{
+    hc05_module_unknown = 0,
+    hc05_module_initialized,
+    hc05_module_ready,
+    hc05_module_pairable,
+    hc05_module_paired,
+    hc05_module_inquiring,
+    hc05_module_connecting,
+    hc05_module_connected,
+    hc05_module_disconnected
+};
+
+/**
+ * @brief Serial settings the module reports with AT+UART?
+ */
+struct hc05_uart_t{
+    uint32_t baudrate;
+    uint32_t stopbits;          //0: 1 bit, 1: 2 bits
+    uint32_t parity;            //0: none, 1: odd, 2: even
+};
+
+/**
+ * @brief Parsed answer of a command
+ *
+ *  The strings point into text.
+ */
+struct hc05_at_response_t{
+    int count;
+    union hc05_at_value_t values[HC05_AT_MAX_PARAMS];
+    char text[HC05_AT_LINE_LENGTH+1];
+};
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+extern const struct hc05_at_command_t hc05AtCatalog[hc05_at_count];
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    int hc05AtRender(char *buffer, int length, enum hc05_at_cmd_t cmd, enum hc05_at_op_t op,
+                     const union hc05_at_value_t *params);
+    int hc05AtParse(enum hc05_at_cmd_t cmd, const struct hc05_at_result_t *result,
+                    struct hc05_at_response_t *response);
+    int hc05AtCall(struct BluetoothDriver *instance, enum hc05_at_cmd_t cmd, enum hc05_at_op_t op,
+                   const union hc05_at_value_t *params, struct hc05_at_response_t *response);
+    int hc05AtNeedsReset(const char *command);
+    int hc05GetAddress(struct BluetoothDriver *instance, struct hc05_bdaddr_t *address);
+    int hc05GetVersion(struct BluetoothDriver *instance, char *version, int length);
+    int hc05GetModuleState(struct BluetoothDriver *instance, enum hc05_module_state_t *state);
+    int hc05GetUart(struct BluetoothDriver *instance, struct hc05_uart_t *uart);
+    int hc05GetPairedCount(struct BluetoothDriver *instance, int *count);
+    const char *hc05ModuleStateName(enum hc05_module_state_t state);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_USE_HC_05_BLUETOOTH */
+
+#endif // HC05AT_H_INCLUDED
+/** @} */
@@ -13,6 +13,13 @@
 #include "chqueues.h"
 #include "bluetooth.h"
 #include "hc05.h"
+#include "hc05at.h"
+#include "btbridge.h"
+#include "btbench.h"
+#include "btframe.h"
+#include "btrpc.h"
+#include "bttelemetry.h"
+#include "btclock.h"
 #include "serial.h"
 #include "serial_lld.h"
 #include "mcuconf.h"
@@ -25,6 +32,22 @@ extern SerialUSBDriver SDU1;
 extern struct BluetoothDriver* BluetoothDriverForConsole;
 char buffer[64];
 
+/*! \brief print the parsed response of an AT command
+*
+*/
+static void hc05PrintAtResult(BaseSequentialStream *chp, struct hc05_at_result_t *result)
+{
+    static const char *statusnames[] = {"OK", "ERROR", "FAIL", "TIMEOUT"};
+
+    chprintf(chp, "Response: %s", statusnames[result->status]);
+    if (result->status == at_error)
+        chprintf(chp, " (code 0x%x)", result->errorcode);
+    chprintf(chp, " in %u ms\r\n", result->elapsedms);
+
+    if (result->infolines)
+        chprintf(chp, "+%s:%s (%i lines)\r\n", result->key, result->value, result->infolines);
+}
+
 /*! \brief set HC 05 to AT mode
 *
 */
@@ -34,8 +57,10 @@ void cmd_hc05SetModeAT(BaseSequentialStream *chp, int argc, char *argv[])
     (void)argc;
 
     chprintf(chp, "Switching to AT mode\r\n");
-    hc05SetModeAt(BluetoothDriverForConsole->config,200);
-    chprintf(chp, "Switched to AT mode\r\n");
+    if (hc05SetModeAt(BluetoothDriverForConsole->config,0) == EXIT_SUCCESS)
+        chprintf(chp, "Switched to AT mode\r\n");
+    else
+        chprintf(chp, "Switch abandoned or timed out\r\n");
 
 }
 
@@ -49,8 +74,10 @@ void cmd_hc05SetModeComm(BaseSequentialStream *chp, int argc, char *argv[])
     (void)argc;
 
     chprintf(chp, "Switching to communication mode\r\n");
-    hc05SetModeComm(BluetoothDriverForConsole->config,200);
-    chprintf(chp, "Switched to communication mode\r\n");
+    if (hc05SetModeComm(BluetoothDriverForConsole->config,0) == EXIT_SUCCESS)
+        chprintf(chp, "Switched to communication mode\r\n");
+    else
+        chprintf(chp, "Switch abandoned or timed out\r\n");
 }
 
 
@@ -92,6 +119,495 @@ void cmd_hc05SetName(BaseSequentialStream *chp, int argc, char *argv[])
     }
 }
 
+/*! \brief set name and PIN with a single AT mode switch
+*
+*/
+void cmd_hc05Configure(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    int failedindex;
+    systime_t start;
+
+    if( argc != 2)
+    {
+        chprintf(chp, "Usage: btconfig name pin\r\n");
+        return;
+    }
+
+    start = chTimeNow();
+
+    if (hc05AtBegin(BluetoothDriverForConsole) != EXIT_SUCCESS)
+    {
+        chprintf(chp, "An AT session is already open\r\n");
+        return;
+    }
+
+    if (hc05setName(BluetoothDriverForConsole, argv[0], strlen(argv[0])) != EXIT_SUCCESS)
+    {
+        hc05AtAbort(BluetoothDriverForConsole);
+        chprintf(chp, "Name too long, at most %i characters\r\n", BLUETOOTH_MAX_NAME_LENGTH);
+        return;
+    }
+
+    if (hc05setPinCode(BluetoothDriverForConsole, argv[1], strlen(argv[1])) != EXIT_SUCCESS)
+    {
+        hc05AtAbort(BluetoothDriverForConsole);
+        chprintf(chp, "PIN too long, at most %i characters\r\n", BLUETOOTH_MAX_PINCODE_LENGTH);
+        return;
+    }
+
+    if (hc05AtCommit(BluetoothDriverForConsole, &failedindex) == EXIT_SUCCESS)
+        chprintf(chp, "Configured in %u ms\r\n", chTimeElapsedSince(start) * 1000 / CH_FREQUENCY);
+    else if (failedindex < 0)
+        chprintf(chp, "The module did not enter AT mode\r\n");
+    else
+        chprintf(chp, "Setting the %s failed\r\n", failedindex == 0 ? "name" : "PIN");
+}
+
+/*! \brief apply the BluetoothConfig to the module and show what the module has
+*
+*/
+void cmd_hc05Sync(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_shadow_t *shadow;
+    systime_t start;
+    int force = (argc == 1 && !strcmp(argv[0], "force"));
+
+    if( argc > 1 || (argc == 1 && !force))
+    {
+        chprintf(chp, "Usage: btsync [force]\r\n");
+        return;
+    }
+
+    start = chTimeNow();
+
+    if (hc05SyncConfig(BluetoothDriverForConsole, force) == EXIT_FAILURE)
+        chprintf(chp, "Sync failed\r\n");
+
+    shadow = hc05GetShadow();
+
+    chprintf(chp, "Synced in %u ms, %s, %i settings written\r\n",
+             chTimeElapsedSince(start) * 1000 / CH_FREQUENCY,
+             shadow->queried ? "module queried" : "cached", shadow->writes);
+    if (shadow->valid)
+        chprintf(chp, "name: %s pin: %s baud: %u role: %i\r\n",
+                 shadow->name, shadow->pincode, shadow->baudrate, shadow->role);
+}
+
+/*! \brief show the latency of the AT mode switches
+*
+*/
+void cmd_hc05SwitchStats(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_modeswitch_stats_t *stats = hc05GetModeSwitchStats();
+    const struct hc05_timing_t *timing = hc05GetTiming();
+
+    if( argc > 1 || (argc == 1 && strcmp(argv[0], "recalibrate") != 0))
+    {
+        chprintf(chp, "Usage: btswitch [recalibrate]\r\n");
+        return;
+    }
+
+    if (argc == 1)
+    {
+        hc05ResetTiming();
+        chprintf(chp, "Boot time will be measured at the next AT mode entry\r\n");
+        return;
+    }
+
+    chprintf(chp, "%6s %6s %10s %10s %10s\r\n", "path", "count", "enter ms", "leave ms", "max enter");
+    chprintf(chp, "%6s %6u %10u %10u %10u\r\n", "fast", stats->fastcount,
+             stats->lastfastenterms, stats->lastfastleavems, stats->maxfastenterms);
+    chprintf(chp, "%6s %6u %10u %10u %10u\r\n", "reset", stats->resetcount,
+             stats->lastresetenterms, stats->lastresetleavems, stats->maxresetenterms);
+    chprintf(chp, "fallbacks: %u\r\n", stats->fallbackcount);
+    chprintf(chp, "key settle %u ms, reset pulse %u ms, boot %u ms (%s, last %u ms)\r\n",
+             timing->keysettlems, timing->resetpulsems, timing->bootms,
+             timing->calibrated ? "measured" : "default", timing->lastbootms);
+    chprintf(chp, "calibrations: %u, failures: %u\r\n", timing->calibrations, timing->failures);
+}
+
+/*! \brief show the connection state and statistics
+*
+*/
+void cmd_hc05Link(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_link_stats_t *stats = hc05GetLinkStats();
+
+    (void)argv;
+    if( argc != 0)
+    {
+        chprintf(chp, "Usage: btlink\r\n");
+        return;
+    }
+
+    chprintf(chp, "%s\r\n", btIsConnected(BluetoothDriverForConsole) ? "connected" : "not connected");
+    chprintf(chp, "connects: %u, disconnects: %u, last change at tick %u\r\n",
+             stats->connects, stats->disconnects, stats->lastchange);
+    chprintf(chp, "dropped: %u bytes, flushed: %u bytes\r\n", stats->droppedbytes, stats->flushedbytes);
+}
+
+/*! \brief show the sniff power policy, or set its idle time
+*
+*/
+void cmd_hc05Power(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_power_stats_t *stats = hc05GetPowerStats();
+    struct hc05_config_t *hc05config = BluetoothDriverForConsole->config->myhc05config;
+
+    if( argc > 1)
+    {
+        chprintf(chp, "Usage: btpower [idle ms, 0 to disable]\r\n");
+        return;
+    }
+
+    if (argc == 1)
+        hc05config->sniffidlems = atoi(argv[0]);
+
+    chprintf(chp, "idle time: %i ms, %s%s\r\n", hc05config->sniffidlems,
+             stats->sniffing ? "sniffing" : "active",
+             stats->unsupported ? ", not supported by the module" : "");
+    chprintf(chp, "entries: %u, wakeups: %u, failures: %u, in sniff: %u ms\r\n",
+             stats->entries, stats->wakeups, stats->failures, stats->sniffms);
+    chprintf(chp, "wake latency: last %u ms, max %u ms, avg %u ms\r\n",
+             stats->lastwakems, stats->maxwakems,
+             stats->wakeups ? stats->totalwakems / stats->wakeups : 0);
+}
+
+/*! \brief prints a device as soon as the inquiry finds it
+*
+*/
+static int hc05PrintInquiryDevice(const struct hc05_inquiry_device_t *device, void *arg)
+{
+    char address[HC05_ADDRESS_TEXT_LENGTH];
+
+    hc05FormatAddress(&device->address, address, ':');
+    chprintf((BaseSequentialStream *)arg, "%-15s class %06x rssi %4i dBm after %u ms\r\n",
+             address, device->deviceclass, device->rssi, device->foundms);
+
+    return 0;
+}
+
+/*! \brief search for devices, the module must be in master role
+*
+*/
+void cmd_hc05Inquiry(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_inquiry_t *results = hc05GetInquiryResults();
+    int maxdevices = HC05_INQUIRY_MAX_DEVICES;
+    int timeout = 4;
+
+    if( argc > 2)
+    {
+        chprintf(chp, "Usage: btinq [max devices] [timeout in 1.28 s units]\r\n");
+        return;
+    }
+
+    if (argc >= 1)
+        maxdevices = atoi(argv[0]);
+    if (argc == 2)
+        timeout = atoi(argv[1]);
+
+    if (hc05Inquiry(BluetoothDriverForConsole, maxdevices, timeout, hc05PrintInquiryDevice, chp) != EXIT_SUCCESS)
+        chprintf(chp, "Inquiry failed\r\n");
+
+    chprintf(chp, "%i devices", results->count);
+    if (results->missed)
+        chprintf(chp, ", %i did not fit", results->missed);
+    chprintf(chp, "\r\n");
+}
+
+/*! \brief keep a link to a device as master, or show the auto-connect statistics
+*
+*/
+void cmd_hc05AutoConnect(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct hc05_autoconnect_stats_t *stats = hc05GetAutoConnectStats();
+    struct hc05_bdaddr_t address;
+
+    if( argc > 1)
+    {
+        chprintf(chp, "Usage: btauto [address|stop]\r\n");
+        return;
+    }
+
+    if (argc == 1)
+    {
+        if (!strcmp(argv[0], "stop"))
+        {
+            hc05AutoConnectStop();
+            chprintf(chp, "Auto-connect stopped\r\n");
+        }
+        else if (hc05ParseAddress(argv[0], &address) != EXIT_SUCCESS)
+            chprintf(chp, "Address format: NAP:UAP:LAP, hexadecimal\r\n");
+        else if (hc05AutoConnectStart(BluetoothDriverForConsole, &address) != EXIT_SUCCESS)
+            chprintf(chp, "Needs the STATE pin or the fast AT mode\r\n");
+        else
+            chprintf(chp, "Auto-connect started\r\n");
+        return;
+    }
+
+    chprintf(chp, "attempts: %u, failures: %u, connects: %u, drops: %u, next try in %u ms\r\n",
+             stats->attempts, stats->failures, stats->connects, stats->drops, stats->backoffms);
+    chprintf(chp, "time to connect: last %u ms, max %u ms, avg %u ms\r\n",
+             stats->lastconnectms, stats->maxconnectms,
+             stats->connects ? stats->totalconnectms / stats->connects : 0);
+}
+
+/*! \brief show what the module reports about itself
+*
+*/
+void cmd_hc05Info(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    struct hc05_bdaddr_t address;
+    char text[HC05_VERSION_LENGTH+1];
+    enum hc05_module_state_t state;
+    struct hc05_uart_t uart;
+    int paired;
+
+    (void)argv;
+    if( argc != 0)
+    {
+        chprintf(chp, "Usage: btinfo\r\n");
+        return;
+    }
+
+    if (hc05GetAddress(BluetoothDriverForConsole, &address) == EXIT_SUCCESS)
+    {
+        hc05FormatAddress(&address, text, ':');
+        chprintf(chp, "address: %s\r\n", text);
+    }
+    if (hc05GetVersion(BluetoothDriverForConsole, text, sizeof(text)) == EXIT_SUCCESS)
+        chprintf(chp, "version: %s\r\n", text);
+    if (hc05GetModuleState(BluetoothDriverForConsole, &state) == EXIT_SUCCESS)
+        chprintf(chp, "state: %s\r\n", hc05ModuleStateName(state));
+    if (hc05GetUart(BluetoothDriverForConsole, &uart) == EXIT_SUCCESS)
+        chprintf(chp, "uart: %u baud, stop bits %u, parity %u\r\n", uart.baudrate, uart.stopbits, uart.parity);
+    if (hc05GetPairedCount(BluetoothDriverForConsole, &paired) == EXIT_SUCCESS)
+        chprintf(chp, "paired devices: %i\r\n", paired);
+}
+
+/*! \brief bridge the console to the bluetooth link until "+++"
+*
+*/
+void cmd_hc05Bridge(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    struct hc05_config_t *hc05config = BluetoothDriverForConsole->config->myhc05config;
+    const struct btbridge_stats_t *stats;
+    int sniffidlems;
+    uint32_t elapsedms;
+
+    (void)argv;
+    if( argc != 0)
+    {
+        chprintf(chp, "Usage: btbridge, leave with +++ after a pause\r\n");
+        return;
+    }
+
+    if (!BluetoothDriverForConsole->driverIsReady || hc05GetState() != st_ready_communication)
+    {
+        chprintf(chp, "Needs the communication mode\r\n");
+        return;
+    }
+    //the pumps write to the serial driver directly, nothing would wake a sniffing link
+    if (hc05GetPowerStats()->sniffing)
+    {
+        chprintf(chp, "The link is in sniff mode, try again after some traffic\r\n");
+        return;
+    }
+
+    sniffidlems = hc05config->sniffidlems;
+    hc05config->sniffidlems = 0;
+
+    if (btBridgeStart((BaseChannel *)chp, (BaseChannel *)hc05config->hc05serialpointer) != EXIT_SUCCESS)
+    {
+        hc05config->sniffidlems = sniffidlems;
+        chprintf(chp, "Bridge already running\r\n");
+        return;
+    }
+    chprintf(chp, "Bridge started, leave with +++\r\n");
+
+    btBridgeWait();
+    hc05config->sniffidlems = sniffidlems;
+
+    stats = btBridgeGetStats();
+    elapsedms = stats->elapsedms ? stats->elapsedms : 1;
+    chprintf(chp, "\r\nhost to bt: %u bytes in %u chunks, %u bytes/s\r\n",
+             stats->hosttobt, stats->hostchunks, (uint32_t)(((uint64_t)stats->hosttobt * 1000) / elapsedms));
+    chprintf(chp, "bt to host: %u bytes in %u chunks, %u bytes/s\r\n",
+             stats->bttohost, stats->btchunks, (uint32_t)(((uint64_t)stats->bttohost * 1000) / elapsedms));
+}
+
+/*! \brief measure the link against tools/btbench.py
+*
+*/
+void cmd_hc05Bench(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    struct btbench_config_t config = {100, 64, 1, 1000};
+    struct btbench_result_t result;
+    uint32_t elapsedms;
+
+    if (argc > 3 || (argc > 2 && !strcmp(argv[0], "reflect")))
+    {
+        chprintf(chp, "Usage: btbench [frames] [payload] [window]\r\n");
+        chprintf(chp, "       btbench reflect [idle seconds]\r\n");
+        chprintf(chp, "       btbench echo [stop]\r\n");
+        return;
+    }
+
+    if (!BluetoothDriverForConsole->driverIsReady || hc05GetState() != st_ready_communication)
+    {
+        chprintf(chp, "Needs the communication mode\r\n");
+        return;
+    }
+
+    //the driver reflector, raw bytes, runs in the background
+    if (argc > 0 && !strcmp(argv[0], "echo"))
+    {
+        const struct hc05_reflector_stats_t *stats = hc05GetReflectorStats();
+
+        if (argc > 1)
+            btStopReflector(BluetoothDriverForConsole);
+        else if (btStartReflector(BluetoothDriverForConsole) != EXIT_SUCCESS)
+            chprintf(chp, "Echo already running or driver not ready\r\n");
+
+        chprintf(chp, "echo %s: %u bytes in %u bursts, largest %u, stalls: %u\r\n",
+                 stats->running ? "running" : "stopped",
+                 stats->bytes, stats->bursts, stats->maxburst, stats->stalls);
+        return;
+    }
+
+    if (argc > 0 && !strcmp(argv[0], "reflect"))
+    {
+        chprintf(chp, "Reflecting, stops when idle\r\n");
+        btBenchReflect(BluetoothDriverForConsole, argc > 1 ? atoi(argv[1]) * 1000 : 10000, &result);
+        chprintf(chp, "echoed: %u frames, %u bytes, corrupt: %u, gaps: %u, out of order: %u\r\n",
+                 result.received, result.bytes, result.corrupt, result.lost, result.outoforder);
+        return;
+    }
+
+    if (argc > 0)
+        config.frames = atoi(argv[0]);
+    if (argc > 1)
+        config.payload = atoi(argv[1]);
+    if (argc > 2)
+        config.window = atoi(argv[2]);
+
+    if (btBenchRun(BluetoothDriverForConsole, &config, &result) != EXIT_SUCCESS)
+    {
+        chprintf(chp, "payload up to %i, window 1 to %i\r\n", BTBENCH_MAX_PAYLOAD, BTBENCH_MAX_WINDOW);
+        return;
+    }
+
+    elapsedms = result.elapsedms ? result.elapsedms : 1;
+    chprintf(chp, "sent: %u, back: %u, lost: %u (%u.%u%%), corrupt: %u, out of order: %u\r\n",
+             result.sent, result.received, result.lost,
+             (result.lost * 100) / result.sent, ((result.lost * 1000) / result.sent) % 10,
+             result.corrupt, result.outoforder);
+    chprintf(chp, "throughput: %u payload bytes/s each way in %u ms, window %u\r\n",
+             (uint32_t)(((uint64_t)result.bytes * 1000) / elapsedms), result.elapsedms, result.window);
+    chprintf(chp, "rtt: min %u, p50 %u, p90 %u, p99 %u, max %u ms\r\n",
+             result.rttminms, result.rttp50ms, result.rttp90ms, result.rttp99ms, result.rttmaxms);
+}
+
+/*! \brief start or stop the framed RPC service, show its statistics
+*
+*/
+void cmd_hc05Rpc(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct btframe_stats_t *frames = btFrameGetStats();
+    const struct btrpc_stats_t *rpc = btRpcGetStats();
+
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "start") && strcmp(argv[0], "stop")))
+    {
+        chprintf(chp, "Usage: btrpc [start|stop]\r\n");
+        return;
+    }
+
+    if (argc == 1 && !strcmp(argv[0], "stop"))
+        btFrameStop();
+    else if (argc == 1 && btFrameStart(BluetoothDriverForConsole) != EXIT_SUCCESS)
+        chprintf(chp, "Already running\r\n");
+
+    chprintf(chp, "frames %s: in %u, out %u, crc errors %u, overflows %u, unhandled %u, send failures %u\r\n",
+             frames->running ? "running" : "stopped", frames->rxframes, frames->txframes,
+             frames->crcerrors, frames->overflows, frames->unhandled, frames->txfailures);
+    chprintf(chp, "rpc: requests %u, errors %u, dropped %u, last %u us, max %u us\r\n",
+             rpc->requests, rpc->errors, rpc->dropped, rpc->lastus, rpc->maxus);
+}
+
+/*! \brief stream the accelerometer in delta encoded batches, show the throughput
+*
+*/
+void cmd_hc05Telemetry(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct bttelemetry_stats_t *stats;
+
+    if (argc > 2 || (argc == 1 && strcmp(argv[0], "stop")))
+    {
+        chprintf(chp, "Usage: bttelem [rate batch | stop]\r\n");
+        return;
+    }
+
+    if (argc == 1)
+        btTelemetryStop();
+    else if (argc == 2)
+    {
+        struct bttelemetry_config_t config;
+
+        config.spip = &SPID1;
+        config.ratehz = atoi(argv[0]);
+        config.batch = atoi(argv[1]);
+        if (btTelemetryStart(BluetoothDriverForConsole, &config) != EXIT_SUCCESS)
+        {
+            chprintf(chp, "Already running or rate 1..%d dividing %d, batch 1..%d\r\n",
+                     BTTELEMETRY_MAX_RATE, CH_FREQUENCY, BTTELEMETRY_MAX_BATCH);
+            return;
+        }
+    }
+
+    stats = btTelemetryGetStats();
+    chprintf(chp, "telemetry %s: %u samples in %u frames, %u bytes, %u ms\r\n",
+             stats->running ? "running" : "stopped", stats->samples, stats->frames,
+             stats->bytes, stats->elapsedms);
+    chprintf(chp, "%u samples/s, %u.%02u bytes/sample, overruns %u, send failures %u\r\n",
+             stats->samplespersecond, stats->bytespersample100 / 100, stats->bytespersample100 % 100,
+             stats->overruns, stats->failures);
+}
+
+/*! \brief synchronize the clock with the host, show the offset, drift and accuracy
+*
+*/
+void cmd_hc05Clock(BaseSequentialStream *chp, int argc, char *argv[])
+{
+    const struct btclock_stats_t *stats;
+    uint64_t host;
+    int64_t offset;
+
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "start") && strcmp(argv[0], "stop")))
+    {
+        chprintf(chp, "Usage: btclock [start|stop]\r\n");
+        return;
+    }
+
+    if (argc == 1 && !strcmp(argv[0], "stop"))
+        btClockStop();
+    else if (argc == 1 && btClockStart(BluetoothDriverForConsole) != EXIT_SUCCESS)
+        chprintf(chp, "Already running or no frames, start them with btrpc start\r\n");
+
+    stats = btClockGetStats();
+    host = btTimeToHost(btClockNow());
+    offset = stats->offsetus < 0 ? -stats->offsetus : stats->offsetus;
+
+    chprintf(chp, "clock %s, %s: exchanges %u, timeouts %u, samples %u\r\n",
+             stats->running ? "running" : "stopped", stats->synced ? "synchronized" : "not synchronized",
+             stats->exchanges, stats->timeouts, stats->samples);
+    chprintf(chp, "offset %s%u.%06u s, drift %d ppb, round trip %u us, accuracy %u us\r\n",
+             stats->offsetus < 0 ? "-" : "", (uint32_t)(offset / 1000000), (uint32_t)(offset % 1000000),
+             stats->driftppb, stats->delayus, stats->accuracyus);
+    chprintf(chp, "%s time %u.%06u s\r\n", stats->synced ? "host" : "device",
+             (uint32_t)(host / 1000000), (uint32_t)(host % 1000000));
+}
+
 /*! \brief reset HC05 settings to factory defaults
 *
 */
@@ -126,13 +642,13 @@ void cmd_hc05SendATCommand(BaseSequentialStream *chp, int argc, char *argv[])
     }
     else
     {
-        chprintf(chp, "Sending command: %s\r\n", argv[0]);
+        struct hc05_at_result_t result;
 
-        chprintf(chp, "commandLength: %i\r\n", strlen(argv[0]));
+        chprintf(chp, "Sending command: %s\r\n", argv[0]);
 
-        hc05sendAtCommand(BluetoothDriverForConsole, argv[0]);
+        hc05executeAtCommand(BluetoothDriverForConsole, argv[0], &result, HC05_AT_DEFAULT_TIMEOUT_MS);
 
-        chprintf(chp, "Command sent: %s\r\n", argv[0]);
+        hc05PrintAtResult(chp, &result);
     }
 }
 
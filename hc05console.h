@@ -35,6 +35,19 @@ extern "C" {
     void cmd_hc05GetBuffer(BaseSequentialStream *chp, int argc, char *argv[]);
     void cmd_hc05SendATCommand(BaseSequentialStream *chp, int argc, char *argv[]);
     void cmd_hc05SetName(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Configure(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Sync(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05SwitchStats(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Link(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Power(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Inquiry(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05AutoConnect(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Info(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Bridge(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Bench(BaseSequentialStream *chp, int argc, char *argv[]);
+    void cmd_hc05Rpc(BaseSequentialStream *chp, int argc, char *argv[]);
+void cmd_hc05Telemetry(BaseSequentialStream *chp, int argc, char *argv[]);
+void cmd_hc05Clock(BaseSequentialStream *chp, int argc, char *argv[]);
     void cmd_hc05resetDefaults(BaseSequentialStream *chp, int argc, char *argv[]);
 
 #ifdef __cplusplus
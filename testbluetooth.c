@@ -16,6 +16,13 @@
 
 #include "testbluetooth.h"
 #include "hc05console.h"
+#include "btbridge.h"
+#include "btline.h"
+#include "btdispatch.h"
+#include "btframe.h"
+#include "btrpc.h"
+#include "btstack.h"
+#include "btcpu.h"
 
 #include "usbcfg.h"
 
@@ -30,7 +37,9 @@ SerialUSBDriver SDU1;
 struct BluetoothDriver* BluetoothDriverForConsole;
 
 void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
+#if CH_USE_HEAP
   size_t n, size;
+#endif
 
   (void)argv;
   if (argc > 0) {
@@ -38,10 +47,14 @@ void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
     chprintf(chp, "Strlen argv0: %i", strlen(argv[0]));
     return;
   }
-  n = chHeapStatus(NULL, &size);
   chprintf(chp, "core free memory : %u bytes\r\n", chCoreStatus());
+#if CH_USE_HEAP
+  n = chHeapStatus(NULL, &size);
   chprintf(chp, "heap fragments   : %u\r\n", n);
   chprintf(chp, "heap free total  : %u bytes\r\n", size);
+#else
+  chprintf(chp, "heap             : off, all static\r\n");
+#endif
 }
 
 void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[])
@@ -50,27 +63,261 @@ void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[])
   Thread *tp;
 
   (void)argv;
-  if (argc > 0)
+  if (argc > 1 || (argc == 1 && strcmp(argv[0], "stacks")))
+  {
+    chprintf(chp, "Usage: threads [stacks]\r\n");
+    return;
+  }
+
+#if CH_DBG_FILL_THREADS
+  if (argc == 1)
+  {
+    static struct btstack_usage_t usage[BTSTACK_PEAKS];
+    int count = btStackGetUsage(usage, BTSTACK_PEAKS);
+    int i, reclaim = 0;
+
+    //sizes as the n of THD_WA_SIZE(n), ended threads with the peak they reached
+    chprintf(chp, "%20s %8s %6s %6s %6s %12s  %s\r\n",
+             "name", "state", "size", "used", "peak", "recommended", "setting");
+    for (i = 0; i < count; i++)
+    {
+      chprintf(chp, "%20s %8s %6u %6u %6u %12u  %s\r\n",
+               usage[i].name, usage[i].running ? "running" : "ended", usage[i].size,
+               usage[i].used, usage[i].peak, usage[i].recommended,
+               usage[i].macro ? usage[i].macro : "-");
+      reclaim += (int)usage[i].size - (int)usage[i].recommended;
+    }
+    chprintf(chp, "%d bytes to reclaim with the recommended sizes, %u bytes margin each\r\n",
+             reclaim, BTSTACK_MARGIN);
+    return;
+  }
+#else
+  if (argc == 1)
   {
-    chprintf(chp, "Usage: threads\r\n");
+    chprintf(chp, "Build with USE_STACK_PROFILING = yes for the stack use\r\n");
     return;
   }
-  chprintf(chp, "%20s %10s %10s %6s %6s %11s %7s\r\n",
+#endif
+
+  chprintf(chp, "%20s %10s %10s %6s %6s %11s %7s",
            "name", "add", "stack", "prio", "refs", "state", "time");
+#if CH_DBG_FILL_THREADS
+  chprintf(chp, " %6s %6s %6s", "size", "used", "peak");
+#endif
+  chprintf(chp, "\r\n");
   tp = chRegFirstThread();
   do
   {
-    chprintf(chp, "%20s %.10lx %.10lx %6lu %6lu %11s %7lu\r\n",
+    chprintf(chp, "%20s %.10lx %.10lx %6lu %6lu %11s %7lu",
              (uint32_t)tp->p_name, (uint32_t)tp, (uint32_t)tp->p_ctx.r13,
              (uint32_t)tp->p_prio, (uint32_t)(tp->p_refs - 1),
              states[tp->p_state], (uint32_t)tp->p_time);
+#if CH_DBG_FILL_THREADS
+    {
+      struct btstack_usage_t usage;
+
+      if (btStackGetThreadUsage(tp, &usage) == EXIT_SUCCESS)
+        chprintf(chp, " %6u %6u %6u", usage.size, usage.used, usage.peak);
+    }
+#endif
+    chprintf(chp, "\r\n");
     tp = chRegNextThread(tp);
   } while (tp != NULL);
 }
 
+/*! \brief prints CPU loads, the busiest thread first
+*
+*/
+static void testbt_printcpu(BaseSequentialStream *chp, struct btcpu_usage_t *usage, int count)
+{
+  int order[BTCPU_THREADS];
+  int i, j, link = 0, idle = 0, other = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    for (j = i; j > 0 && usage[order[j - 1]].load < usage[i].load; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+  }
+
+  chprintf(chp, "%20s %7s %7s %9s %7s\r\n", "name", "cpu%", "peak%", "peak at s", "avg%");
+  for (i = 0; i < count; i++)
+  {
+    const struct btcpu_usage_t *u = &usage[order[i]];
+
+    chprintf(chp, "%20s %5u.%u %5u.%u %9u %5u.%u%s\r\n", u->name,
+             u->load / 10, u->load % 10, u->peak / 10, u->peak % 10, u->peakms / 1000,
+             u->average / 10, u->average % 10, u->running ? "" : " ended");
+    if (!strcmp(u->name, "idle"))
+      idle += u->load;
+    else if (u->link)
+      link += u->load;
+    else
+      other += u->load;
+  }
+  chprintf(chp, "link %u.%u%%, application %u.%u%%, idle %u.%u%%\r\n",
+           link / 10, link % 10, other / 10, other % 10, idle / 10, idle % 10);
+}
+
+void cmd_top(BaseSequentialStream *chp, int argc, char *argv[])
+{
+  static struct btcpu_usage_t usage[BTCPU_THREADS];
+  uint32_t window = BTCPU_WINDOW_MS;
+  int count = 1, n;
+
+  if (argc >= 1 && !strcmp(argv[0], "start"))
+  {
+    if (argc == 2)
+      window = atoi(argv[1]);
+    if (argc > 2 || btCpuStart(window) != EXIT_SUCCESS)
+      chprintf(chp, "Already running or bad window\r\n");
+    return;
+  }
+  if (argc == 1 && !strcmp(argv[0], "stop"))
+  {
+    btCpuStop();
+    return;
+  }
+  if (argc == 1 && !strcmp(argv[0], "reset"))
+  {
+    btCpuReset();
+    return;
+  }
+  if (argc == 1 && !strcmp(argv[0], "peaks"))
+  {
+    testbt_printcpu(chp, usage, btCpuGetUsage(usage, BTCPU_THREADS));
+    return;
+  }
+
+  if (argc > 2 || (argc >= 1 && (int)(window = atoi(argv[0])) <= 0) ||
+      (argc == 2 && (count = atoi(argv[1])) <= 0))
+  {
+    chprintf(chp, "Usage: top [window ms [count]] | peaks | reset | start [window ms] | stop\r\n");
+    return;
+  }
+
+  while (count--)
+  {
+    //the background sampler has the windows, show its next one
+    if (btCpuIsRunning())
+    {
+      chThdSleepMilliseconds(window);
+      n = btCpuGetUsage(usage, BTCPU_THREADS);
+    }
+    else
+      n = btCpuSample(window, usage, BTCPU_THREADS);
+    testbt_printcpu(chp, usage, n);
+  }
+}
+
+/*! \brief LEDs of the board on GPIOD, by name
+*
+*/
+static const struct {
+    const char *name;
+    unsigned pad;
+} testBtLeds[] = {
+    {"orange", GPIOD_LED3},
+    {"green", GPIOD_LED4},
+    {"red", GPIOD_LED5},
+    {"blue", GPIOD_LED6}
+};
+
+static void testbt_orangeon(struct BluetoothDriver *instance, int argc, char *argv[]) {
+    (void)instance; (void)argc; (void)argv;
+    palSetPad(GPIOD, GPIOD_LED3);
+}
+
+static void testbt_orangeoff(struct BluetoothDriver *instance, int argc, char *argv[]) {
+    (void)instance; (void)argc; (void)argv;
+    palClearPad(GPIOD, GPIOD_LED3);
+}
+
+/*! \brief led color on|off
+*
+*/
+static void testbt_led(struct BluetoothDriver *instance, int argc, char *argv[]) {
+    unsigned i;
+
+    (void)instance;
+    if (argc != 3)
+        return;
+
+    for (i = 0; i < sizeof(testBtLeds) / sizeof(testBtLeds[0]); i++) {
+        if (strcmp(testBtLeds[i].name, argv[1]))
+            continue;
+        if (!strcmp(argv[2], "on"))
+            palSetPad(GPIOD, testBtLeds[i].pad);
+        else if (!strcmp(argv[2], "off"))
+            palClearPad(GPIOD, testBtLeds[i].pad);
+    }
+}
+
+/*! \brief Commands the demo takes over bluetooth, one per line
+*
+*/
+static const struct btdispatch_command_t testBtCommands[] = {
+    {"orangeon", testbt_orangeon},
+    {"orangeoff", testbt_orangeoff},
+    {"led", testbt_led}
+};
+
+static struct btdispatch_t testBtDispatch;
+static struct btline_t testBtLine;
+
+static void testbt_line(char *line, int length, void *arg) {
+    (void)length;
+    btDispatchLine(&testBtDispatch, arg, line);
+}
+
+/*! \brief RPC 1: led(color index, on)
+*
+*/
+static int testbt_rpcled(struct btcbor_reader_t *params, struct btcbor_writer_t *result) {
+    uint32_t color;
+    int count, on;
+
+    (void)result;
+    if (btCborGetArray(params, &count) != EXIT_SUCCESS || count != 2 ||
+        btCborGetUint(params, &color) != EXIT_SUCCESS || btCborGetBool(params, &on) != EXIT_SUCCESS ||
+        color >= sizeof(testBtLeds) / sizeof(testBtLeds[0]))
+        return BTRPC_ERROR_PARAMS;
+
+    if (on)
+        palSetPad(GPIOD, testBtLeds[color].pad);
+    else
+        palClearPad(GPIOD, testBtLeds[color].pad);
+    return BTRPC_OK;
+}
+
+/*! \brief RPC 2: uptime(), in milliseconds
+*
+*/
+static int testbt_rpcuptime(struct btcbor_reader_t *params, struct btcbor_writer_t *result) {
+    (void)params;
+    btCborPutUint(result, (uint32_t)(((uint64_t)chTimeNow() * 1000) / CH_FREQUENCY));
+    return BTRPC_OK;
+}
+
+/*! \brief RPC 3: name(), of the module as configured
+*
+*/
+static int testbt_rpcname(struct btcbor_reader_t *params, struct btcbor_writer_t *result) {
+    (void)params;
+    btCborPutText(result, BluetoothDriverForConsole->config->name);
+    return BTRPC_OK;
+}
+
+static const struct btrpc_method_entry_t testBtMethods[] = {
+    {1, "led", testbt_rpcled},
+    {2, "uptime", testbt_rpcuptime},
+    {3, "name", testbt_rpcname}
+};
+
 static const ShellCommand commands[] = {
     {"mem", cmd_mem},
     {"threads", cmd_threads},
+    {"top", cmd_top},
     {"modeat", cmd_hc05SetModeAT},
     {"modecomm", cmd_hc05SetModeComm},
     {"btsetname", cmd_hc05SetName},
@@ -79,13 +326,32 @@ static const ShellCommand commands[] = {
     {"btread", cmd_hc05GetBuffer},
     {"btresetdefaults", cmd_hc05resetDefaults},
     {"btsetpin", cmd_hc05SetPin},
+    {"btconfig", cmd_hc05Configure},
+    {"btsync", cmd_hc05Sync},
+    {"btswitch", cmd_hc05SwitchStats},
+    {"btlink", cmd_hc05Link},
+    {"btpower", cmd_hc05Power},
+    {"btinq", cmd_hc05Inquiry},
+    {"btauto", cmd_hc05AutoConnect},
+    {"btinfo", cmd_hc05Info},
+    {"btbridge", cmd_hc05Bridge},
+    {"btbench", cmd_hc05Bench},
+    {"btrpc", cmd_hc05Rpc},
+    {"bttelem", cmd_hc05Telemetry},
+    {"btclock", cmd_hc05Clock},
 
 
 
     {NULL,NULL}
 };
 
-#define SHELL_WA_SIZE THD_WA_SIZE(2048)
+#define SHELL_STACK_SIZE 2048
+#define SHELL_WA_SIZE THD_WA_SIZE(SHELL_STACK_SIZE)
+
+#if !CH_USE_HEAP || !CH_USE_DYNAMIC
+//without the heap the shell runs in a static working area, one at a time
+static WORKING_AREA(testBtShellWa, SHELL_STACK_SIZE);
+#endif
 
 extern SerialUSBDriver SDU1;
 
@@ -125,7 +391,16 @@ int main(void){
         .resetpin = 5,
         .keyport = gpioe_port,
         .keypin = 4,
-        .serialdriver = sd2
+        .serialdriver = sd2,
+        //AT mode with the key pin only, if the firmware of the module supports it
+        .fastatmode = 0,
+        //the STATE pin (PIO9) of the module wired to PE6, then set usestatepin = 1. Without the wire
+        //the link never reads up, and with HC05_TX_DROP_WHEN_DISCONNECTED every send is dropped
+        .stateport = gpioe_port,
+        .statepin = 6,
+        .usestatepin = 0,
+        //milliseconds without traffic before sniff mode, needs fastatmode (e.g. 5000)
+        .sniffidlems = 0
     };
 
     static struct BluetoothConfig myTestBluetoothConfig ={
@@ -148,37 +423,47 @@ int main(void){
     BluetoothDriverForConsole = &myTestBluetoothDriver;
 
 
-    btOpen(&myTestBluetoothDriver, &myTestBluetoothConfig);
+    //bring the module up in the background, the shell is usable in the meantime
+    btObjectInit(&myTestBluetoothDriver);
+    btOpenAsync(&myTestBluetoothDriver, &myTestBluetoothConfig);
 
     static char myTestBuffer[TESTBT_BUFFERLEN+1];
     memset(&myTestBuffer, '\0' , TESTBT_BUFFERLEN+1);
 
+    btLineInit(&testBtLine, btline_drop);
+    btDispatchInit(&testBtDispatch, testBtCommands, sizeof(testBtCommands) / sizeof(testBtCommands[0]));
+    btRpcInit(testBtMethods, sizeof(testBtMethods) / sizeof(testBtMethods[0]));
+
 
 
     while(TRUE) {
         if (!shelltp) {
             if(SDU1.config->usbp->state==USB_ACTIVE)
+#if CH_USE_HEAP && CH_USE_DYNAMIC
                 shelltp = shellCreate(&shell_cfg1, SHELL_WA_SIZE, NORMALPRIO);
+#else
+                shelltp = shellCreateStatic(&shell_cfg1, testBtShellWa, sizeof(testBtShellWa), NORMALPRIO);
+#endif
         }
         else {
             if(chThdTerminated(shelltp)) {
+#if CH_USE_DYNAMIC
                 chThdRelease(shelltp);
+#endif
                 shelltp=NULL;
             }
         }
 
 
-        if (btCanRecieve(&myTestBluetoothDriver))
+        //the bridge, the reflector and the frame receiver own the serial driver while they run
+        if (myTestBluetoothDriver.driverIsReady && !btBridgeGetStats()->running &&
+            !hc05GetReflectorStats()->running && !btFrameGetStats()->running &&
+            btCanRecieve(&myTestBluetoothDriver))
         {
-            memset(&myTestBuffer, '\0' , TESTBT_BUFFERLEN+1);
-            btRead(&myTestBluetoothDriver, myTestBuffer, TESTBT_BUFFERLEN);
-            btSend(&myTestBluetoothDriver, myTestBuffer, TESTBT_BUFFERLEN);
-
-            if (!strcmp("orangeon\r\n",myTestBuffer))
-                palSetPad(GPIOD, GPIOD_LED3);
+            int length = btReadTimeout(&myTestBluetoothDriver, myTestBuffer, TESTBT_BUFFERLEN, TIME_IMMEDIATE);
 
-            if (!strcmp("orangeoff\r\n",myTestBuffer))
-                palClearPad(GPIOD, GPIOD_LED3);
+            btSend(&myTestBluetoothDriver, myTestBuffer, length);
+            btLineFeed(&testBtLine, myTestBuffer, length, testbt_line, &myTestBluetoothDriver);
         }
 
 
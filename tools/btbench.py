@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Host side of the btbench shell command.
+
+The frames are described in btbench.c. Open the serial port of the
+bluetooth link (rfcomm, the COM port of the paired module) and:
+
+    btbench.py PORT echo            # target runs: btbench [frames] [payload] [window]
+    btbench.py PORT run [frames] [payload] [window]
+                                    # target runs: btbench reflect (checks the frames)
+                                    # or btbench echo (driver reflector, lowest latency)
+
+Needs pyserial.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+SYNC = b"\x55\xaa"
+HEADER = struct.Struct("<HHI")      # sequence, payload length, timestamp
+MAX_PAYLOAD = 240
+
+
+def fletcher16(data):
+    sum1 = sum2 = 0
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def build_frame(sequence, payload, stamp):
+    body = HEADER.pack(sequence & 0xFFFF, payload, stamp & 0xFFFFFFFF)
+    body += bytes((sequence + i) & 0xFF for i in range(payload))
+    return SYNC + body + struct.pack("<H", fletcher16(body))
+
+
+class Parser:
+    """Collects frames from a byte stream, counts the corrupt ones."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.corrupt = 0
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                del self.buffer[:-1]
+                return frames
+            del self.buffer[:start]
+            if len(self.buffer) < 2 + HEADER.size:
+                return frames
+            sequence, payload, stamp = HEADER.unpack_from(self.buffer, 2)
+            if payload > MAX_PAYLOAD:
+                self.corrupt += 1
+                del self.buffer[:2]
+                continue
+            length = 2 + HEADER.size + payload + 2
+            if len(self.buffer) < length:
+                return frames
+            frame = bytes(self.buffer[:length])
+            del self.buffer[:length]
+            (checksum,) = struct.unpack_from("<H", frame, length - 2)
+            if fletcher16(frame[2:-2]) != checksum:
+                self.corrupt += 1
+                continue
+            frames.append((sequence, payload, stamp, frame))
+
+
+def echo(port):
+    parser = Parser()
+    count = 0
+    print("echoing, ctrl-c to stop")
+    try:
+        while True:
+            for _, _, _, frame in parser.feed(port.read(port.in_waiting or 1)):
+                port.write(frame)
+                count += 1
+    except KeyboardInterrupt:
+        pass
+    print("echoed %d frames, %d corrupt" % (count, parser.corrupt))
+
+
+def percentile(samples, p):
+    return samples[(len(samples) - 1) * p // 100] if samples else 0
+
+
+def run(port, frames, payload, window, timeout):
+    parser = Parser()
+    sent = done = received = lost = outoforder = 0
+    rtts = []
+    epoch = time.monotonic()
+    start = epoch
+    while done < frames:
+        while sent < frames and sent - done < window:
+            stamp = int((time.monotonic() - epoch) * 1000)
+            port.write(build_frame(sent, payload, stamp))
+            sent += 1
+        deadline = time.monotonic() + timeout
+        got = []
+        while not got and time.monotonic() < deadline:
+            got = parser.feed(port.read(port.in_waiting or 1))
+        if not got:
+            lost += sent - done
+            done = sent
+            continue
+        for sequence, length, stamp, _ in got:
+            delta = (sequence - done) & 0xFFFF
+            if delta >= sent - done or length != payload:
+                outoforder += 1
+                continue
+            lost += delta
+            done += delta + 1
+            received += 1
+            rtts.append(int((time.monotonic() - epoch) * 1000) - stamp)
+    elapsed = time.monotonic() - start
+    rtts.sort()
+    print("sent: %d, back: %d, lost: %d (%.1f%%), corrupt: %d, out of order: %d"
+          % (sent, received, lost, 100.0 * lost / sent, parser.corrupt, outoforder))
+    print("throughput: %d payload bytes/s each way in %d ms"
+          % (received * payload / elapsed, elapsed * 1000))
+    if rtts:
+        print("rtt: min %d, p50 %d, p90 %d, p99 %d, max %d ms"
+              % (rtts[0], percentile(rtts, 50), percentile(rtts, 90), percentile(rtts, 99), rtts[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("mode", choices=("echo", "run"))
+    parser.add_argument("frames", type=int, nargs="?", default=100)
+    parser.add_argument("payload", type=int, nargs="?", default=64)
+    parser.add_argument("window", type=int, nargs="?", default=1)
+    parser.add_argument("--baud", type=int, default=38400)
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds until a frame is lost")
+    args = parser.parse_args()
+
+    if not 0 <= args.payload <= MAX_PAYLOAD or args.window < 1:
+        sys.exit("payload up to %d, window at least 1" % MAX_PAYLOAD)
+
+    with serial.Serial(args.port, args.baud, timeout=0.05) as port:
+        if args.mode == "echo":
+            echo(port)
+        else:
+            run(port, args.frames, args.payload, args.window, args.timeout)
+
+
+if __name__ == "__main__":
+    main()
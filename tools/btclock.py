@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Host side of the clock synchronization (btclock.c).
+
+    btclock.py PORT [--seconds N]
+
+Answers the clock exchanges of the target, start them there with
+"btrpc start" and "btclock start", then "btclock" shows the offset, the
+drift and the accuracy. ClockResponder can be installed on the FrameLink
+of other tools, bttelemetry.py does so. Needs pyserial.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+
+import serial
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from btrpc import FrameLink  # noqa: E402
+
+CHANNEL_CLOCK = 3
+
+
+def host_us():
+    return time.time_ns() // 1000
+
+
+class ClockResponder:
+    """Stamps every request on arrival (t2) and just before the answer (t3)."""
+
+    def __init__(self, link):
+        self.link = link
+        self.requests = 0
+        link.set_handler(CHANNEL_CLOCK, self._request)
+
+    def _request(self, payload):
+        received = host_us()
+        if len(payload) != 1:
+            return
+        self.requests += 1
+        self.link.send(CHANNEL_CLOCK, struct.pack("<BQQ", payload[0], received, host_us()))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("--baud", type=int, default=38400)
+    parser.add_argument("--seconds", type=float, default=0, help="0 runs until Ctrl-C")
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, args.baud, timeout=0.05) as port:
+        link = FrameLink(port)
+        responder = ClockResponder(link)
+        start = time.monotonic()
+        try:
+            while not args.seconds or time.monotonic() - start < args.seconds:
+                time.sleep(10)
+                print("%d requests answered" % responder.requests)
+        except KeyboardInterrupt:
+            pass
+        link.close()
+
+
+if __name__ == "__main__":
+    main()
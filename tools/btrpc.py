@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+"""Host side of the framed RPC (btframe.c, btrpc.c).
+
+    btrpc.py PORT list
+    btrpc.py PORT call METHOD [PARAM...]    # METHOD is an id or a name, PARAMs are
+                                            # integers, true/false/null or text
+    btrpc.py PORT bench [CALLS] [CONCURRENT]
+
+Start the service on the target first with "btrpc start". RpcClient can be
+used from other tools: call() blocks, call_async() returns a Future, so
+many calls can be outstanding at once. Needs pyserial.
+"""
+
+import argparse
+import itertools
+import struct
+import sys
+import threading
+import time
+from concurrent.futures import Future
+
+import serial
+
+END, ESC, ESC_END, ESC_ESC = 0xC0, 0xDB, 0xDC, 0xDD
+CHANNEL_RPC = 1
+MAX_PAYLOAD = 200
+
+STATUS = {0: "ok", -1: "unknown method", -2: "bad request", -3: "bad parameters", -4: "result too big"}
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+# CBOR subset, see btcbor.c
+
+def cbor_head(major, argument):
+    if argument < 24:
+        return bytes([(major << 5) | argument])
+    if argument <= 0xFF:
+        return bytes([(major << 5) | 24, argument])
+    if argument <= 0xFFFF:
+        return bytes([(major << 5) | 25]) + struct.pack(">H", argument)
+    return bytes([(major << 5) | 26]) + struct.pack(">I", argument)
+
+
+def cbor_encode(value):
+    if value is None:
+        return b"\xf6"
+    if value is True:
+        return b"\xf5"
+    if value is False:
+        return b"\xf4"
+    if isinstance(value, int):
+        return cbor_head(0, value) if value >= 0 else cbor_head(1, -1 - value)
+    if isinstance(value, (bytes, bytearray)):
+        return cbor_head(2, len(value)) + bytes(value)
+    if isinstance(value, str):
+        data = value.encode()
+        return cbor_head(3, len(data)) + data
+    if isinstance(value, (list, tuple)):
+        return cbor_head(4, len(value)) + b"".join(cbor_encode(v) for v in value)
+    if isinstance(value, dict):
+        return cbor_head(5, len(value)) + b"".join(cbor_encode(k) + cbor_encode(v) for k, v in value.items())
+    raise TypeError("can not encode %r" % (value,))
+
+
+def cbor_decode(data, position=0):
+    """Returns (value, next position)."""
+    initial = data[position]
+    major, info = initial >> 5, initial & 0x1F
+    position += 1
+    if major == 7:
+        return {20: False, 21: True, 22: None}[info], position
+    if info < 24:
+        argument = info
+    else:
+        size = {24: 1, 25: 2, 26: 4}[info]
+        argument = int.from_bytes(data[position:position + size], "big")
+        position += size
+    if major == 0:
+        return argument, position
+    if major == 1:
+        return -1 - argument, position
+    if major in (2, 3):
+        value = bytes(data[position:position + argument])
+        return (value if major == 2 else value.decode()), position + argument
+    if major == 4:
+        items = []
+        for _ in range(argument):
+            item, position = cbor_decode(data, position)
+            items.append(item)
+        return items, position
+    if major == 5:
+        items = {}
+        for _ in range(argument):
+            key, position = cbor_decode(data, position)
+            items[key], position = cbor_decode(data, position)
+        return items, position
+    raise ValueError("unsupported CBOR item 0x%02x" % initial)
+
+
+class FrameLink:
+    """SLIP frames with a channel byte and a CRC-16/CCITT, one reader thread."""
+
+    def __init__(self, port):
+        self.port = port
+        self.handlers = {}
+        self.crcerrors = 0
+        self.lock = threading.Lock()
+        self.running = True
+        self.thread = threading.Thread(target=self._reader, daemon=True)
+        self.thread.start()
+
+    def set_handler(self, channel, handler):
+        self.handlers[channel] = handler
+
+    def send(self, channel, payload):
+        body = bytes([channel]) + bytes(payload)
+        body += struct.pack("<H", crc16(body))
+        encoded = bytearray([END])
+        for byte in body:
+            if byte == END:
+                encoded += bytes([ESC, ESC_END])
+            elif byte == ESC:
+                encoded += bytes([ESC, ESC_ESC])
+            else:
+                encoded.append(byte)
+        encoded.append(END)
+        with self.lock:
+            self.port.write(encoded)
+
+    def close(self):
+        self.running = False
+        self.thread.join()
+
+    def _reader(self):
+        frame = bytearray()
+        escape = False
+        while self.running:
+            for byte in self.port.read(self.port.in_waiting or 1):
+                if byte == END:
+                    self._complete(bytes(frame))
+                    frame.clear()
+                    escape = False
+                elif escape:
+                    frame.append({ESC_END: END, ESC_ESC: ESC}.get(byte, byte))
+                    escape = False
+                elif byte == ESC:
+                    escape = True
+                else:
+                    frame.append(byte)
+
+    def _complete(self, frame):
+        if len(frame) < 3:
+            return
+        if crc16(frame[:-2]) != struct.unpack("<H", frame[-2:])[0]:
+            self.crcerrors += 1
+            return
+        handler = self.handlers.get(frame[0])
+        if handler:
+            handler(frame[1:-2])
+
+
+class RpcError(Exception):
+    def __init__(self, status):
+        Exception.__init__(self, STATUS.get(status, "error %d" % status))
+        self.status = status
+
+
+class RpcClient:
+    def __init__(self, link):
+        self.link = link
+        self.ids = itertools.count(1)
+        self.pending = {}
+        self.lock = threading.Lock()
+        link.set_handler(CHANNEL_RPC, self._reply)
+
+    def call_async(self, method, *params, timeout=1.0):
+        request_id = next(self.ids) & 0xFFFFFFFF
+        future = Future()
+        timer = threading.Timer(timeout, self._expire, (request_id,))
+        with self.lock:
+            self.pending[request_id] = (future, timer)
+        timer.start()
+        self.link.send(CHANNEL_RPC, cbor_encode([request_id, method, list(params)]))
+        return future
+
+    def call(self, method, *params, timeout=1.0):
+        return self.call_async(method, *params, timeout=timeout).result()
+
+    def methods(self):
+        return {name: method_id for method_id, name in self.call(0)}
+
+    def _expire(self, request_id):
+        with self.lock:
+            entry = self.pending.pop(request_id, None)
+        if entry:
+            entry[0].set_exception(TimeoutError("request %d timed out" % request_id))
+
+    def _reply(self, payload):
+        try:
+            (request_id, status, result), _ = cbor_decode(payload)
+        except (ValueError, KeyError, IndexError, TypeError):
+            return
+        with self.lock:
+            entry = self.pending.pop(request_id, None)
+        if not entry:
+            return
+        entry[1].cancel()
+        if status == 0:
+            entry[0].set_result(result)
+        else:
+            entry[0].set_exception(RpcError(status))
+
+
+def parse_param(text):
+    special = {"true": True, "false": False, "null": None}
+    if text in special:
+        return special[text]
+    try:
+        return int(text, 0)
+    except ValueError:
+        return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("command", choices=("list", "call", "bench"))
+    parser.add_argument("args", nargs="*")
+    parser.add_argument("--baud", type=int, default=38400)
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds per call")
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, args.baud, timeout=0.05) as port:
+        link = FrameLink(port)
+        client = RpcClient(link)
+
+        if args.command == "list":
+            for name, method_id in sorted(client.methods().items(), key=lambda item: item[1]):
+                print("%3d %s" % (method_id, name))
+
+        elif args.command == "call":
+            if not args.args:
+                sys.exit("call needs a method")
+            method = args.args[0]
+            method = int(method) if method.isdigit() else client.methods()[method]
+            print(client.call(method, *[parse_param(a) for a in args.args[1:]], timeout=args.timeout))
+
+        else:
+            calls = int(args.args[0]) if args.args else 100
+            concurrent = int(args.args[1]) if len(args.args) > 1 else 4
+            latencies, failures = [], 0
+            start = time.monotonic()
+            for first in range(0, calls, concurrent):
+                batch = []
+                for _ in range(min(concurrent, calls - first)):
+                    batch.append((time.monotonic(), client.call_async(0, timeout=args.timeout)))
+                for sent, future in batch:
+                    try:
+                        future.result()
+                        latencies.append((time.monotonic() - sent) * 1000)
+                    except (RpcError, TimeoutError):
+                        failures += 1
+            elapsed = time.monotonic() - start
+            latencies.sort()
+            print("%d calls, %d failed, %.1f calls/s" % (calls, failures, calls / elapsed))
+            if latencies:
+                print("latency: min %.1f, p50 %.1f, p99 %.1f, max %.1f ms"
+                      % (latencies[0], latencies[len(latencies) // 2],
+                         latencies[(len(latencies) - 1) * 99 // 100], latencies[-1]))
+
+        link.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Host side of the accelerometer telemetry (bttelemetry.c).
+
+    bttelemetry.py PORT [--csv FILE] [--seconds N]
+
+Start the stream on the target first with "bttelem RATE BATCH". Prints the
+throughput once a second and a gap whenever a batch sequence number is
+missing; with --csv every sample goes to FILE as "ms,x,y,z". It answers the
+clock exchanges too, after "btclock start" on the target the times are host
+time (ms since the epoch) instead of ms since the target booted. Needs pyserial.
+"""
+
+import argparse
+import os
+import sys
+import threading
+import time
+
+import serial
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from btclock import ClockResponder  # noqa: E402
+from btrpc import FrameLink  # noqa: E402
+
+CHANNEL_TELEMETRY = 2
+
+
+def varint(data, position):
+    value, shift = 0, 0
+    while True:
+        byte = data[position]
+        position += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, position
+
+
+def decode(payload):
+    """Returns sequence, clock, [(ms, x, y, z), ...] of one frame.
+
+    Clock 0: ms since the device booted, 1: host ms since the epoch.
+    """
+    sequence, position = varint(payload, 0)
+    clock, position = varint(payload, position)
+    start, position = varint(payload, position)
+    period, position = varint(payload, position)
+    count, position = varint(payload, position)
+    samples, previous = [], [0, 0, 0]
+    for index in range(count):
+        for axis in range(3):
+            value, position = varint(payload, position)
+            previous[axis] += (value >> 1) ^ -(value & 1)
+        samples.append((start + index * period / 1000.0, *previous))
+    return sequence, clock, samples
+
+
+class TelemetryReceiver:
+    def __init__(self, link, csv=None):
+        self.csv = csv
+        self.lock = threading.Lock()
+        self.expected = None
+        self.frames = self.samples = self.bytes = self.lost = self.errors = 0
+        self.clock = None
+        link.set_handler(CHANNEL_TELEMETRY, self._frame)
+
+    def _frame(self, payload):
+        try:
+            sequence, clock, samples = decode(payload)
+        except IndexError:
+            self.errors += 1
+            return
+        with self.lock:
+            if self.expected is not None and sequence != self.expected:
+                self.lost += (sequence - self.expected) & 0xFFFFFFFF
+                print("gap: expected batch %d, got %d" % (self.expected, sequence))
+            self.expected = (sequence + 1) & 0xFFFFFFFF
+            self.frames += 1
+            self.samples += len(samples)
+            self.bytes += len(payload)
+            if clock != self.clock:
+                print("times are now %s" % ("host time" if clock else "target time since boot"))
+                self.clock = clock
+        if self.csv:
+            for sample in samples:
+                self.csv.write("%.3f,%d,%d,%d\n" % sample)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port")
+    parser.add_argument("--baud", type=int, default=38400)
+    parser.add_argument("--csv", type=argparse.FileType("w"))
+    parser.add_argument("--seconds", type=float, default=0, help="0 runs until Ctrl-C")
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, args.baud, timeout=0.05) as port:
+        link = FrameLink(port)
+        receiver = TelemetryReceiver(link, args.csv)
+        ClockResponder(link)
+        start = time.monotonic()
+        try:
+            while not args.seconds or time.monotonic() - start < args.seconds:
+                time.sleep(1)
+                elapsed = time.monotonic() - start
+                with receiver.lock:
+                    print("%d frames, %.0f samples/s, %.2f bytes/sample, %d batches lost, %d crc errors"
+                          % (receiver.frames, receiver.samples / elapsed,
+                             receiver.bytes / receiver.samples if receiver.samples else 0,
+                             receiver.lost, link.crcerrors + receiver.errors))
+        except KeyboardInterrupt:
+            pass
+        link.close()
+
+
+if __name__ == "__main__":
+    main()